@@ -0,0 +1,105 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "compress.h"
+
+/*
+ * Measures the block encoding used for the compressed history of a
+ * metric: bytes saved over raw samples, and the cost of encoding and
+ * decoding them. Every update is encoded exactly once, when its block
+ * leaves the ring, so the encode time per sample is the cost added to
+ * each update.
+ */
+
+#define NUM_SAMPLES (64*SYMBIOMON_CHUNK_SIZE)
+#define NUM_REPS    20
+
+static double wtime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static void run(const char* name, const symbiomon_metric_sample* samples, symbiomon_metric_sample* out)
+{
+    uint8_t* blocks[NUM_SAMPLES/SYMBIOMON_CHUNK_SIZE];
+    size_t sizes[NUM_SAMPLES/SYMBIOMON_CHUNK_SIZE];
+    size_t i, b, bytes = 0;
+    double t, encode = 0, decode = 0;
+    int r;
+
+    for(r = 0; r < NUM_REPS; r++) {
+        t = wtime();
+        for(i = 0, b = 0; i < NUM_SAMPLES; i += SYMBIOMON_CHUNK_SIZE, b++)
+            sizes[b] = symbiomon_block_encode(samples + i, SYMBIOMON_CHUNK_SIZE, &blocks[b]);
+        encode += wtime() - t;
+
+        t = wtime();
+        for(i = 0, b = 0; i < NUM_SAMPLES; i += SYMBIOMON_CHUNK_SIZE, b++)
+            symbiomon_block_decode(blocks[b], sizes[b], SYMBIOMON_CHUNK_SIZE, out + i);
+        decode += wtime() - t;
+
+        for(b = 0, bytes = 0; b < NUM_SAMPLES/SYMBIOMON_CHUNK_SIZE; b++) {
+            bytes += sizes[b];
+            free(blocks[b]);
+        }
+    }
+
+    for(i = 0; i < NUM_SAMPLES; i++) {
+        if(out[i].time != samples[i].time || out[i].val != samples[i].val
+        || out[i].sample_id != samples[i].sample_id) {
+            printf("%-10s decoding mismatch at sample %zu\n", name, i);
+            return;
+        }
+    }
+    printf("%-10s %8.2f x %8.2f bytes/sample %8.1f ns/update (encode) %8.1f ns/sample (decode)\n",
+            name, (double)NUM_SAMPLES*sizeof(symbiomon_metric_sample)/bytes,
+            (double)bytes/NUM_SAMPLES, encode*1e9/NUM_SAMPLES/NUM_REPS,
+            decode*1e9/NUM_SAMPLES/NUM_REPS);
+}
+
+int main(void)
+{
+    symbiomon_metric_sample* samples = (symbiomon_metric_sample*)malloc(NUM_SAMPLES*sizeof(*samples));
+    symbiomon_metric_sample* out = (symbiomon_metric_sample*)malloc(NUM_SAMPLES*sizeof(*out));
+    double t = 1.6e9;
+    size_t i;
+
+    if(!samples || !out) return 1;
+    srand(42);
+
+    /* gauge sampled about every 10ms, drifting slowly */
+    for(i = 0; i < NUM_SAMPLES; i++) {
+        t += 0.01 + 1e-6*(rand() % 100);
+        samples[i].time = t;
+        samples[i].val = round(500.0 + 50.0*sin(i/1000.0));
+        samples[i].sample_id = 1 + i/SYMBIOMON_CHUNK_SIZE;
+    }
+    printf("# %d samples in blocks of %d, %d repetitions\n",
+            NUM_SAMPLES, SYMBIOMON_CHUNK_SIZE, NUM_REPS);
+    run("gauge", samples, out);
+
+    /* counter incremented by a few units per update */
+    for(i = 0; i < NUM_SAMPLES; i++) {
+        t += 0.01 + 1e-6*(rand() % 100);
+        samples[i].time = t;
+        samples[i].val = (i ? samples[i-1].val : 0.0) + (rand() % 4);
+    }
+    run("counter", samples, out);
+
+    /* worst case: uniformly random values */
+    for(i = 0; i < NUM_SAMPLES; i++)
+        samples[i].val = (double)rand()/RAND_MAX;
+    run("random", samples, out);
+
+    free(samples);
+    free(out);
+    return 0;
+}
@@ -0,0 +1,133 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <margo.h>
+#include <symbiomon/symbiomon-server.h>
+#include <symbiomon/symbiomon-metric.h>
+#include <symbiomon/symbiomon-common.h>
+#include "provider.h"
+
+/*
+ * Measures what consistent fetches cost. A writer ULT updates a metric
+ * on one execution stream while a reader ULT on another one repeatedly
+ * copies the whole ring, the way symbiomon_metric_fetch_ult does. The
+ * reader either copies without locking (samples overwritten during the
+ * copy are trimmed afterwards) or holds the metric mutex for the copy.
+ */
+
+#define NUM_UPDATES 2000000
+#define CAPACITY    160000
+
+enum reader_mode { NO_READER, SNAPSHOT_READER, LOCKED_READER };
+
+struct bench_state {
+    symbiomon_metric_t metric;
+    enum reader_mode   mode;
+    volatile int       done;
+    double             write_time;
+    size_t             num_snapshots;
+    size_t             num_trimmed;
+    double             read_time;
+};
+
+static void writer_ult(void* arg)
+{
+    struct bench_state* st = (struct bench_state*)arg;
+    double t = ABT_get_wtime();
+    int i;
+    for(i = 0; i < NUM_UPDATES; i++)
+        symbiomon_metric_update(st->metric, (double)i);
+    st->write_time = ABT_get_wtime() - t;
+    st->done = 1;
+}
+
+static void reader_ult(void* arg)
+{
+    struct bench_state* st = (struct bench_state*)arg;
+    symbiomon_metric_sample* buf = (symbiomon_metric_sample*)malloc(CAPACITY*sizeof(*buf));
+    double t = ABT_get_wtime();
+    while(!st->done) {
+        size_t expected = symbiomon_series_size(&st->metric->series);
+        size_t n;
+        if(st->mode == LOCKED_READER) {
+            ABT_mutex_lock(st->metric->metric_mutex);
+            n = symbiomon_provider_metric_copy_last(st->metric, CAPACITY, buf);
+            ABT_mutex_unlock(st->metric->metric_mutex);
+        } else {
+            n = symbiomon_provider_metric_copy_last(st->metric, CAPACITY, buf);
+        }
+        if(n < expected) st->num_trimmed += expected - n;
+        st->num_snapshots++;
+    }
+    st->read_time = ABT_get_wtime() - t;
+    free(buf);
+}
+
+static void run(symbiomon_provider_t provider, symbiomon_taglist_t taglist, enum reader_mode mode, const char* name)
+{
+    struct bench_state st = { 0 };
+    ABT_xstream xstreams[2];
+    ABT_thread ults[2];
+    ABT_pool pool;
+    int i;
+
+    symbiomon_metric_create("bench", "snapshot", SYMBIOMON_TYPE_GAUGE,
+            "snapshot benchmark", taglist, &st.metric, provider);
+    st.mode = mode;
+
+    for(i = 0; i < 2; i++)
+        ABT_xstream_create(ABT_SCHED_NULL, &xstreams[i]);
+    ABT_xstream_get_main_pools(xstreams[0], 1, &pool);
+    ABT_thread_create(pool, writer_ult, &st, ABT_THREAD_ATTR_NULL, &ults[0]);
+    if(mode != NO_READER) {
+        ABT_xstream_get_main_pools(xstreams[1], 1, &pool);
+        ABT_thread_create(pool, reader_ult, &st, ABT_THREAD_ATTR_NULL, &ults[1]);
+    }
+    for(i = 0; i < (mode != NO_READER ? 2 : 1); i++) {
+        ABT_thread_join(ults[i]);
+        ABT_thread_free(&ults[i]);
+    }
+    for(i = 0; i < 2; i++) {
+        ABT_xstream_join(xstreams[i]);
+        ABT_xstream_free(&xstreams[i]);
+    }
+
+    printf("%-16s %12.1f", name, st.write_time*1e9/NUM_UPDATES);
+    if(mode != NO_READER && st.num_snapshots)
+        printf(" %12.3f %12.1f", st.read_time*1e3/st.num_snapshots,
+                (double)st.num_trimmed/st.num_snapshots);
+    printf("\n");
+
+    symbiomon_metric_destroy(st.metric, provider);
+}
+
+int main(int argc, char** argv)
+{
+    (void)argc;
+    (void)argv;
+    margo_instance_id mid = margo_init("na+sm", MARGO_SERVER_MODE, 0, 0);
+    assert(mid);
+
+    struct symbiomon_provider_args args = SYMBIOMON_PROVIDER_ARGS_INIT;
+    symbiomon_provider_t provider;
+    symbiomon_provider_register(mid, 42, &args, &provider);
+
+    symbiomon_taglist_t taglist;
+    symbiomon_taglist_create(&taglist, 0);
+
+    printf("# %d updates, snapshots of up to %d samples\n", NUM_UPDATES, CAPACITY);
+    printf("%-16s %12s %12s %12s\n", "reader", "ns/update", "ms/snapshot", "trimmed");
+    run(provider, taglist, NO_READER,       "none");
+    run(provider, taglist, SNAPSHOT_READER, "snapshot");
+    run(provider, taglist, LOCKED_READER,   "mutex");
+
+    symbiomon_taglist_destroy(taglist);
+    symbiomon_provider_destroy(provider);
+    margo_finalize(mid);
+    return 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "kernels.h"
+
+/*
+ * Measures the throughput of the reduction kernels used by
+ * symbiomon_provider_metric_reduce over a buffer of the size
+ * a metric typically holds when it is reduced.
+ */
+
+#define NUM_SAMPLES 160000
+#define NUM_REPS    200
+
+static double wtime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static volatile double sink;
+
+static void report(const char* impl, const char* op, double elapsed)
+{
+    printf("%-8s %-10s %10.3f ms %10.1f Msamples/s\n", impl, op,
+            elapsed*1e3/NUM_REPS, (double)NUM_SAMPLES*NUM_REPS/elapsed/1e6);
+}
+
+static void run(const symbiomon_kernels* k, const double* vals)
+{
+    symbiomon_summary s;
+    double t;
+    int r;
+
+    t = wtime();
+    for(r = 0; r < NUM_REPS; r++) sink = k->sum(vals, NUM_SAMPLES);
+    report(k->name, "sum", wtime() - t);
+
+    t = wtime();
+    for(r = 0; r < NUM_REPS; r++) sink = k->sum(vals, NUM_SAMPLES)/NUM_SAMPLES;
+    report(k->name, "avg", wtime() - t);
+
+    t = wtime();
+    for(r = 0; r < NUM_REPS; r++) sink = k->min(vals, NUM_SAMPLES);
+    report(k->name, "min", wtime() - t);
+
+    t = wtime();
+    for(r = 0; r < NUM_REPS; r++) sink = k->max(vals, NUM_SAMPLES);
+    report(k->name, "max", wtime() - t);
+
+    t = wtime();
+    for(r = 0; r < NUM_REPS; r++) {
+        k->summary(vals, NUM_SAMPLES, &s);
+        sink = symbiomon_summary_variance(&s);
+    }
+    report(k->name, "variance", wtime() - t);
+}
+
+int main(void)
+{
+    const char* impls[] = { "scalar", "avx2", "avx512" };
+    double* vals = (double*)malloc(NUM_SAMPLES*sizeof(double));
+    size_t i;
+
+    srand(42);
+    for(i = 0; i < NUM_SAMPLES; i++)
+        vals[i] = 1000.0 + (double)rand()/RAND_MAX;
+
+    printf("# %d samples, %d repetitions, selected kernels: %s\n",
+            NUM_SAMPLES, NUM_REPS, symbiomon_kernels_get()->name);
+    for(i = 0; i < sizeof(impls)/sizeof(impls[0]); i++) {
+        const symbiomon_kernels* k = symbiomon_kernels_find(impls[i]);
+        if(!k) {
+            printf("%-8s not supported on this CPU\n", impls[i]);
+            continue;
+        }
+        run(k, vals);
+    }
+
+    free(vals);
+    return 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <margo.h>
+#include <symbiomon/symbiomon-server.h>
+#include <symbiomon/symbiomon-metric.h>
+#include <symbiomon/symbiomon-common.h>
+
+/*
+ * Compares recording samples one symbiomon_metric_update call at a time
+ * with symbiomon_metric_update_batch (many values into one metric) and
+ * symbiomon_metrics_update_multi (one value into each of many metrics),
+ * the way a tool dumping all its metrics at once would use them.
+ */
+
+#define NUM_METRICS 256
+#define NUM_ROUNDS  2000
+
+static void report(const char* name, double elapsed)
+{
+    printf("%-28s %10.1f ns/sample\n", name, elapsed*1e9/((double)NUM_METRICS*NUM_ROUNDS));
+}
+
+int main(int argc, char** argv)
+{
+    (void)argc;
+    (void)argv;
+    margo_instance_id mid = margo_init("na+sm", MARGO_SERVER_MODE, 0, 0);
+    assert(mid);
+
+    struct symbiomon_provider_args args = SYMBIOMON_PROVIDER_ARGS_INIT;
+    symbiomon_provider_t provider;
+    symbiomon_provider_register(mid, 42, &args, &provider);
+
+    symbiomon_taglist_t taglist;
+    symbiomon_taglist_create(&taglist, 0);
+
+    symbiomon_metric_t metrics[NUM_METRICS];
+    double vals[NUM_METRICS];
+    char name[64];
+    double t;
+    int i, r;
+
+    for(i = 0; i < NUM_METRICS; i++) {
+        sprintf(name, "metric_%d", i);
+        symbiomon_metric_create("bench", name, SYMBIOMON_TYPE_GAUGE, "batch benchmark", taglist, &metrics[i], provider);
+        vals[i] = (double)i;
+    }
+
+    printf("# %d metrics, %d rounds\n", NUM_METRICS, NUM_ROUNDS);
+
+    /* one value into each metric */
+    t = ABT_get_wtime();
+    for(r = 0; r < NUM_ROUNDS; r++)
+        for(i = 0; i < NUM_METRICS; i++)
+            symbiomon_metric_update(metrics[i], vals[i]);
+    report("update (many metrics)", ABT_get_wtime() - t);
+
+    t = ABT_get_wtime();
+    for(r = 0; r < NUM_ROUNDS; r++)
+        symbiomon_metrics_update_multi(metrics, vals, NUM_METRICS);
+    report("metrics_update_multi", ABT_get_wtime() - t);
+
+    /* many values into one metric */
+    t = ABT_get_wtime();
+    for(r = 0; r < NUM_ROUNDS; r++)
+        for(i = 0; i < NUM_METRICS; i++)
+            symbiomon_metric_update(metrics[0], vals[i]);
+    report("update (one metric)", ABT_get_wtime() - t);
+
+    t = ABT_get_wtime();
+    for(r = 0; r < NUM_ROUNDS; r++)
+        symbiomon_metric_update_batch(metrics[0], vals, NUM_METRICS);
+    report("metric_update_batch", ABT_get_wtime() - t);
+
+    symbiomon_metric_destroy_all(provider);
+    symbiomon_taglist_destroy(taglist);
+    symbiomon_provider_destroy(provider);
+    margo_finalize(mid);
+    return 0;
+}
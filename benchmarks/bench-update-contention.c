@@ -0,0 +1,100 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <margo.h>
+#include <symbiomon/symbiomon-server.h>
+#include <symbiomon/symbiomon-metric.h>
+#include <symbiomon/symbiomon-common.h>
+
+/*
+ * Measures the throughput of symbiomon_metric_update when ULTs running
+ * on 1 to 64 execution streams all update the same gauge, first with
+ * the metric protected by its mutex, then with one lock-free shard per
+ * execution stream.
+ */
+
+#define UPDATES_PER_XSTREAM 200000
+#define MAX_XSTREAMS        64
+#define BENCH_CAPACITY      4096
+
+static void update_ult(void* arg)
+{
+    symbiomon_metric_t m = (symbiomon_metric_t)arg;
+    int i;
+    for(i = 0; i < UPDATES_PER_XSTREAM; i++)
+        symbiomon_metric_update(m, (double)i);
+}
+
+static double run(symbiomon_provider_t provider, symbiomon_taglist_t taglist, int num_xstreams, size_t num_shards)
+{
+    ABT_xstream xstreams[MAX_XSTREAMS];
+    ABT_thread ults[MAX_XSTREAMS];
+    ABT_pool pool;
+    symbiomon_metric_t m;
+    double t;
+    int i;
+
+    struct symbiomon_metric_args args = SYMBIOMON_METRIC_ARGS_INIT;
+    args.capacity = BENCH_CAPACITY;
+    args.num_shards = num_shards;
+    symbiomon_return_t ret = symbiomon_metric_create_with_args("bench", "contention",
+            SYMBIOMON_TYPE_GAUGE, "contention benchmark", taglist, &m, provider, &args);
+    assert(ret == SYMBIOMON_SUCCESS);
+
+    for(i = 0; i < num_xstreams; i++)
+        ABT_xstream_create(ABT_SCHED_NULL, &xstreams[i]);
+
+    t = ABT_get_wtime();
+    for(i = 0; i < num_xstreams; i++) {
+        ABT_xstream_get_main_pools(xstreams[i], 1, &pool);
+        ABT_thread_create(pool, update_ult, m, ABT_THREAD_ATTR_NULL, &ults[i]);
+    }
+    for(i = 0; i < num_xstreams; i++) {
+        ABT_thread_join(ults[i]);
+        ABT_thread_free(&ults[i]);
+    }
+    t = ABT_get_wtime() - t;
+
+    for(i = 0; i < num_xstreams; i++) {
+        ABT_xstream_join(xstreams[i]);
+        ABT_xstream_free(&xstreams[i]);
+    }
+    symbiomon_metric_destroy(m, provider);
+
+    return (double)num_xstreams*UPDATES_PER_XSTREAM/t;
+}
+
+int main(int argc, char** argv)
+{
+    (void)argc;
+    (void)argv;
+    margo_instance_id mid = margo_init("na+sm", MARGO_SERVER_MODE, 0, 0);
+    assert(mid);
+
+    struct symbiomon_provider_args args = SYMBIOMON_PROVIDER_ARGS_INIT;
+    symbiomon_provider_t provider;
+    symbiomon_provider_register(mid, 42, &args, &provider);
+
+    symbiomon_taglist_t taglist;
+    symbiomon_taglist_create(&taglist, 0);
+
+    /* execution stream ranks also count those created by margo, so give
+     * the sharded metric enough shards for every stream to get its own */
+    printf("# %d updates per xstream\n", UPDATES_PER_XSTREAM);
+    printf("%-8s %16s %16s\n", "xstreams", "locked (Mupd/s)", "sharded (Mupd/s)");
+    int n;
+    for(n = 1; n <= MAX_XSTREAMS; n *= 2) {
+        double locked  = run(provider, taglist, n, 0);
+        double sharded = run(provider, taglist, n, 2*MAX_XSTREAMS);
+        printf("%-8d %16.2f %16.2f\n", n, locked/1e6, sharded/1e6);
+    }
+
+    symbiomon_taglist_destroy(taglist);
+    symbiomon_provider_destroy(provider);
+    margo_finalize(mid);
+    return 0;
+}
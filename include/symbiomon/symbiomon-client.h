@@ -16,6 +16,9 @@ extern "C" {
 typedef struct symbiomon_client* symbiomon_client_t;
 #define SYMBIOMON_CLIENT_NULL ((symbiomon_client_t)NULL)
 
+typedef struct symbiomon_request* symbiomon_request_t;
+#define SYMBIOMON_REQUEST_NULL ((symbiomon_request_t)NULL)
+
 /**
  * @brief Creates a SYMBIOMON client.
  *
@@ -35,6 +38,57 @@ symbiomon_return_t symbiomon_client_init(margo_instance_id mid, symbiomon_client
  */
 symbiomon_return_t symbiomon_client_finalize(symbiomon_client_t client);
 
+/**
+ * @brief Sets the encoding in which the client asks providers to send
+ * the samples of symbiomon_remote_metric_fetch and
+ * symbiomon_remote_metric_ifetch. Samples are decoded by the client;
+ * a provider may still answer with raw samples, e.g. when encoding them
+ * would not make the transfer smaller. Providers must support encoded
+ * fetches unless the encoding is SYMBIOMON_ENCODING_RAW (the default).
+ *
+ * @param[in] client SYMBIOMON client
+ * @param[in] encoding encoding requested
+ *
+ * @return SYMBIOMON_SUCCESS or error code defined in symbiomon-common.h
+ */
+symbiomon_return_t symbiomon_client_set_fetch_encoding(symbiomon_client_t client, symbiomon_fetch_encoding_t encoding);
+
+/**
+ * @brief Waits for a request started by a non-blocking call
+ * (e.g. symbiomon_remote_metric_ifetch) and releases it.
+ *
+ * @param[in] req request
+ *
+ * @return the result of the operation
+ */
+symbiomon_return_t symbiomon_request_wait(symbiomon_request_t req);
+
+/**
+ * @brief Checks whether a request has completed, without blocking.
+ * The request must still be passed to symbiomon_request_wait.
+ *
+ * @param[in] req request
+ * @param[out] flag 1 if the request completed, 0 otherwise
+ *
+ * @return SYMBIOMON_SUCCESS or error code defined in symbiomon-common.h
+ */
+symbiomon_return_t symbiomon_request_test(symbiomon_request_t req, int* flag);
+
+/**
+ * @brief Waits for any of count requests to complete and releases it.
+ * Its slot in reqs is set to SYMBIOMON_REQUEST_NULL, and NULL slots
+ * are skipped, so the call can be repeated until all are done.
+ * If the wait itself fails, index is set to count and the requests
+ * are left in reqs, to be waited for one by one.
+ *
+ * @param[in] count number of requests
+ * @param[inout] reqs requests
+ * @param[out] index index of the request that completed
+ *
+ * @return the result of that request's operation
+ */
+symbiomon_return_t symbiomon_request_wait_any(size_t count, symbiomon_request_t* reqs, size_t* index);
+
 #ifdef __cplusplus
 }
 #endif
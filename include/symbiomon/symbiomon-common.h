@@ -35,8 +35,12 @@ typedef enum symbiomon_return_t {
     SYMBIOMON_ERR_OTHER              /* Other error */
 } symbiomon_return_t;
 
+/* default number of samples retained per metric */
 #define METRIC_BUFFER_SIZE 160000
 
+/* maximum number of rollup tiers per metric */
+#define SYMBIOMON_MAX_ROLLUPS 4
+
 /**
  * @brief Identifier for a metric.
  */
@@ -45,7 +49,8 @@ typedef uint32_t symbiomon_metric_id_t;
 typedef enum symbiomon_metric_type {
    SYMBIOMON_TYPE_COUNTER,
    SYMBIOMON_TYPE_TIMER,
-   SYMBIOMON_TYPE_GAUGE    
+   SYMBIOMON_TYPE_GAUGE,
+   SYMBIOMON_TYPE_HISTOGRAM  /* non-negative values counted in log-linear buckets, no samples retained */
 } symbiomon_metric_type_t;
 
 typedef enum symbiomon_metric_reduction_op {
@@ -55,9 +60,64 @@ typedef enum symbiomon_metric_reduction_op {
    SYMBIOMON_REDUCTION_OP_AVG,
    SYMBIOMON_REDUCTION_OP_MIN,
    SYMBIOMON_REDUCTION_OP_MAX,
-   SYMBIOMON_REDUCTION_OP_ANOMALY
+   SYMBIOMON_REDUCTION_OP_ANOMALY,
+   SYMBIOMON_REDUCTION_OP_P50,    /* percentiles from a mergeable sketch of the values, timers and histograms only */
+   SYMBIOMON_REDUCTION_OP_P95,
+   SYMBIOMON_REDUCTION_OP_P99
 } symbiomon_metric_reduction_op_t;
 
+typedef enum symbiomon_metric_layout {
+   SYMBIOMON_LAYOUT_ROWS,    /* samples stored as an array of symbiomon_metric_sample */
+   SYMBIOMON_LAYOUT_COLUMNS  /* values, timestamps and sample ids stored as separate arrays */
+} symbiomon_metric_layout_t;
+
+typedef enum symbiomon_metric_column {
+   SYMBIOMON_COLUMN_VAL       = 1,
+   SYMBIOMON_COLUMN_TIME      = 2,
+   SYMBIOMON_COLUMN_SAMPLE_ID = 4
+} symbiomon_metric_column_t;
+
+typedef enum symbiomon_metric_stats_scope {
+   SYMBIOMON_STATS_LIFETIME, /* every sample recorded since the metric was created */
+   SYMBIOMON_STATS_INTERVAL  /* samples recorded since the last reduction */
+} symbiomon_metric_stats_scope_t;
+
+typedef enum symbiomon_downsample_mode {
+   SYMBIOMON_DOWNSAMPLE_MIN,  /* smallest sample of each time interval */
+   SYMBIOMON_DOWNSAMPLE_MAX,  /* largest sample of each time interval */
+   SYMBIOMON_DOWNSAMPLE_AVG,  /* mean time and value of each time interval */
+   SYMBIOMON_DOWNSAMPLE_LTTB  /* Largest-Triangle-Three-Buckets */
+} symbiomon_downsample_mode_t;
+
+typedef enum symbiomon_fetch_encoding {
+   SYMBIOMON_ENCODING_RAW,    /* arrays of symbiomon_metric_sample */
+   SYMBIOMON_ENCODING_BLOCK   /* delta-of-delta timestamps, XORed values, repeated sample ids omitted */
+} symbiomon_fetch_encoding_t;
+
+typedef enum symbiomon_subscription_filter {
+   SYMBIOMON_SUBSCRIBE_METRIC,     /* the metric with a given id */
+   SYMBIOMON_SUBSCRIBE_NAMESPACE,  /* every metric of a namespace */
+   SYMBIOMON_SUBSCRIBE_TAG         /* every metric carrying a tag */
+} symbiomon_subscription_filter_t;
+
+/* running statistics maintained as samples are recorded */
+typedef struct symbiomon_metric_stats {
+   uint64_t count;
+   double sum;
+   double min;
+   double max;
+   double mean;
+   double variance;
+} symbiomon_metric_stats;
+
+/* statistics over a window of samples, computed by the provider */
+typedef struct symbiomon_metric_aggregate {
+   symbiomon_metric_stats stats;
+   double p50;
+   double p90;
+   double p99;
+} symbiomon_metric_aggregate;
+
 typedef struct symbiomon_metric_sample {
    double time;
    double val;
@@ -66,6 +126,62 @@ typedef struct symbiomon_metric_sample {
 
 typedef symbiomon_metric_sample* symbiomon_metric_buffer;
 
+/* position after a sample timestamp: the samples taken after time, plus
+ * those taken at time but beyond the first seen ones, which a batch update
+ * gives a single timestamp */
+typedef struct symbiomon_time_cursor {
+   double time;
+   uint64_t seen;
+} symbiomon_time_cursor;
+
+/* summary of the samples taken in [time, time + period) */
+typedef struct symbiomon_rollup {
+   double time;
+   uint64_t count;
+   double sum;
+   double min;
+   double max;
+} symbiomon_rollup;
+
+/*
+ * Log-linear buckets: 2^SYMBIOMON_HISTOGRAM_SUB_BITS buckets per power of
+ * two from 2^SYMBIOMON_HISTOGRAM_MIN_EXP to 2^SYMBIOMON_HISTOGRAM_MAX_EXP,
+ * each within 1/16th of its lower bound. The first bucket also counts
+ * smaller values and the last one larger values.
+ */
+#define SYMBIOMON_HISTOGRAM_SUB_BITS 4
+#define SYMBIOMON_HISTOGRAM_MIN_EXP  (-32)
+#define SYMBIOMON_HISTOGRAM_MAX_EXP  32
+#define SYMBIOMON_HISTOGRAM_BUCKETS  ((SYMBIOMON_HISTOGRAM_MAX_EXP - SYMBIOMON_HISTOGRAM_MIN_EXP) << SYMBIOMON_HISTOGRAM_SUB_BITS)
+
+/* bound on the size of an encoded histogram: a 40-byte header and at
+ * most 10 bytes per bucket */
+#define SYMBIOMON_SKETCH_MAX_SIZE    (40 + 10*SYMBIOMON_HISTOGRAM_BUCKETS)
+
+/* values of a histogram metric; histograms merge by adding their buckets */
+typedef struct symbiomon_histogram {
+   uint64_t count;
+   double sum;
+   double min;
+   double max;
+   uint64_t buckets[SYMBIOMON_HISTOGRAM_BUCKETS];
+} symbiomon_histogram;
+
+/* samples returned column by column; columns that were not requested are NULL */
+typedef struct symbiomon_metric_columns {
+   double *val;
+   double *time;
+   uint64_t *sample_id;
+} symbiomon_metric_columns;
+
+/* per-metric result of a multi-metric fetch; samples point into the
+ * packed buffer returned alongside */
+typedef struct symbiomon_metric_fetch_result {
+   symbiomon_return_t ret;
+   int64_t count;
+   symbiomon_metric_sample *samples;
+} symbiomon_metric_fetch_result;
+
 typedef struct symbiomon_taglist {
     char **taglist;
     int num_tags;
@@ -24,12 +24,99 @@ typedef struct symbiomon_metric_sample symbiomon_metric_sample;
 typedef void (*func)();
 #define SYMBIOMON_METRIC_HANDLE_NULL ((symbiomon_metric_handle_t)NULL)
 
+typedef struct symbiomon_subscription* symbiomon_subscription_t;
+
+/* Receives the new samples of one metric, oldest first. The samples are
+ * only valid during the call, which must not unsubscribe. */
+typedef void (*symbiomon_subscription_fn)(void* uarg, symbiomon_metric_id_t metric_id, const symbiomon_metric_sample* samples, size_t count);
+
+struct symbiomon_rollup_args {
+    double period;    // Seconds covered by a bucket (0 to disable the tier)
+    size_t retention; // Number of buckets retained
+};
+
+/* With a history, the update that is about to overwrite a block of the
+ * ring (1024 samples, or the whole ring if smaller) first
+ * compresses that block under the metric's lock: roughly a hundred
+ * microseconds for a full block on a recent x86 core, paid by one update
+ * in a block. A history_capacity below one block is rounded up to it. */
+struct symbiomon_metric_args {
+    size_t                          capacity;          // Number of most recent samples retained
+    symbiomon_metric_reduction_op_t reduction_op;      // Reduction applied by symbiomon_metric_reduce
+    symbiomon_metric_layout_t       layout;            // Row or columnar sample storage
+    symbiomon_metric_stats_scope_t  reduction_scope;   // Reduce every sample, or only those since the last reduction
+    size_t                          num_shards;        // Lock-free buffers for xstreams of rank < num_shards (0 to disable)
+    double                          snapshot_interval; // Seconds between samples of symbiomon_metric_increment counts (0 to disable)
+    size_t                          history_capacity;  // Older samples kept compressed once overwritten in the ring (0 to disable, ignored with shards)
+    struct symbiomon_rollup_args    rollups[SYMBIOMON_MAX_ROLLUPS]; // Tiers of increasing periods, ignored with shards
+};
+
+struct symbiomon_subscription_args {
+    symbiomon_subscription_filter_t filter;     // Which metrics are followed
+    symbiomon_metric_id_t           metric_id;  // Metric followed with SYMBIOMON_SUBSCRIBE_METRIC
+    const char*                     pattern;    // Namespace or tag followed otherwise
+    double                          interval;   // Seconds between pushes of new samples
+    uint64_t                        batch_size; // Maximum number of samples per push
+};
+
+#define SYMBIOMON_SUBSCRIPTION_ARGS_INIT { \
+    .filter = SYMBIOMON_SUBSCRIBE_METRIC, \
+    .metric_id = 0, \
+    .pattern = NULL, \
+    .interval = 1.0, \
+    .batch_size = 4096 \
+}
+
+/* provider queried by a fan-out */
+typedef struct symbiomon_target {
+    hg_addr_t addr;
+    uint16_t  provider_id;
+} symbiomon_target;
+
+struct symbiomon_fanout_args {
+    size_t max_inflight;     // Requests in flight at once
+    double straggler_factor; // Targets slower than this times the median latency are stragglers (0 to disable)
+};
+
+#define SYMBIOMON_FANOUT_ARGS_INIT { \
+    .max_inflight = 64, \
+    .straggler_factor = 2.0 \
+}
+
+/* outcome of a fan-out for one target */
+typedef struct symbiomon_fanout_result {
+    symbiomon_return_t         ret;       // Result of the target's query
+    double                     latency;   // Seconds from issuing the query to its completion
+    int                        straggler; // Whether the target was flagged as a straggler
+    int64_t                    count;     // Number of samples the target contributed
+    symbiomon_metric_aggregate aggregate; // Target's statistics, for aggregate fan-outs
+} symbiomon_fanout_result;
+
+/* row of the table merged by a fan-out fetch */
+typedef struct symbiomon_fanout_sample {
+    double   time;
+    double   val;
+    uint64_t sample_id;
+    uint32_t target;  // index of the target the sample comes from
+} symbiomon_fanout_sample;
+
+#define SYMBIOMON_METRIC_ARGS_INIT { \
+    .capacity = METRIC_BUFFER_SIZE, \
+    .reduction_op = SYMBIOMON_REDUCTION_OP_NULL, \
+    .layout = SYMBIOMON_LAYOUT_ROWS, \
+    .reduction_scope = SYMBIOMON_STATS_LIFETIME, \
+    .num_shards = 0, \
+    .snapshot_interval = 0.0, \
+    .history_capacity = 0 \
+}
+
 /* APIs for providers to record performance data */
 symbiomon_return_t symbiomon_taglist_create(symbiomon_taglist_t *taglist, int num_tags, ...);
 symbiomon_return_t symbiomon_taglist_destroy(symbiomon_taglist_t taglist);
 
 symbiomon_return_t symbiomon_metric_create_with_reduction(const char *ns, const char *name, symbiomon_metric_type_t t, const char *desc, symbiomon_taglist_t taglist, symbiomon_metric_t* metric_handle, symbiomon_provider_t provider, symbiomon_metric_reduction_op_t op);
 symbiomon_return_t symbiomon_metric_create(const char *ns, const char *name, symbiomon_metric_type_t t, const char *desc, symbiomon_taglist_t taglist, symbiomon_metric_t* metric_handle, symbiomon_provider_t provider);
+symbiomon_return_t symbiomon_metric_create_with_args(const char *ns, const char *name, symbiomon_metric_type_t t, const char *desc, symbiomon_taglist_t taglist, symbiomon_metric_t* metric_handle, symbiomon_provider_t provider, const struct symbiomon_metric_args* args);
 
 symbiomon_return_t symbiomon_metric_destroy(symbiomon_metric_t m, symbiomon_provider_t provider);
 symbiomon_return_t symbiomon_metric_destroy_all(symbiomon_provider_t provider);
@@ -37,10 +124,41 @@ symbiomon_return_t symbiomon_metric_reduce(symbiomon_metric_t m, symbiomon_provi
 symbiomon_return_t symbiomon_metric_reduce_all(symbiomon_provider_t provider);
 symbiomon_return_t symbiomon_metric_global_reduce_all(symbiomon_provider_t p, size_t cohort_size);
 symbiomon_return_t symbiomon_metric_update(symbiomon_metric_t m, double val);
+symbiomon_return_t symbiomon_metric_update_batch(symbiomon_metric_t m, const double* vals, size_t n);
+symbiomon_return_t symbiomon_metrics_update_multi(symbiomon_metric_t* metrics, const double* vals, size_t n);
 symbiomon_return_t symbiomon_metric_update_gauge_by_fixed_amount(symbiomon_metric_t m, double diff);
+symbiomon_return_t symbiomon_metric_increment(symbiomon_metric_t m, uint64_t delta);
+symbiomon_return_t symbiomon_metric_get_stats(symbiomon_metric_t m, symbiomon_metric_stats_scope_t scope, symbiomon_metric_stats* stats);
+
+/* Writes the distribution of the values of a metric to filename: for
+ * histogram metrics, one "lower, upper, count" line per non-empty bucket,
+ * otherwise the retained samples counted in num_buckets buckets of equal
+ * width between their min and max. */
 symbiomon_return_t symbiomon_metric_dump_histogram(symbiomon_metric_t m, const char *filename, size_t num_buckets);
 symbiomon_return_t symbiomon_metric_dump_raw_data(symbiomon_metric_t m, const char *filename);
 symbiomon_return_t symbiomon_metric_list_all(symbiomon_provider_t provider, const char *filename);
+
+/* Copies the buckets of a SYMBIOMON_TYPE_HISTOGRAM metric */
+symbiomon_return_t symbiomon_metric_get_histogram(symbiomon_metric_t m, symbiomon_histogram* h);
+
+/* Adds the values counted in other to h */
+void symbiomon_histogram_merge(symbiomon_histogram* h, const symbiomon_histogram* other);
+
+/* Value of rank ceil(q*count) of a histogram (q between 0 and 1), within
+ * 1/32nd of the exact one in the range of the buckets; NaN if empty */
+double symbiomon_histogram_quantile(const symbiomon_histogram* h, double q);
+
+/* Encodes a histogram as a sketch, which only holds its non-empty range
+ * of buckets, into a buffer allocated with malloc. Returns the size of
+ * the sketch, or 0 if the allocation failed. Reductions store sketches
+ * under the "<metric>_SKETCH" keys of the aggregators; the global
+ * reduction of a percentile merges those of the cohort and stores the
+ * result under "<ns>_<name>_GLOBAL_P50" (or _P95, _P99). */
+size_t symbiomon_histogram_encode(const symbiomon_histogram* h, void** sketch);
+
+/* Adds the values of a sketch to h; sketches of several ranks merge
+ * without loss. h is left unchanged if the sketch is malformed. */
+symbiomon_return_t symbiomon_histogram_merge_encoded(symbiomon_histogram* h, const void* sketch, size_t size);
 symbiomon_return_t symbiomon_metric_class_register_retrieval_callback(char *ns, func f);
 
 /* APIs for remote clients to request for performance data */
@@ -49,8 +167,109 @@ symbiomon_return_t symbiomon_remote_metric_handle_create(symbiomon_client_t clie
 symbiomon_return_t symbiomon_remote_metric_handle_ref_incr(symbiomon_metric_handle_t handle);
 symbiomon_return_t symbiomon_remote_metric_handle_release(symbiomon_metric_handle_t handle);
 symbiomon_return_t symbiomon_remote_metric_fetch(symbiomon_metric_handle_t handle, int64_t *num_samples_requested, symbiomon_metric_buffer *buf);
+symbiomon_return_t symbiomon_remote_metric_fetch_columns(symbiomon_metric_handle_t handle, int64_t *num_samples_requested, uint32_t columns, symbiomon_metric_columns *cols);
+
+/* Non-blocking symbiomon_remote_metric_fetch: *num_samples_requested and
+ * *buf are set when *req completes (see symbiomon_request_wait), and must
+ * stay valid until then. */
+symbiomon_return_t symbiomon_remote_metric_ifetch(symbiomon_metric_handle_t handle, int64_t *num_samples_requested, symbiomon_metric_buffer *buf, symbiomon_request_t *req);
+
+/* Fetches the samples that follow *cursor, a sample sequence number (0 to
+ * start from the oldest retained sample), oldest first and at most
+ * *num_samples_requested of them. *cursor is advanced for the next call
+ * and *dropped (if not NULL) receives how many samples after the previous
+ * cursor were overwritten before they could be fetched. Sharded metrics
+ * only support timestamp cursors. */
+symbiomon_return_t symbiomon_remote_metric_fetch_since(symbiomon_metric_handle_t handle, uint64_t *cursor, int64_t *num_samples_requested, symbiomon_metric_buffer *buf, uint64_t *dropped);
+
+/* Same with a timestamp cursor: fetches the samples that follow *cursor
+ * (start from { t, 0 } for the samples taken at t or later) and moves it
+ * past the last one returned, so that a batch split across two calls is
+ * resumed where it was cut. Overwritten samples cannot be counted from a
+ * timestamp: a cursor older than the oldest retained sample resumes from
+ * it without reporting any drop, use sequence cursors to detect them. */
+symbiomon_return_t symbiomon_remote_metric_fetch_since_time(symbiomon_metric_handle_t handle, symbiomon_time_cursor *cursor, int64_t *num_samples_requested, symbiomon_metric_buffer *buf);
+
+/* Fetches the samples taken between t0 and t1 (both included), oldest
+ * first and at most *num_samples_requested of them. The provider looks
+ * the window up by binary search and only transfers matching samples. */
+symbiomon_return_t symbiomon_remote_metric_fetch_range(symbiomon_metric_handle_t handle, double t0, double t1, int64_t *num_samples_requested, symbiomon_metric_buffer *buf);
+
+/* Fetches the whole retained history of a metric downsampled on the
+ * provider to at most *num_points points, oldest first, and sets
+ * *num_points to the number returned. See symbiomon_downsample_mode_t. */
+symbiomon_return_t symbiomon_remote_metric_fetch_downsampled(symbiomon_metric_handle_t handle, symbiomon_downsample_mode_t mode, int64_t *num_points, symbiomon_metric_buffer *buf);
+
+/* Fetches the buckets of at most resolution seconds overlapping [t0, t1],
+ * oldest first and at most *num_buckets of them. The provider answers
+ * from the coarsest rollup tier that still reaches back to t0, or from
+ * the raw samples, sent as buckets of one sample with *period set to 0. */
+symbiomon_return_t symbiomon_remote_metric_fetch_rollup(symbiomon_metric_handle_t handle, double t0, double t1, double resolution, int64_t *num_buckets, symbiomon_rollup **buf, double *period);
+
+/* Computes the count, sum, min, max, mean, variance and the 50th, 90th
+ * and 99th percentiles of the samples taken between t0 and t1 (both
+ * included) on the provider, so that only the statistics are sent back.
+ * Percentiles are exact nearest-rank values; the standard deviation is
+ * the square root of the variance. When the raw samples no longer reach
+ * back to t0, the finest rollup tier that does is used instead and the
+ * variance and percentiles are NaN. */
+symbiomon_return_t symbiomon_remote_metric_aggregate(symbiomon_metric_handle_t handle, double t0, double t1, symbiomon_metric_aggregate *aggregate);
+
+/* Non-blocking symbiomon_remote_metric_aggregate */
+symbiomon_return_t symbiomon_remote_metric_iaggregate(symbiomon_metric_handle_t handle, double t0, double t1, symbiomon_metric_aggregate *aggregate, symbiomon_request_t *req);
+
+/* Fetches the buckets of a SYMBIOMON_TYPE_HISTOGRAM metric, a few KB
+ * however many values were counted */
+symbiomon_return_t symbiomon_remote_metric_fetch_histogram(symbiomon_metric_handle_t handle, symbiomon_histogram *h);
+
+/* Non-blocking symbiomon_remote_metric_fetch_histogram */
+symbiomon_return_t symbiomon_remote_metric_ifetch_histogram(symbiomon_metric_handle_t handle, symbiomon_histogram *h, symbiomon_request_t *req);
+
+/* Fetches the last num_samples_requested samples of a metric from each of
+ * num_targets providers, with at most args->max_inflight requests in
+ * flight, and merges them into *table (freed by the caller), ordered by
+ * time. results[i] tells how targets[i] answered, how long it took and
+ * whether it was a straggler; failed targets contribute no samples. */
+symbiomon_return_t symbiomon_remote_fanout_fetch(symbiomon_client_t client, size_t num_targets, const symbiomon_target* targets, symbiomon_metric_id_t metric_id, int64_t num_samples_requested, const struct symbiomon_fanout_args* args, symbiomon_fanout_result* results, symbiomon_fanout_sample** table, size_t* table_size);
+
+/* Same but computes symbiomon_remote_metric_aggregate over [t0, t1] on
+ * every target and reduces the statistics into *global. Percentiles do
+ * not combine across providers, so those of *global are NaN and the
+ * per-target ones are in results[i].aggregate. */
+symbiomon_return_t symbiomon_remote_fanout_aggregate(symbiomon_client_t client, size_t num_targets, const symbiomon_target* targets, symbiomon_metric_id_t metric_id, double t0, double t1, const struct symbiomon_fanout_args* args, symbiomon_fanout_result* results, symbiomon_metric_aggregate* global);
+
+/* Same but fetches the buckets of a histogram metric from every target
+ * and merges them into *global, whose percentiles then cover all the
+ * targets. results[i].count is the number of values of targets[i]. */
+symbiomon_return_t symbiomon_remote_fanout_histogram(symbiomon_client_t client, size_t num_targets, const symbiomon_target* targets, symbiomon_metric_id_t metric_id, const struct symbiomon_fanout_args* args, symbiomon_fanout_result* results, symbiomon_histogram* global);
+
+/* Fetches the last counts[i] samples (the default window if negative) of
+ * each of the num_metrics metrics ids[i] of a provider in one round trip.
+ * results[i] describes what was returned for ids[i]; all the samples are
+ * packed in *buf, which the caller frees. */
+symbiomon_return_t symbiomon_remote_metrics_fetch_multi(symbiomon_client_t client, hg_addr_t addr, uint16_t provider_id, size_t num_metrics, const symbiomon_metric_id_t *ids, const int64_t *counts, symbiomon_metric_fetch_result *results, symbiomon_metric_buffer *buf);
+
+/* Switches a handle to one-sided pulls: the provider registers the metric's
+ * ring once, and symbiomon_remote_metric_fetch then reads it with RDMA
+ * without running any handler on the provider. Each fetch on such a handle
+ * returns the samples appended since the previous one (at most the number
+ * requested, the most recent ones). Only metrics with the row layout and
+ * no shards can be pulled; unmaterialized counter increments are not seen. */
+symbiomon_return_t symbiomon_remote_metric_enable_pull(symbiomon_metric_handle_t handle);
 symbiomon_return_t symbiomon_remote_list_metrics(symbiomon_client_t client, hg_addr_t addr, uint16_t provider_id, symbiomon_metric_id_t** ids, size_t* count);
 
+/* Non-blocking symbiomon_remote_list_metrics, completed like
+ * symbiomon_remote_metric_ifetch */
+symbiomon_return_t symbiomon_remote_list_metrics_ilist(symbiomon_client_t client, hg_addr_t addr, uint16_t provider_id, symbiomon_metric_id_t** ids, size_t* count, symbiomon_request_t* req);
+
+/* Asks a provider to push the samples recorded from now on by the metrics
+ * matching args (including metrics created later) to fn, every
+ * args->interval seconds and at most args->batch_size samples per push.
+ * A provider serves a bounded number of subscribers and drops those that
+ * repeatedly fail to take their notifications in time. */
+symbiomon_return_t symbiomon_remote_subscribe(symbiomon_client_t client, hg_addr_t addr, uint16_t provider_id, const struct symbiomon_subscription_args* args, symbiomon_subscription_fn fn, void* uarg, symbiomon_subscription_t* subscription);
+symbiomon_return_t symbiomon_remote_unsubscribe(symbiomon_subscription_t subscription);
+
 #ifdef __cplusplus
 }
 #endif
@@ -25,6 +25,7 @@ struct symbiomon_provider_args {
     const char*        token;  // Security token
     const char*        config; // JSON configuration
     ABT_pool           pool;   // Pool used to run RPCs
+    size_t             max_subscribers; // Subscriptions served at once
   //  abt_io_instance_id abtio;  // ABT-IO instance
     // ...
 };
@@ -33,7 +34,8 @@ struct symbiomon_provider_args {
     .push_finalize_callback = 1,\
     .token = NULL, \
     .config = NULL, \
-    .pool = ABT_POOL_NULL \
+    .pool = ABT_POOL_NULL, \
+    .max_subscribers = 64 \
 }
 
 /**
@@ -5,12 +5,16 @@
  */
 #include <stdarg.h>
 #include <assert.h>
+#include <math.h>
 #include "types.h"
 #include "client.h"
 #include "provider.h"
 #include "symbiomon/symbiomon-client.h"
 #include "symbiomon/symbiomon-common.h"
 
+static DECLARE_MARGO_RPC_HANDLER(symbiomon_subscription_notify_ult)
+static void symbiomon_subscription_notify_ult(hg_handle_t h);
+
 symbiomon_return_t symbiomon_client_init(margo_instance_id mid, symbiomon_client_t* client)
 {
     symbiomon_client_t c = (symbiomon_client_t)calloc(1, sizeof(*c));
@@ -24,11 +28,46 @@ symbiomon_return_t symbiomon_client_init(margo_instance_id mid, symbiomon_client
 
     if(flag == HG_TRUE) {
         margo_registered_name(mid, "symbiomon_remote_metric_fetch", &c->metric_fetch_id, &flag);
+        margo_registered_name(mid, "symbiomon_remote_metric_fetch_encoded", &c->metric_fetch_encoded_id, &flag);
         margo_registered_name(mid, "symbiomon_remote_list_metrics", &c->list_metrics_id, &flag);
+        margo_registered_name(mid, "symbiomon_remote_metric_fetch_columns", &c->metric_fetch_columns_id, &flag);
+        margo_registered_name(mid, "symbiomon_remote_metric_expose", &c->metric_expose_id, &flag);
+        margo_registered_name(mid, "symbiomon_remote_metric_fetch_since", &c->metric_fetch_since_id, &flag);
+        margo_registered_name(mid, "symbiomon_remote_metrics_fetch_multi", &c->metrics_fetch_multi_id, &flag);
+        margo_registered_name(mid, "symbiomon_remote_metric_fetch_range", &c->metric_fetch_range_id, &flag);
+        margo_registered_name(mid, "symbiomon_remote_metric_aggregate", &c->metric_aggregate_id, &flag);
+        margo_registered_name(mid, "symbiomon_remote_metric_fetch_downsampled", &c->metric_fetch_downsampled_id, &flag);
+        margo_registered_name(mid, "symbiomon_remote_metric_fetch_rollup", &c->metric_fetch_rollup_id, &flag);
+        margo_registered_name(mid, "symbiomon_remote_metric_fetch_histogram", &c->metric_fetch_histogram_id, &flag);
+        margo_registered_name(mid, "symbiomon_remote_subscribe", &c->subscribe_id, &flag);
+        margo_registered_name(mid, "symbiomon_remote_unsubscribe", &c->unsubscribe_id, &flag);
     } else {
         c->metric_fetch_id = MARGO_REGISTER(mid, "symbiomon_remote_metric_fetch", metric_fetch_in_t, metric_fetch_out_t, NULL);
+        c->metric_fetch_encoded_id = MARGO_REGISTER(mid, "symbiomon_remote_metric_fetch_encoded", metric_fetch_encoded_in_t, metric_fetch_encoded_out_t, NULL);
         c->list_metrics_id = MARGO_REGISTER(mid, "symbiomon_remote_list_metrics", list_metrics_in_t, list_metrics_out_t, NULL);
+        c->metric_fetch_columns_id = MARGO_REGISTER(mid, "symbiomon_remote_metric_fetch_columns", metric_fetch_columns_in_t, metric_fetch_out_t, NULL);
+        c->metric_expose_id = MARGO_REGISTER(mid, "symbiomon_remote_metric_expose", metric_expose_in_t, metric_expose_out_t, NULL);
+        c->metric_fetch_since_id = MARGO_REGISTER(mid, "symbiomon_remote_metric_fetch_since", metric_fetch_since_in_t, metric_fetch_since_out_t, NULL);
+        c->metrics_fetch_multi_id = MARGO_REGISTER(mid, "symbiomon_remote_metrics_fetch_multi", metrics_fetch_multi_in_t, metrics_fetch_multi_out_t, NULL);
+        c->metric_fetch_range_id = MARGO_REGISTER(mid, "symbiomon_remote_metric_fetch_range", metric_fetch_range_in_t, metric_fetch_out_t, NULL);
+        c->metric_aggregate_id = MARGO_REGISTER(mid, "symbiomon_remote_metric_aggregate", metric_aggregate_in_t, metric_aggregate_out_t, NULL);
+        c->metric_fetch_downsampled_id = MARGO_REGISTER(mid, "symbiomon_remote_metric_fetch_downsampled", metric_fetch_downsampled_in_t, metric_fetch_out_t, NULL);
+        c->metric_fetch_rollup_id = MARGO_REGISTER(mid, "symbiomon_remote_metric_fetch_rollup", metric_fetch_rollup_in_t, metric_fetch_rollup_out_t, NULL);
+        c->metric_fetch_histogram_id = MARGO_REGISTER(mid, "symbiomon_remote_metric_fetch_histogram", metric_fetch_histogram_in_t, metric_fetch_histogram_out_t, NULL);
+        c->subscribe_id = MARGO_REGISTER(mid, "symbiomon_remote_subscribe", subscribe_in_t, subscribe_out_t, NULL);
+        c->unsubscribe_id = MARGO_REGISTER(mid, "symbiomon_remote_unsubscribe", unsubscribe_in_t, unsubscribe_out_t, NULL);
+    }
+
+    /* each client takes notifications under its own provider id, so that
+     * several clients can share a margo instance */
+    for(c->notify_provider_id = 0; c->notify_provider_id < MARGO_MAX_PROVIDER_ID; c->notify_provider_id++) {
+        margo_provider_registered_name(mid, "symbiomon_subscription_notify", c->notify_provider_id, &id, &flag);
+        if(flag == HG_FALSE) break;
     }
+    c->notify_id = MARGO_REGISTER_PROVIDER(mid, "symbiomon_subscription_notify", notify_in_t, notify_out_t,
+            symbiomon_subscription_notify_ult, c->notify_provider_id, ABT_POOL_NULL);
+    margo_register_data(mid, c->notify_id, (void*)c, NULL);
+    ABT_mutex_create(&c->subscriptions_mutex);
 
     c->num_metric_handles = 0;
     *client = c;
@@ -42,6 +81,12 @@ symbiomon_return_t symbiomon_client_finalize(symbiomon_client_t client)
                 "Warning: %ld metric handles not released when symbiomon_client_finalize was called\n",
                 client->num_metric_handles);
     }
+    if(client->subscriptions) {
+        fprintf(stderr,
+                "Warning: subscriptions not cancelled when symbiomon_client_finalize was called\n");
+    }
+    margo_deregister(client->mid, client->notify_id);
+    ABT_mutex_free(&client->subscriptions_mutex);
     free(client);
     return SYMBIOMON_SUCCESS;
 }
@@ -93,6 +138,12 @@ symbiomon_return_t symbiomon_metric_create(const char *ns, const char *name, sym
     return symbiomon_provider_metric_create(ns, name, t, desc, taglist, m, p);
 }
 
+symbiomon_return_t symbiomon_metric_create_with_args(const char *ns, const char *name, symbiomon_metric_type_t t, const char *desc, symbiomon_taglist_t taglist, symbiomon_metric_t* m, symbiomon_provider_t p, const struct symbiomon_metric_args* args)
+
+{
+    return symbiomon_provider_metric_create_with_args(ns, name, t, desc, taglist, m, p, args);
+}
+
 symbiomon_return_t symbiomon_metric_destroy(symbiomon_metric_t m, symbiomon_provider_t p)
 {
     return symbiomon_provider_metric_destroy(m, p);
@@ -123,34 +174,119 @@ symbiomon_return_t symbiomon_metric_global_reduce_all(symbiomon_provider_t p, si
     return symbiomon_provider_global_reduce_all_metrics(p, cohort_size);
 }
 
-symbiomon_return_t symbiomon_metric_update(symbiomon_metric_t m, double val)
+/* shard of the calling execution stream, or NULL if the metric is not
+ * sharded or if this execution stream has no shard of its own */
+static inline symbiomon_shard* metric_shard(symbiomon_metric_t m)
+{
+    int rank;
+    if(m->num_shards == 0)
+        return NULL;
+    if(ABT_self_get_xstream_rank(&rank) != ABT_SUCCESS || rank < 0 || (size_t)rank >= m->num_shards)
+        return NULL;
+    return &m->shards[rank];
+}
+
+/* checks that vals are valid for the type of the metric; counter values
+ * may not decrease, starting from the last value recorded in s */
+static inline symbiomon_return_t check_values(symbiomon_metric_t m, const symbiomon_series* s, const double* vals, size_t n)
 {
+    size_t i;
+    double last;
+
     switch(m->type) {
         case SYMBIOMON_TYPE_COUNTER:
-          if((m->buffer_index >=1) && (m->buffer[m->buffer_index-1].val > val)) 
-              return SYMBIOMON_ERR_INVALID_VALUE;
+          last = s->count ? symbiomon_series_last_val(s, 0) : -INFINITY;
+          for(i = 0; i < n; i++) {
+              if(last > vals[i])
+                  return SYMBIOMON_ERR_INVALID_VALUE;
+              last = vals[i];
+          }
           break;
         case SYMBIOMON_TYPE_TIMER:
-          if(val < 0)
-              return SYMBIOMON_ERR_INVALID_VALUE;
+          for(i = 0; i < n; i++) {
+              if(vals[i] < 0)
+                  return SYMBIOMON_ERR_INVALID_VALUE;
+          }
           break;
         case SYMBIOMON_TYPE_GAUGE:
           break;
+        case SYMBIOMON_TYPE_HISTOGRAM:
+          for(i = 0; i < n; i++) {
+              if(!(vals[i] >= 0))
+                  return SYMBIOMON_ERR_INVALID_VALUE;
+          }
+          break;
+    }
+    return SYMBIOMON_SUCCESS;
+}
+
+/* appends n samples sharing the same timestamp and sample id, either to
+ * the shard of the calling execution stream or to the locked series */
+static inline symbiomon_return_t metric_append(symbiomon_metric_t m, symbiomon_shard* shard, const double* vals, size_t n, double time, ABT_unit_id self_id)
+{
+    symbiomon_return_t ret = SYMBIOMON_SUCCESS;
+    size_t i;
+
+    /* ULTs of an execution stream do not preempt each other, so its
+     * shard can be appended to without locking */
+    if(shard) {
+        for(i = 0; i < n && ret == SYMBIOMON_SUCCESS; i++)
+            ret = symbiomon_series_append(&shard->series, vals[i], time, self_id);
+        return ret;
     }
 
-    ABT_unit_id self_id;
-  
     ABT_mutex_lock(m->metric_mutex);
+    for(i = 0; i < n && ret == SYMBIOMON_SUCCESS; i++)
+        ret = symbiomon_metric_record(m, vals[i], time, self_id);
+    ABT_mutex_unlock(m->metric_mutex);
+
+    return ret;
+}
+
+symbiomon_return_t symbiomon_metric_update(symbiomon_metric_t m, double val)
+{
+    symbiomon_shard* shard = metric_shard(m);
+    symbiomon_return_t ret = check_values(m, shard ? &shard->series : &m->series, &val, 1);
+    if(ret != SYMBIOMON_SUCCESS)
+        return ret;
+
+    ABT_unit_id self_id;
     ABT_self_get_thread_id(&self_id);
-        
-    m->buffer[m->buffer_index].val = val;
-    m->buffer[m->buffer_index].time = ABT_get_wtime();
-    m->buffer[m->buffer_index].sample_id = self_id;
-    m->buffer_index++;
 
-    ABT_mutex_unlock(m->metric_mutex);
+    return metric_append(m, shard, &val, 1, ABT_get_wtime(), self_id);
+}
 
-    return SYMBIOMON_SUCCESS;
+symbiomon_return_t symbiomon_metric_update_batch(symbiomon_metric_t m, const double* vals, size_t n)
+{
+    symbiomon_shard* shard = metric_shard(m);
+    symbiomon_return_t ret = check_values(m, shard ? &shard->series : &m->series, vals, n);
+    if(ret != SYMBIOMON_SUCCESS)
+        return ret;
+
+    ABT_unit_id self_id;
+    ABT_self_get_thread_id(&self_id);
+
+    return metric_append(m, shard, vals, n, ABT_get_wtime(), self_id);
+}
+
+symbiomon_return_t symbiomon_metrics_update_multi(symbiomon_metric_t* ms, const double* vals, size_t n)
+{
+    symbiomon_return_t ret = SYMBIOMON_SUCCESS, r;
+    ABT_unit_id self_id;
+    double time = ABT_get_wtime();
+    size_t i;
+
+    ABT_self_get_thread_id(&self_id);
+    for(i = 0; i < n; i++) {
+        symbiomon_shard* shard = metric_shard(ms[i]);
+        r = check_values(ms[i], shard ? &shard->series : &ms[i]->series, &vals[i], 1);
+        if(r == SYMBIOMON_SUCCESS)
+            r = metric_append(ms[i], shard, &vals[i], 1, time, self_id);
+        /* keep going, but report the first error */
+        if(r != SYMBIOMON_SUCCESS && ret == SYMBIOMON_SUCCESS)
+            ret = r;
+    }
+    return ret;
 }
 
 symbiomon_return_t symbiomon_metric_update_gauge_by_fixed_amount(symbiomon_metric_t m, double diff)
@@ -158,6 +294,7 @@ symbiomon_return_t symbiomon_metric_update_gauge_by_fixed_amount(symbiomon_metri
     switch(m->type) {
         case SYMBIOMON_TYPE_COUNTER:
         case SYMBIOMON_TYPE_TIMER:
+        case SYMBIOMON_TYPE_HISTOGRAM:
              return SYMBIOMON_ERR_INVALID_VALUE;
     }
 
@@ -166,19 +303,60 @@ symbiomon_return_t symbiomon_metric_update_gauge_by_fixed_amount(symbiomon_metri
     ABT_mutex_lock(m->metric_mutex);
     ABT_self_get_thread_id(&self_id);
 
-    if(m->buffer_index) {
-        m->buffer[m->buffer_index].val = m->buffer[m->buffer_index - 1].val + diff;
-    } else {
-        m->buffer[m->buffer_index].val = 1;
-    }
+    double val = 1;
+    if(m->series.count)
+        val = symbiomon_series_last_val(&m->series, 0) + diff;
 
-    m->buffer[m->buffer_index].time = ABT_get_wtime();
-    m->buffer[m->buffer_index].sample_id = self_id;
-    m->buffer_index++;
+    symbiomon_return_t ret = symbiomon_metric_record(m, val, ABT_get_wtime(), self_id);
 
 unlock:
     ABT_mutex_unlock(m->metric_mutex);
 
+    return ret;
+}
+
+symbiomon_return_t symbiomon_metric_increment(symbiomon_metric_t m, uint64_t delta)
+{
+    if(m->type != SYMBIOMON_TYPE_COUNTER)
+        return SYMBIOMON_ERR_INVALID_VALUE;
+
+    /* the value only becomes a sample when the metric is fetched,
+     * reduced, dumped, or when its periodic snapshot runs */
+    __atomic_fetch_add(&m->increments, delta, __ATOMIC_RELAXED);
+    return SYMBIOMON_SUCCESS;
+}
+
+symbiomon_return_t symbiomon_metric_get_stats(symbiomon_metric_t m, symbiomon_metric_stats_scope_t scope, symbiomon_metric_stats* stats)
+{
+    symbiomon_summary s;
+    size_t i;
+
+    ABT_mutex_lock(m->metric_mutex);
+    symbiomon_metric_materialize(m);
+    if(scope == SYMBIOMON_STATS_INTERVAL) {
+        s = m->interval;
+    } else {
+        s = m->reduced;
+        symbiomon_summary_merge(&s, &m->interval);
+    }
+    /* shards do not keep accumulators: summarize their unreduced samples */
+    for(i = 0; i < m->num_shards; i++) {
+        symbiomon_series* series = &m->shards[i].series;
+        uint64_t end = symbiomon_series_count(series);
+        uint64_t first = end > series->capacity ? end - series->capacity : 0;
+        if(first < m->shards[i].reduced_index)
+            first = m->shards[i].reduced_index;
+        symbiomon_series_summarize(series, first, end, &s);
+    }
+    ABT_mutex_unlock(m->metric_mutex);
+
+    stats->count    = s.count;
+    stats->sum      = s.sum;
+    stats->min      = s.count ? s.min : 0.0;
+    stats->max      = s.count ? s.max : 0.0;
+    stats->mean     = s.mean;
+    stats->variance = symbiomon_summary_variance(&s);
+
     return SYMBIOMON_SUCCESS;
 }
 
@@ -189,43 +367,126 @@ symbiomon_return_t symbiomon_metric_register_retrieval_callback(char *ns, func f
     return SYMBIOMON_SUCCESS;
 }
 
+symbiomon_return_t symbiomon_metric_get_histogram(symbiomon_metric_t m, symbiomon_histogram* h)
+{
+    if(!m->histogram)
+        return SYMBIOMON_ERR_OP_UNSUPPORTED;
+    ABT_mutex_lock(m->metric_mutex);
+    *h = *m->histogram;
+    ABT_mutex_unlock(m->metric_mutex);
+    return SYMBIOMON_SUCCESS;
+}
+
+/* one line per non-empty bucket of a histogram metric */
+static symbiomon_return_t dump_buckets(symbiomon_metric_t m, FILE* fp)
+{
+    symbiomon_histogram* h = (symbiomon_histogram*)malloc(sizeof(*h));
+    size_t i;
+    if(!h)
+        return SYMBIOMON_ERR_ALLOCATION;
+    symbiomon_metric_get_histogram(m, h);
+    fprintf(fp, "%lu, %lf, %lf\n", h->count, h->count ? h->min : 0.0, h->count ? h->max : 0.0);
+    for(i = 0; i < SYMBIOMON_HISTOGRAM_BUCKETS; i++) {
+        if(h->buckets[i])
+            fprintf(fp, "%.9lf, %.9lf, %lu\n", symbiomon_histogram_bucket_lower(i), symbiomon_histogram_bucket_upper(i), h->buckets[i]);
+    }
+    free(h);
+    return SYMBIOMON_SUCCESS;
+}
+
 symbiomon_return_t symbiomon_metric_dump_histogram(symbiomon_metric_t m, const char *filename, size_t num_buckets)
 {
-    double max = 0;
-    double min = 9999999999999;
+    double max = -INFINITY;
+    double min = INFINITY;
+    symbiomon_return_t ret = SYMBIOMON_SUCCESS;
+
+    if(!m->histogram && num_buckets == 0)
+        return SYMBIOMON_ERR_INVALID_ARGS;
+    FILE *fp = fopen(filename, "w");
+    if(!fp)
+        return SYMBIOMON_ERR_INVALID_ARGS;
+    if(m->histogram) {
+        ret = dump_buckets(m, fp);
+        fclose(fp);
+        return ret;
+    }
 
-    fprintf(stderr, "Invoked dump histogram\n");
-    int i = 0; 
+    ABT_mutex_lock(m->metric_mutex);
+    symbiomon_metric_materialize(m);
+    ABT_mutex_unlock(m->metric_mutex);
+    uint64_t seq, end;
+    size_t i, k, n;
+    double scratch[256];
+    const double* vals;
+    symbiomon_series* series;
     size_t *buckets = (size_t*)calloc(num_buckets, sizeof(size_t));
-    for(i = 0 ; i < m->buffer_index; i++) {
-        if(m->buffer[i].val > max)
-            max = m->buffer[i].val;
-	if(m->buffer[i].val < min)
-	    min = m->buffer[i].val;
+    if(!buckets) {
+        fclose(fp);
+        return SYMBIOMON_ERR_ALLOCATION;
+    }
+    for(k = 0; k <= m->num_shards; k++) {
+        series = symbiomon_metric_series(m, k);
+        end = symbiomon_series_count(series);
+        for(seq = end > series->capacity ? end - series->capacity : 0; seq < end; seq += n) {
+            n = symbiomon_series_values(series, seq, end - seq, scratch, 256, &vals);
+            for(i = 0; i < n; i++) {
+                if(vals[i] > max)
+                    max = vals[i];
+	        if(vals[i] < min)
+	            min = vals[i];
+            }
+        }
     }
 
-    int bucket_index;
-    for(i = 0 ; i < m->buffer_index; i++) {
-        bucket_index = (int)(((m->buffer[i].val - min)/(max - min))*num_buckets);
-        buckets[bucket_index]++;
+    /* samples written between the two passes may fall outside [min, max]:
+     * they go to the first or last bucket, as does everything if all the
+     * samples are equal */
+    size_t bucket_index;
+    for(k = 0; k <= m->num_shards && min <= max; k++) {
+        series = symbiomon_metric_series(m, k);
+        end = symbiomon_series_count(series);
+        for(seq = end > series->capacity ? end - series->capacity : 0; seq < end; seq += n) {
+            n = symbiomon_series_values(series, seq, end - seq, scratch, 256, &vals);
+            for(i = 0; i < n; i++) {
+                bucket_index = 0;
+                if(max > min && vals[i] > min)
+                    bucket_index = (size_t)(((vals[i] - min)/(max - min))*num_buckets);
+                if(bucket_index >= num_buckets)
+                    bucket_index = num_buckets - 1;
+                buckets[bucket_index]++;
+            }
+        }
     }
+    if(min > max)
+        min = max = 0.0;
 
-    FILE *fp = fopen(filename, "w");
     fprintf(fp, "%lu, %lf, %lf\n", num_buckets, min, max);
     for(i = 0; i < num_buckets; i++)
         fprintf(fp, "%lu\n", buckets[i]);
     fclose(fp);
     free(buckets);
-
+    return SYMBIOMON_SUCCESS;
 }
 
 symbiomon_return_t symbiomon_metric_dump_raw_data(symbiomon_metric_t m, const char *filename)
 {
 
     FILE *fp = fopen(filename, "w");
-    int i;
-    for(i = 0; i < m->buffer_index; i++)
-        fprintf(fp, "%.9lf, %.9lf, %lu\n", m->buffer[i].val, m->buffer[i].time, m->buffer[i].sample_id);
+    size_t i, n = 0;
+    ABT_mutex_lock(m->metric_mutex);
+    symbiomon_metric_materialize(m);
+    n = m->history.num_samples;
+    ABT_mutex_unlock(m->metric_mutex);
+    for(i = 0; i <= m->num_shards; i++)
+        n += symbiomon_series_size(symbiomon_metric_series(m, i));
+    /* samples of all the shards, merged by timestamp, preceded by the
+     * compressed history if any */
+    symbiomon_metric_buffer buf = (symbiomon_metric_buffer)malloc(n*sizeof(*buf));
+    if(buf) n = symbiomon_provider_metric_copy_last(m, n, buf);
+    for(i = 0; buf && i < n; i++) {
+        fprintf(fp, "%.9lf, %.9lf, %lu\n", buf[i].val, buf[i].time, buf[i].sample_id);
+    }
+    free(buf);
     fclose(fp);
 }
 
@@ -241,148 +502,1479 @@ symbiomon_return_t symbiomon_remote_metric_get_id(char *ns, char *name, symbiomo
     return SYMBIOMON_SUCCESS;
 }
 
-symbiomon_return_t symbiomon_remote_metric_fetch(symbiomon_metric_handle_t handle, int64_t *num_samples_requested, symbiomon_metric_buffer *buf)
+/* number of bulk transfers a pull keeps in flight at once */
+#define MAX_INFLIGHT_PULLS 16
+
+static hg_return_t pull_count(symbiomon_metric_handle_t handle)
 {
-    hg_handle_t h;
-    metric_fetch_in_t in;
-    metric_fetch_out_t out;
-    hg_bulk_t local_bulk;
+    return margo_bulk_transfer(handle->client->mid, HG_BULK_PULL, handle->addr,
+            handle->pull_bulk, 0, handle->pull_count_bulk, 0, sizeof(uint64_t));
+}
 
-    hg_return_t ret;
-    in.metric_id = handle->metric_id;
+/* pulls the samples [first, first+n) of the remote ring into local_bulk,
+ * one transfer per contiguous run */
+static hg_return_t pull_runs(symbiomon_metric_handle_t handle, uint64_t first, size_t n, hg_bulk_t local_bulk)
+{
+    margo_request reqs[MAX_INFLIGHT_PULLS];
+    size_t i, num_reqs = 0, pulled = 0;
+    hg_size_t chunk_bytes = handle->pull_chunk_size*sizeof(symbiomon_metric_sample);
+    hg_return_t hret = HG_SUCCESS;
+
+    while(pulled < n || num_reqs) {
+        if(pulled < n && hret == HG_SUCCESS && num_reqs < MAX_INFLIGHT_PULLS) {
+            uint64_t slot = (first + pulled) % handle->pull_capacity;
+            uint64_t off = slot % handle->pull_chunk_size;
+            size_t len = n - pulled;
+            if(len > handle->pull_chunk_size - off) len = handle->pull_chunk_size - off;
+            if(len > handle->pull_capacity - slot) len = handle->pull_capacity - slot;
+            /* the remote region is the count followed by the chunks */
+            hg_size_t remote_offset = sizeof(uint64_t)
+                + (slot / handle->pull_chunk_size)*chunk_bytes
+                + off*sizeof(symbiomon_metric_sample);
+            hret = margo_bulk_itransfer(handle->client->mid, HG_BULK_PULL, handle->addr,
+                    handle->pull_bulk, remote_offset, local_bulk, pulled*sizeof(symbiomon_metric_sample),
+                    len*sizeof(symbiomon_metric_sample), &reqs[num_reqs]);
+            if(hret == HG_SUCCESS) num_reqs++;
+            pulled += len;
+            continue;
+        }
+        for(i = 0; i < num_reqs; i++) {
+            hg_return_t r = margo_wait(reqs[i]);
+            if(hret == HG_SUCCESS) hret = r;
+        }
+        num_reqs = 0;
+        if(hret != HG_SUCCESS) break;
+    }
+    return hret;
+}
 
-    if(*num_samples_requested >= METRIC_BUFFER_SIZE || *num_samples_requested < 0)
-        *num_samples_requested = METRIC_BUFFER_SIZE;
+/*
+ * Fetch without any RPC: reads the remote count, pulls the samples
+ * appended since the previous pull (the most recent ones if there are
+ * more than requested), then reads the count again to drop the samples
+ * that the provider overwrote while they were being pulled.
+ */
+static symbiomon_return_t pull_samples(symbiomon_metric_handle_t handle, int64_t *num_samples_requested, symbiomon_metric_buffer *buf)
+{
+    hg_bulk_t local_bulk = HG_BULK_NULL;
+    hg_return_t hret;
+    uint64_t count, first, torn = 0;
+    size_t n;
 
-    in.count = *num_samples_requested;
+    hret = pull_count(handle);
+    if(hret != HG_SUCCESS)
+        return SYMBIOMON_ERR_FROM_MERCURY;
+    count = handle->pull_count;
+
+    first = handle->pull_cursor;
+    if(count > handle->pull_capacity && first < count - handle->pull_capacity)
+        first = count - handle->pull_capacity;
+    if(count - first > (uint64_t)*num_samples_requested)
+        first = count - *num_samples_requested;
+    n = count - first;
 
     symbiomon_metric_buffer b = (symbiomon_metric_buffer)calloc(*num_samples_requested, sizeof(symbiomon_metric_sample));
-    hg_size_t segment_sizes[1] = {*num_samples_requested*sizeof(symbiomon_metric_sample)};
-    void *segment_ptrs[1] = {(void*)b};
+    if(!b)
+        return SYMBIOMON_ERR_ALLOCATION;
+
+    if(n) {
+        void* ptr = b;
+        hg_size_t size = n*sizeof(symbiomon_metric_sample);
+        hret = margo_bulk_create(handle->client->mid, 1, &ptr, &size, HG_BULK_WRITE_ONLY, &local_bulk);
+        if(hret == HG_SUCCESS)
+            hret = pull_runs(handle, first, n, local_bulk);
+        if(hret == HG_SUCCESS)
+            hret = pull_count(handle);
+        if(local_bulk != HG_BULK_NULL)
+            margo_bulk_free(local_bulk);
+        if(hret != HG_SUCCESS) {
+            free(b);
+            return SYMBIOMON_ERR_FROM_MERCURY;
+        }
+        /* a sample is only overwritten once the count has moved a full
+         * ring past it (see symbiomon_series_torn on the provider side) */
+        if(handle->pull_count + 1 > handle->pull_capacity + first)
+            torn = handle->pull_count + 1 - handle->pull_capacity - first;
+        if(torn > n) torn = n;
+        if(torn) {
+            n -= torn;
+            memmove(b, b + torn, n*sizeof(*b));
+        }
+    }
 
-    ret = margo_bulk_create(handle->client->mid, 1,  segment_ptrs, segment_sizes, HG_BULK_WRITE_ONLY, &local_bulk);
-    in.bulk = local_bulk;
-    assert(ret == HG_SUCCESS);
+    handle->pull_cursor = count;
+    *num_samples_requested = n;
+    *buf = b;
+    return SYMBIOMON_SUCCESS;
+}
+
+symbiomon_return_t symbiomon_remote_metric_enable_pull(symbiomon_metric_handle_t handle)
+{
+    hg_handle_t h;
+    metric_expose_in_t in;
+    metric_expose_out_t out;
+    hg_return_t hret;
+    symbiomon_return_t ret;
 
-    if(!in.bulk) fprintf(stderr, "Damn!! bulk is null!\n");
-    fprintf(stderr, "Received a request for %d samples and allocated segment size: %lu\n", *num_samples_requested, segment_sizes[0]);
+    if(handle == SYMBIOMON_METRIC_HANDLE_NULL)
+        return SYMBIOMON_ERR_INVALID_ARGS;
+    if(handle->pull_bulk != HG_BULK_NULL)
+        return SYMBIOMON_SUCCESS;
+
+    if(handle->pull_count_bulk == HG_BULK_NULL) {
+        void* ptr = &handle->pull_count;
+        hg_size_t size = sizeof(handle->pull_count);
+        hret = margo_bulk_create(handle->client->mid, 1, &ptr, &size, HG_BULK_WRITE_ONLY, &handle->pull_count_bulk);
+        if(hret != HG_SUCCESS)
+            return SYMBIOMON_ERR_FROM_MERCURY;
+    }
+
+    in.metric_id = handle->metric_id;
 
-    ret = margo_create(handle->client->mid, handle->addr, handle->client->metric_fetch_id, &h);
-    
-    assert(ret == HG_SUCCESS);
-    if(ret != HG_SUCCESS)         
-        return SYMBIOMON_ERR_FROM_MERCURY; 
+    hret = margo_create(handle->client->mid, handle->addr, handle->client->metric_expose_id, &h);
+    if(hret != HG_SUCCESS)
+        return SYMBIOMON_ERR_FROM_MERCURY;
 
-    ret = margo_provider_forward(handle->provider_id, h, &in);
-    if(ret != HG_SUCCESS) {
+    hret = margo_provider_forward(handle->provider_id, h, &in);
+    if(hret != HG_SUCCESS) {
         margo_destroy(h);
-	return SYMBIOMON_ERR_FROM_MERCURY;
+        return SYMBIOMON_ERR_FROM_MERCURY;
     }
 
-    ret = margo_get_output(h, &out);
-    if(ret != HG_SUCCESS) {
-	margo_free_output(h, &out);
+    hret = margo_get_output(h, &out);
+    if(hret != HG_SUCCESS) {
         margo_destroy(h);
-	return SYMBIOMON_ERR_FROM_MERCURY;
+        return SYMBIOMON_ERR_FROM_MERCURY;
     }
 
-    *num_samples_requested = out.actual_count;
-    *buf = b;
+    ret = out.ret;
+    if(ret == SYMBIOMON_SUCCESS) {
+        /* keep the remote bulk handle past the output's lifetime */
+        HG_Bulk_ref_incr(out.bulk);
+        handle->pull_bulk = out.bulk;
+        handle->pull_capacity = out.capacity;
+        handle->pull_chunk_size = out.chunk_size;
+        handle->pull_cursor = 0;
+    }
 
     margo_free_output(h, &out);
     margo_destroy(h);
-    margo_bulk_free(local_bulk);
-
-    return out.ret;
+    return ret;
 }
 
-symbiomon_return_t symbiomon_remote_metric_handle_create(
-        symbiomon_client_t client,
-        hg_addr_t addr,
-        uint16_t provider_id,
-        symbiomon_metric_id_t metric_id,
-        symbiomon_metric_handle_t* handle)
+/* Reads the output of a completed request and releases it. hret is the
+ * result of waiting for the response. */
+static symbiomon_return_t finish_request(symbiomon_request* r, hg_return_t hret)
 {
-    if(client == SYMBIOMON_CLIENT_NULL)
-        return SYMBIOMON_ERR_INVALID_ARGS;
-
-    symbiomon_metric_handle_t rh =
-        (symbiomon_metric_handle_t)calloc(1, sizeof(*rh));
+    symbiomon_return_t ret = r->ret;
+    if(r->handle != HG_HANDLE_NULL) {
+        ret = hret == HG_SUCCESS ? r->complete(r) : SYMBIOMON_ERR_FROM_MERCURY;
+        margo_destroy(r->handle);
+    }
+    if(r->bulk != HG_BULK_NULL)
+        margo_bulk_free(r->bulk);
+    if(ret != SYMBIOMON_SUCCESS)
+        free(r->samples);
+    free(r);
+    return ret;
+}
 
-    if(!rh) return SYMBIOMON_ERR_ALLOCATION;
+static symbiomon_return_t complete_fetch(symbiomon_request* r)
+{
+    metric_fetch_out_t out;
+    symbiomon_return_t ret;
 
-    hg_return_t ret = margo_addr_dup(client->mid, addr, &(rh->addr));
-    if(ret != HG_SUCCESS) {
-        free(rh);
+    if(margo_get_output(r->handle, &out) != HG_SUCCESS)
         return SYMBIOMON_ERR_FROM_MERCURY;
+
+    ret = out.ret;
+    if(ret == SYMBIOMON_SUCCESS) {
+        *r->num_samples = out.actual_count;
+        *r->buf = r->samples;
     }
+    margo_free_output(r->handle, &out);
+    return ret;
+}
 
-    rh->client      = client;
-    rh->provider_id = provider_id;
-    rh->metric_id   = metric_id;
-    rh->refcount    = 1;
+static symbiomon_return_t complete_fetch_encoded(symbiomon_request* r)
+{
+    metric_fetch_encoded_out_t out;
+    symbiomon_return_t ret;
+    /* *r->num_samples still holds the count the buffer was sized for */
+    int64_t requested = *r->num_samples;
+    uint64_t buf_size = (requested ? requested : 1)*sizeof(symbiomon_metric_sample);
 
-    client->num_metric_handles += 1;
+    if(margo_get_output(r->handle, &out) != HG_SUCCESS)
+        return SYMBIOMON_ERR_FROM_MERCURY;
 
-    *handle = rh;
-    return SYMBIOMON_SUCCESS;
+    ret = out.ret;
+    /* the reply is not trusted to stay within the buffer */
+    if(ret == SYMBIOMON_SUCCESS
+    && (out.actual_count < 0 || out.actual_count > requested || out.payload_size > buf_size))
+        ret = SYMBIOMON_ERR_INVALID_ARGS;
+    if(ret == SYMBIOMON_SUCCESS && out.encoding == SYMBIOMON_ENCODING_BLOCK) {
+        /* the block sits at the front of the buffer and is decoded
+         * into a buffer of its own */
+        symbiomon_metric_buffer b = (symbiomon_metric_buffer)malloc((out.actual_count ? out.actual_count : 1)*sizeof(*b));
+        if(!b) {
+            ret = SYMBIOMON_ERR_ALLOCATION;
+        } else if((ret = symbiomon_block_decode((const uint8_t*)r->samples, out.payload_size,
+                        out.actual_count, b)) != SYMBIOMON_SUCCESS) {
+            free(b);
+        } else {
+            free(r->samples);
+            r->samples = b;
+        }
+    } else if(ret == SYMBIOMON_SUCCESS && out.encoding != SYMBIOMON_ENCODING_RAW) {
+        ret = SYMBIOMON_ERR_OP_UNSUPPORTED;
+    }
+    if(ret == SYMBIOMON_SUCCESS) {
+        *r->num_samples = out.actual_count;
+        *r->buf = r->samples;
+    }
+    margo_free_output(r->handle, &out);
+    return ret;
 }
 
-symbiomon_return_t symbiomon_remote_metric_handle_ref_incr(
-        symbiomon_metric_handle_t handle)
+symbiomon_return_t symbiomon_client_set_fetch_encoding(symbiomon_client_t client, symbiomon_fetch_encoding_t encoding)
 {
-    if(handle == SYMBIOMON_METRIC_HANDLE_NULL)
+    if(encoding != SYMBIOMON_ENCODING_RAW && encoding != SYMBIOMON_ENCODING_BLOCK)
         return SYMBIOMON_ERR_INVALID_ARGS;
-    handle->refcount += 1;
+    client->fetch_encoding = encoding;
     return SYMBIOMON_SUCCESS;
 }
 
-symbiomon_return_t symbiomon_remote_metric_handle_release(symbiomon_metric_handle_t handle)
+symbiomon_return_t symbiomon_remote_metric_ifetch(symbiomon_metric_handle_t handle, int64_t *num_samples_requested, symbiomon_metric_buffer *buf, symbiomon_request_t *req)
 {
-    if(handle == SYMBIOMON_METRIC_HANDLE_NULL)
-        return SYMBIOMON_ERR_INVALID_ARGS;
-    handle->refcount -= 1;
-    if(handle->refcount == 0) {
-        margo_addr_free(handle->client->mid, handle->addr);
-        handle->client->num_metric_handles -= 1;
-        free(handle);
+    metric_fetch_in_t in;
+    metric_fetch_encoded_in_t encoded_in;
+    symbiomon_fetch_encoding_t encoding = handle->client->fetch_encoding;
+    hg_return_t hret;
+
+    symbiomon_request* r = (symbiomon_request*)calloc(1, sizeof(*r));
+    if(!r)
+        return SYMBIOMON_ERR_ALLOCATION;
+    r->handle      = HG_HANDLE_NULL;
+    r->bulk        = HG_BULK_NULL;
+    r->complete    = complete_fetch;
+    r->num_samples = num_samples_requested;
+    r->buf         = buf;
+
+    /* a negative count requests the default window; the provider
+     * clamps the answer to what the metric's ring actually retains */
+    if(*num_samples_requested < 0)
+        *num_samples_requested = METRIC_BUFFER_SIZE;
+
+    /* pulls are one-sided and done by the time they return */
+    if(handle->pull_bulk != HG_BULK_NULL) {
+        r->ret = pull_samples(handle, num_samples_requested, buf);
+        *req = r;
+        return SYMBIOMON_SUCCESS;
+    }
+
+    in.metric_id = handle->metric_id;
+    in.count = *num_samples_requested;
+
+    r->samples = (symbiomon_metric_buffer)calloc(in.count ? in.count : 1, sizeof(symbiomon_metric_sample));
+    if(!r->samples) {
+        free(r);
+        return SYMBIOMON_ERR_ALLOCATION;
+    }
+    void* ptr = r->samples;
+    hg_size_t size = (in.count ? in.count : 1)*sizeof(symbiomon_metric_sample);
+
+    hret = margo_bulk_create(handle->client->mid, 1, &ptr, &size, HG_BULK_WRITE_ONLY, &r->bulk);
+    if(hret != HG_SUCCESS) {
+        r->bulk = HG_BULK_NULL;
+        r->ret = SYMBIOMON_ERR_FROM_MERCURY;
+        return finish_request(r, HG_SUCCESS);
     }
+    in.bulk = r->bulk;
+
+    /* encoded payloads go through their own RPC, plain fetches keep
+     * using the one every provider understands */
+    hret = margo_create(handle->client->mid, handle->addr,
+            encoding == SYMBIOMON_ENCODING_RAW ? handle->client->metric_fetch_id : handle->client->metric_fetch_encoded_id,
+            &r->handle);
+    if(hret != HG_SUCCESS) {
+        r->handle = HG_HANDLE_NULL;
+        r->ret = SYMBIOMON_ERR_FROM_MERCURY;
+        return finish_request(r, HG_SUCCESS);
+    }
+
+    if(encoding == SYMBIOMON_ENCODING_RAW) {
+        hret = margo_provider_iforward(handle->provider_id, r->handle, &in, &r->req);
+    } else {
+        encoded_in.metric_id = in.metric_id;
+        encoded_in.count = in.count;
+        encoded_in.encoding = encoding;
+        encoded_in.bulk = in.bulk;
+        r->complete = complete_fetch_encoded;
+        hret = margo_provider_iforward(handle->provider_id, r->handle, &encoded_in, &r->req);
+    }
+    if(hret != HG_SUCCESS)
+        return finish_request(r, hret);
+
+    *req = r;
     return SYMBIOMON_SUCCESS;
 }
 
-symbiomon_return_t symbiomon_remote_list_metrics(symbiomon_client_t client, hg_addr_t addr, uint16_t provider_id, symbiomon_metric_id_t** ids, size_t* count)
+symbiomon_return_t symbiomon_remote_metric_fetch(symbiomon_metric_handle_t handle, int64_t *num_samples_requested, symbiomon_metric_buffer *buf)
+{
+    symbiomon_request_t req;
+    symbiomon_return_t ret = symbiomon_remote_metric_ifetch(handle, num_samples_requested, buf, &req);
+    if(ret != SYMBIOMON_SUCCESS)
+        return ret;
+    return symbiomon_request_wait(req);
+}
+
+symbiomon_return_t symbiomon_remote_metric_fetch_columns(symbiomon_metric_handle_t handle, int64_t *num_samples_requested, uint32_t columns, symbiomon_metric_columns *cols)
 {
     hg_handle_t h;
-    list_metrics_in_t  in;
-    list_metrics_out_t out;
-    symbiomon_return_t ret;
+    metric_fetch_columns_in_t in;
+    metric_fetch_out_t out;
+    hg_bulk_t local_bulk;
     hg_return_t hret;
+    symbiomon_return_t ret;
 
-    in.max_ids = *count;
+    if(*num_samples_requested < 0)
+        *num_samples_requested = METRIC_BUFFER_SIZE;
 
-    hret = margo_create(client->mid, addr, client->list_metrics_id, &h);
-    if(hret != HG_SUCCESS)
-        return SYMBIOMON_ERR_FROM_MERCURY;
+    in.metric_id = handle->metric_id;
+    in.count = *num_samples_requested;
+    in.columns = columns;
+
+    /* one bulk segment per requested column, in value, time, sample id order */
+    hg_size_t segment_sizes[3];
+    void *segment_ptrs[3];
+    uint32_t num_segments = 0;
+    hg_size_t column_size = in.count*sizeof(double);
+
+    memset(cols, 0, sizeof(*cols));
+    if(columns & SYMBIOMON_COLUMN_VAL) {
+        cols->val = (double*)calloc(in.count, sizeof(double));
+        segment_ptrs[num_segments] = cols->val;
+        segment_sizes[num_segments++] = column_size;
+    }
+    if(columns & SYMBIOMON_COLUMN_TIME) {
+        cols->time = (double*)calloc(in.count, sizeof(double));
+        segment_ptrs[num_segments] = cols->time;
+        segment_sizes[num_segments++] = column_size;
+    }
+    if(columns & SYMBIOMON_COLUMN_SAMPLE_ID) {
+        cols->sample_id = (uint64_t*)calloc(in.count, sizeof(uint64_t));
+        segment_ptrs[num_segments] = cols->sample_id;
+        segment_sizes[num_segments++] = column_size;
+    }
+    if(num_segments == 0)
+        return SYMBIOMON_ERR_INVALID_ARGS;
 
-    hret = margo_provider_forward(provider_id, h, &in);
+    hret = margo_bulk_create(handle->client->mid, num_segments, segment_ptrs, segment_sizes, HG_BULK_WRITE_ONLY, &local_bulk);
+    if(hret != HG_SUCCESS) {
+        ret = SYMBIOMON_ERR_FROM_MERCURY;
+        goto error;
+    }
+    in.bulk = local_bulk;
+
+    hret = margo_create(handle->client->mid, handle->addr, handle->client->metric_fetch_columns_id, &h);
+    if(hret != HG_SUCCESS) {
+        margo_bulk_free(local_bulk);
+        ret = SYMBIOMON_ERR_FROM_MERCURY;
+        goto error;
+    }
+
+    hret = margo_provider_forward(handle->provider_id, h, &in);
     if(hret != HG_SUCCESS) {
         margo_destroy(h);
-        return SYMBIOMON_ERR_FROM_MERCURY;
+        margo_bulk_free(local_bulk);
+        ret = SYMBIOMON_ERR_FROM_MERCURY;
+        goto error;
     }
 
     hret = margo_get_output(h, &out);
     if(hret != HG_SUCCESS) {
         margo_destroy(h);
-        return SYMBIOMON_ERR_FROM_MERCURY;
+        margo_bulk_free(local_bulk);
+        ret = SYMBIOMON_ERR_FROM_MERCURY;
+        goto error;
     }
 
     ret = out.ret;
-    if(ret == SYMBIOMON_SUCCESS) {
-        *count = out.count;
-        memcpy(*ids, out.ids, out.count*sizeof(symbiomon_metric_id_t));
-    }
-    
+    *num_samples_requested = out.actual_count;
+
     margo_free_output(h, &out);
     margo_destroy(h);
+    margo_bulk_free(local_bulk);
+    if(ret == SYMBIOMON_SUCCESS)
+        return ret;
+
+error:
+    free(cols->val);
+    free(cols->time);
+    free(cols->sample_id);
+    memset(cols, 0, sizeof(*cols));
     return ret;
 }
+
+symbiomon_return_t symbiomon_remote_metric_fetch_range(symbiomon_metric_handle_t handle, double t0, double t1, int64_t *num_samples_requested, symbiomon_metric_buffer *buf)
+{
+    hg_handle_t h;
+    metric_fetch_range_in_t in;
+    metric_fetch_out_t out;
+    hg_bulk_t local_bulk;
+    hg_return_t hret;
+    symbiomon_return_t ret;
+
+    if(*num_samples_requested < 0)
+        *num_samples_requested = METRIC_BUFFER_SIZE;
+
+    in.metric_id = handle->metric_id;
+    in.count = *num_samples_requested;
+    in.t0 = t0;
+    in.t1 = t1;
+
+    symbiomon_metric_buffer b = (symbiomon_metric_buffer)calloc(in.count ? in.count : 1, sizeof(symbiomon_metric_sample));
+    if(!b)
+        return SYMBIOMON_ERR_ALLOCATION;
+    void* ptr = b;
+    hg_size_t size = (in.count ? in.count : 1)*sizeof(symbiomon_metric_sample);
+
+    hret = margo_bulk_create(handle->client->mid, 1, &ptr, &size, HG_BULK_WRITE_ONLY, &local_bulk);
+    if(hret != HG_SUCCESS) {
+        free(b);
+        return SYMBIOMON_ERR_FROM_MERCURY;
+    }
+    in.bulk = local_bulk;
+
+    hret = margo_create(handle->client->mid, handle->addr, handle->client->metric_fetch_range_id, &h);
+    if(hret != HG_SUCCESS) {
+        margo_bulk_free(local_bulk);
+        free(b);
+        return SYMBIOMON_ERR_FROM_MERCURY;
+    }
+
+    hret = margo_provider_forward(handle->provider_id, h, &in);
+    if(hret == HG_SUCCESS)
+        hret = margo_get_output(h, &out);
+    margo_bulk_free(local_bulk);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        free(b);
+        return SYMBIOMON_ERR_FROM_MERCURY;
+    }
+
+    ret = out.ret;
+    if(ret == SYMBIOMON_SUCCESS) {
+        *num_samples_requested = out.actual_count;
+        *buf = b;
+    } else {
+        free(b);
+    }
+
+    margo_free_output(h, &out);
+    margo_destroy(h);
+    return ret;
+}
+
+symbiomon_return_t symbiomon_remote_metric_fetch_downsampled(symbiomon_metric_handle_t handle, symbiomon_downsample_mode_t mode, int64_t *num_points, symbiomon_metric_buffer *buf)
+{
+    hg_handle_t h;
+    metric_fetch_downsampled_in_t in;
+    metric_fetch_out_t out;
+    hg_bulk_t local_bulk;
+    hg_return_t hret;
+    symbiomon_return_t ret;
+
+    if(*num_points <= 0)
+        return SYMBIOMON_ERR_INVALID_ARGS;
+
+    in.metric_id = handle->metric_id;
+    in.count = *num_points;
+    in.mode = mode;
+
+    symbiomon_metric_buffer b = (symbiomon_metric_buffer)calloc(in.count, sizeof(symbiomon_metric_sample));
+    if(!b)
+        return SYMBIOMON_ERR_ALLOCATION;
+    void* ptr = b;
+    hg_size_t size = in.count*sizeof(symbiomon_metric_sample);
+
+    hret = margo_bulk_create(handle->client->mid, 1, &ptr, &size, HG_BULK_WRITE_ONLY, &local_bulk);
+    if(hret != HG_SUCCESS) {
+        free(b);
+        return SYMBIOMON_ERR_FROM_MERCURY;
+    }
+    in.bulk = local_bulk;
+
+    hret = margo_create(handle->client->mid, handle->addr, handle->client->metric_fetch_downsampled_id, &h);
+    if(hret != HG_SUCCESS) {
+        margo_bulk_free(local_bulk);
+        free(b);
+        return SYMBIOMON_ERR_FROM_MERCURY;
+    }
+
+    hret = margo_provider_forward(handle->provider_id, h, &in);
+    if(hret == HG_SUCCESS)
+        hret = margo_get_output(h, &out);
+    margo_bulk_free(local_bulk);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        free(b);
+        return SYMBIOMON_ERR_FROM_MERCURY;
+    }
+
+    ret = out.ret;
+    if(ret == SYMBIOMON_SUCCESS) {
+        *num_points = out.actual_count;
+        *buf = b;
+    } else {
+        free(b);
+    }
+
+    margo_free_output(h, &out);
+    margo_destroy(h);
+    return ret;
+}
+
+symbiomon_return_t symbiomon_remote_metric_fetch_rollup(symbiomon_metric_handle_t handle, double t0, double t1, double resolution, int64_t *num_buckets, symbiomon_rollup **buf, double *period)
+{
+    hg_handle_t h;
+    metric_fetch_rollup_in_t in;
+    metric_fetch_rollup_out_t out;
+    hg_bulk_t local_bulk;
+    hg_return_t hret;
+    symbiomon_return_t ret;
+
+    if(*num_buckets <= 0 || t1 < t0)
+        return SYMBIOMON_ERR_INVALID_ARGS;
+
+    in.metric_id = handle->metric_id;
+    in.count = *num_buckets;
+    in.t0 = t0;
+    in.t1 = t1;
+    in.resolution = resolution;
+
+    symbiomon_rollup* b = (symbiomon_rollup*)calloc(in.count, sizeof(symbiomon_rollup));
+    if(!b)
+        return SYMBIOMON_ERR_ALLOCATION;
+    void* ptr = b;
+    hg_size_t size = in.count*sizeof(symbiomon_rollup);
+
+    hret = margo_bulk_create(handle->client->mid, 1, &ptr, &size, HG_BULK_WRITE_ONLY, &local_bulk);
+    if(hret != HG_SUCCESS) {
+        free(b);
+        return SYMBIOMON_ERR_FROM_MERCURY;
+    }
+    in.bulk = local_bulk;
+
+    hret = margo_create(handle->client->mid, handle->addr, handle->client->metric_fetch_rollup_id, &h);
+    if(hret != HG_SUCCESS) {
+        margo_bulk_free(local_bulk);
+        free(b);
+        return SYMBIOMON_ERR_FROM_MERCURY;
+    }
+
+    hret = margo_provider_forward(handle->provider_id, h, &in);
+    if(hret == HG_SUCCESS)
+        hret = margo_get_output(h, &out);
+    margo_bulk_free(local_bulk);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        free(b);
+        return SYMBIOMON_ERR_FROM_MERCURY;
+    }
+
+    ret = out.ret;
+    if(ret == SYMBIOMON_SUCCESS) {
+        *num_buckets = out.actual_count;
+        *buf = b;
+        if(period) *period = out.period;
+    } else {
+        free(b);
+    }
+
+    margo_free_output(h, &out);
+    margo_destroy(h);
+    return ret;
+}
+
+static symbiomon_return_t complete_histogram(symbiomon_request* r)
+{
+    metric_fetch_histogram_out_t out;
+    symbiomon_return_t ret;
+
+    if(margo_get_output(r->handle, &out) != HG_SUCCESS)
+        return SYMBIOMON_ERR_FROM_MERCURY;
+
+    ret = out.ret;
+    margo_free_output(r->handle, &out);
+    return ret;
+}
+
+symbiomon_return_t symbiomon_remote_metric_ifetch_histogram(symbiomon_metric_handle_t handle, symbiomon_histogram *hist, symbiomon_request_t *req)
+{
+    metric_fetch_histogram_in_t in;
+    hg_return_t hret;
+
+    symbiomon_request* r = (symbiomon_request*)calloc(1, sizeof(*r));
+    if(!r)
+        return SYMBIOMON_ERR_ALLOCATION;
+    r->bulk     = HG_BULK_NULL;
+    r->complete = complete_histogram;
+
+    /* the provider pushes the buckets straight into the caller's histogram */
+    void* ptr = hist;
+    hg_size_t size = sizeof(*hist);
+    hret = margo_bulk_create(handle->client->mid, 1, &ptr, &size, HG_BULK_WRITE_ONLY, &r->bulk);
+    if(hret != HG_SUCCESS) {
+        free(r);
+        return SYMBIOMON_ERR_FROM_MERCURY;
+    }
+
+    in.metric_id = handle->metric_id;
+    in.bulk = r->bulk;
+
+    hret = margo_create(handle->client->mid, handle->addr, handle->client->metric_fetch_histogram_id, &r->handle);
+    if(hret != HG_SUCCESS) {
+        margo_bulk_free(r->bulk);
+        free(r);
+        return SYMBIOMON_ERR_FROM_MERCURY;
+    }
+
+    hret = margo_provider_iforward(handle->provider_id, r->handle, &in, &r->req);
+    if(hret != HG_SUCCESS)
+        return finish_request(r, hret);
+
+    *req = r;
+    return SYMBIOMON_SUCCESS;
+}
+
+symbiomon_return_t symbiomon_remote_metric_fetch_histogram(symbiomon_metric_handle_t handle, symbiomon_histogram *hist)
+{
+    symbiomon_request_t req;
+    symbiomon_return_t ret = symbiomon_remote_metric_ifetch_histogram(handle, hist, &req);
+    if(ret != SYMBIOMON_SUCCESS)
+        return ret;
+    return symbiomon_request_wait(req);
+}
+
+static symbiomon_return_t complete_aggregate(symbiomon_request* r)
+{
+    metric_aggregate_out_t out;
+    symbiomon_return_t ret;
+
+    if(margo_get_output(r->handle, &out) != HG_SUCCESS)
+        return SYMBIOMON_ERR_FROM_MERCURY;
+
+    ret = out.ret;
+    if(ret == SYMBIOMON_SUCCESS)
+        *r->aggregate = out.aggregate;
+
+    margo_free_output(r->handle, &out);
+    return ret;
+}
+
+symbiomon_return_t symbiomon_remote_metric_iaggregate(symbiomon_metric_handle_t handle, double t0, double t1, symbiomon_metric_aggregate *aggregate, symbiomon_request_t *req)
+{
+    metric_aggregate_in_t in;
+    hg_return_t hret;
+
+    symbiomon_request* r = (symbiomon_request*)calloc(1, sizeof(*r));
+    if(!r)
+        return SYMBIOMON_ERR_ALLOCATION;
+    r->bulk      = HG_BULK_NULL;
+    r->complete  = complete_aggregate;
+    r->aggregate = aggregate;
+
+    in.metric_id = handle->metric_id;
+    in.t0 = t0;
+    in.t1 = t1;
+
+    hret = margo_create(handle->client->mid, handle->addr, handle->client->metric_aggregate_id, &r->handle);
+    if(hret != HG_SUCCESS) {
+        free(r);
+        return SYMBIOMON_ERR_FROM_MERCURY;
+    }
+
+    hret = margo_provider_iforward(handle->provider_id, r->handle, &in, &r->req);
+    if(hret != HG_SUCCESS)
+        return finish_request(r, hret);
+
+    *req = r;
+    return SYMBIOMON_SUCCESS;
+}
+
+symbiomon_return_t symbiomon_remote_metric_aggregate(symbiomon_metric_handle_t handle, double t0, double t1, symbiomon_metric_aggregate *aggregate)
+{
+    symbiomon_request_t req;
+    symbiomon_return_t ret = symbiomon_remote_metric_iaggregate(handle, t0, t1, aggregate, &req);
+    if(ret != SYMBIOMON_SUCCESS)
+        return ret;
+    return symbiomon_request_wait(req);
+}
+
+static symbiomon_return_t fetch_since(symbiomon_metric_handle_t handle, metric_fetch_since_in_t* in,
+        metric_fetch_since_out_t* result, symbiomon_metric_buffer *buf)
+{
+    hg_handle_t h;
+    metric_fetch_since_out_t out;
+    hg_bulk_t local_bulk;
+    hg_return_t hret;
+
+    in->metric_id = handle->metric_id;
+    if(in->count < 0)
+        in->count = METRIC_BUFFER_SIZE;
+
+    symbiomon_metric_buffer b = (symbiomon_metric_buffer)calloc(in->count ? in->count : 1, sizeof(symbiomon_metric_sample));
+    if(!b)
+        return SYMBIOMON_ERR_ALLOCATION;
+    void* ptr = b;
+    hg_size_t size = (in->count ? in->count : 1)*sizeof(symbiomon_metric_sample);
+
+    hret = margo_bulk_create(handle->client->mid, 1, &ptr, &size, HG_BULK_WRITE_ONLY, &local_bulk);
+    if(hret != HG_SUCCESS) {
+        free(b);
+        return SYMBIOMON_ERR_FROM_MERCURY;
+    }
+    in->bulk = local_bulk;
+
+    hret = margo_create(handle->client->mid, handle->addr, handle->client->metric_fetch_since_id, &h);
+    if(hret != HG_SUCCESS) {
+        margo_bulk_free(local_bulk);
+        free(b);
+        return SYMBIOMON_ERR_FROM_MERCURY;
+    }
+
+    hret = margo_provider_forward(handle->provider_id, h, in);
+    if(hret == HG_SUCCESS)
+        hret = margo_get_output(h, &out);
+    margo_bulk_free(local_bulk);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        free(b);
+        return SYMBIOMON_ERR_FROM_MERCURY;
+    }
+
+    *result = out;
+    margo_free_output(h, &out);
+    margo_destroy(h);
+    if(result->ret != SYMBIOMON_SUCCESS) {
+        free(b);
+        return result->ret;
+    }
+
+    /* samples overwritten while the provider was pushing them */
+    if(result->skipped)
+        memmove(b, b + result->skipped, result->actual_count*sizeof(*b));
+    *buf = b;
+    return SYMBIOMON_SUCCESS;
+}
+
+symbiomon_return_t symbiomon_remote_metric_fetch_since(symbiomon_metric_handle_t handle, uint64_t *cursor, int64_t *num_samples_requested, symbiomon_metric_buffer *buf, uint64_t *dropped)
+{
+    metric_fetch_since_in_t in;
+    metric_fetch_since_out_t out;
+    symbiomon_return_t ret;
+
+    in.count = *num_samples_requested;
+    in.by_time = 0;
+    in.cursor = *cursor;
+    in.since = 0.0;
+
+    ret = fetch_since(handle, &in, &out, buf);
+    if(ret != SYMBIOMON_SUCCESS)
+        return ret;
+
+    *num_samples_requested = out.actual_count;
+    *cursor = out.next_cursor;
+    if(dropped) *dropped = out.dropped;
+    return SYMBIOMON_SUCCESS;
+}
+
+symbiomon_return_t symbiomon_remote_metric_fetch_since_time(symbiomon_metric_handle_t handle, symbiomon_time_cursor *cursor, int64_t *num_samples_requested, symbiomon_metric_buffer *buf)
+{
+    metric_fetch_since_in_t in;
+    metric_fetch_since_out_t out;
+    symbiomon_return_t ret;
+
+    /* in time mode the sequence cursor carries the samples seen at since */
+    in.count = *num_samples_requested;
+    in.by_time = 1;
+    in.cursor = cursor->seen;
+    in.since = cursor->time;
+
+    ret = fetch_since(handle, &in, &out, buf);
+    if(ret != SYMBIOMON_SUCCESS)
+        return ret;
+
+    *num_samples_requested = out.actual_count;
+    cursor->time = out.next_since;
+    cursor->seen = out.next_cursor;
+    return SYMBIOMON_SUCCESS;
+}
+
+symbiomon_return_t symbiomon_remote_metrics_fetch_multi(symbiomon_client_t client, hg_addr_t addr, uint16_t provider_id, size_t num_metrics, const symbiomon_metric_id_t *ids, const int64_t *counts, symbiomon_metric_fetch_result *results, symbiomon_metric_buffer *buf)
+{
+    hg_handle_t h;
+    metrics_fetch_multi_in_t in;
+    metrics_fetch_multi_out_t out;
+    hg_bulk_t local_bulk = HG_BULK_NULL;
+    metric_fetch_index* index = NULL;
+    symbiomon_metric_buffer b = NULL;
+    symbiomon_return_t ret;
+    hg_return_t hret;
+    size_t i, total = 0;
+
+    if(client == SYMBIOMON_CLIENT_NULL || (num_metrics && (!ids || !counts || !results)))
+        return SYMBIOMON_ERR_INVALID_ARGS;
+
+    in.num_metrics = num_metrics;
+    in.ids = (symbiomon_metric_id_t*)ids;
+    in.counts = (int64_t*)malloc((num_metrics ? num_metrics : 1)*sizeof(int64_t));
+    index = (metric_fetch_index*)calloc(num_metrics ? num_metrics : 1, sizeof(*index));
+    if(!in.counts || !index) {
+        ret = SYMBIOMON_ERR_ALLOCATION;
+        goto finish;
+    }
+    for(i = 0; i < num_metrics; i++) {
+        in.counts[i] = counts[i] < 0 ? METRIC_BUFFER_SIZE : counts[i];
+        total += in.counts[i];
+    }
+    b = (symbiomon_metric_buffer)malloc((total ? total : 1)*sizeof(*b));
+    if(!b) {
+        ret = SYMBIOMON_ERR_ALLOCATION;
+        goto finish;
+    }
+
+    /* one bulk for the index followed by the packed samples */
+    void* segment_ptrs[2] = { index, b };
+    hg_size_t segment_sizes[2] = {
+        (num_metrics ? num_metrics : 1)*sizeof(*index),
+        (total ? total : 1)*sizeof(*b)
+    };
+    hret = margo_bulk_create(client->mid, 2, segment_ptrs, segment_sizes, HG_BULK_WRITE_ONLY, &local_bulk);
+    if(hret != HG_SUCCESS) {
+        ret = SYMBIOMON_ERR_FROM_MERCURY;
+        goto finish;
+    }
+    in.bulk = local_bulk;
+
+    hret = margo_create(client->mid, addr, client->metrics_fetch_multi_id, &h);
+    if(hret != HG_SUCCESS) {
+        ret = SYMBIOMON_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    hret = margo_provider_forward(provider_id, h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        ret = SYMBIOMON_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    hret = margo_get_output(h, &out);
+    if(hret != HG_SUCCESS) {
+        margo_destroy(h);
+        ret = SYMBIOMON_ERR_FROM_MERCURY;
+        goto finish;
+    }
+    ret = out.ret;
+    margo_free_output(h, &out);
+    margo_destroy(h);
+    if(ret != SYMBIOMON_SUCCESS)
+        goto finish;
+
+    /* the index is not trusted to stay within the buffer */
+    for(i = 0; i < num_metrics; i++) {
+        uint64_t offset = index[i].offset, skipped = (uint64_t)index[i].skipped;
+        results[i].ret = (symbiomon_return_t)index[i].ret;
+        results[i].count = index[i].count;
+        results[i].samples = b;
+        if(offset > total || skipped > total - offset
+        || (uint64_t)index[i].count > total - offset - skipped) {
+            if(results[i].ret == SYMBIOMON_SUCCESS)
+                results[i].ret = SYMBIOMON_ERR_INVALID_ARGS;
+            results[i].count = 0;
+            continue;
+        }
+        results[i].samples = b + offset + skipped;
+    }
+    *buf = b;
+    b = NULL;
+
+finish:
+    if(local_bulk != HG_BULK_NULL)
+        margo_bulk_free(local_bulk);
+    free(in.counts);
+    free(index);
+    free(b);
+    return ret;
+}
+
+symbiomon_return_t symbiomon_remote_metric_handle_create(
+        symbiomon_client_t client,
+        hg_addr_t addr,
+        uint16_t provider_id,
+        symbiomon_metric_id_t metric_id,
+        symbiomon_metric_handle_t* handle)
+{
+    if(client == SYMBIOMON_CLIENT_NULL)
+        return SYMBIOMON_ERR_INVALID_ARGS;
+
+    symbiomon_metric_handle_t rh =
+        (symbiomon_metric_handle_t)calloc(1, sizeof(*rh));
+
+    if(!rh) return SYMBIOMON_ERR_ALLOCATION;
+
+    hg_return_t ret = margo_addr_dup(client->mid, addr, &(rh->addr));
+    if(ret != HG_SUCCESS) {
+        free(rh);
+        return SYMBIOMON_ERR_FROM_MERCURY;
+    }
+
+    rh->client      = client;
+    rh->provider_id = provider_id;
+    rh->metric_id   = metric_id;
+    rh->refcount    = 1;
+
+    client->num_metric_handles += 1;
+
+    *handle = rh;
+    return SYMBIOMON_SUCCESS;
+}
+
+symbiomon_return_t symbiomon_remote_metric_handle_ref_incr(
+        symbiomon_metric_handle_t handle)
+{
+    if(handle == SYMBIOMON_METRIC_HANDLE_NULL)
+        return SYMBIOMON_ERR_INVALID_ARGS;
+    handle->refcount += 1;
+    return SYMBIOMON_SUCCESS;
+}
+
+symbiomon_return_t symbiomon_remote_metric_handle_release(symbiomon_metric_handle_t handle)
+{
+    if(handle == SYMBIOMON_METRIC_HANDLE_NULL)
+        return SYMBIOMON_ERR_INVALID_ARGS;
+    handle->refcount -= 1;
+    if(handle->refcount == 0) {
+        if(handle->pull_bulk != HG_BULK_NULL)
+            margo_bulk_free(handle->pull_bulk);
+        if(handle->pull_count_bulk != HG_BULK_NULL)
+            margo_bulk_free(handle->pull_count_bulk);
+        margo_addr_free(handle->client->mid, handle->addr);
+        handle->client->num_metric_handles -= 1;
+        free(handle);
+    }
+    return SYMBIOMON_SUCCESS;
+}
+
+static symbiomon_return_t complete_list(symbiomon_request* r)
+{
+    list_metrics_out_t out;
+    symbiomon_return_t ret;
+
+    if(margo_get_output(r->handle, &out) != HG_SUCCESS)
+        return SYMBIOMON_ERR_FROM_MERCURY;
+
+    ret = out.ret;
+    if(ret == SYMBIOMON_SUCCESS) {
+        *r->count = out.count;
+        memcpy(*r->ids, out.ids, out.count*sizeof(symbiomon_metric_id_t));
+    }
+
+    margo_free_output(r->handle, &out);
+    return ret;
+}
+
+symbiomon_return_t symbiomon_remote_list_metrics_ilist(symbiomon_client_t client, hg_addr_t addr, uint16_t provider_id, symbiomon_metric_id_t** ids, size_t* count, symbiomon_request_t* req)
+{
+    list_metrics_in_t in;
+    hg_return_t hret;
+
+    symbiomon_request* r = (symbiomon_request*)calloc(1, sizeof(*r));
+    if(!r)
+        return SYMBIOMON_ERR_ALLOCATION;
+    r->bulk     = HG_BULK_NULL;
+    r->complete = complete_list;
+    r->ids      = ids;
+    r->count    = count;
+
+    in.max_ids = *count;
+
+    hret = margo_create(client->mid, addr, client->list_metrics_id, &r->handle);
+    if(hret != HG_SUCCESS) {
+        free(r);
+        return SYMBIOMON_ERR_FROM_MERCURY;
+    }
+
+    hret = margo_provider_iforward(provider_id, r->handle, &in, &r->req);
+    if(hret != HG_SUCCESS)
+        return finish_request(r, hret);
+
+    *req = r;
+    return SYMBIOMON_SUCCESS;
+}
+
+symbiomon_return_t symbiomon_remote_list_metrics(symbiomon_client_t client, hg_addr_t addr, uint16_t provider_id, symbiomon_metric_id_t** ids, size_t* count)
+{
+    symbiomon_request_t req;
+    symbiomon_return_t ret = symbiomon_remote_list_metrics_ilist(client, addr, provider_id, ids, count, &req);
+    if(ret != SYMBIOMON_SUCCESS)
+        return ret;
+    return symbiomon_request_wait(req);
+}
+
+symbiomon_return_t symbiomon_request_wait(symbiomon_request_t req)
+{
+    hg_return_t hret = HG_SUCCESS;
+    if(req->handle != HG_HANDLE_NULL)
+        hret = margo_wait(req->req);
+    return finish_request(req, hret);
+}
+
+symbiomon_return_t symbiomon_request_test(symbiomon_request_t req, int* flag)
+{
+    *flag = 1;
+    if(req->handle != HG_HANDLE_NULL && margo_test(req->req, flag) != HG_SUCCESS)
+        return SYMBIOMON_ERR_FROM_MERCURY;
+    return SYMBIOMON_SUCCESS;
+}
+
+symbiomon_return_t symbiomon_request_wait_any(size_t count, symbiomon_request_t* reqs, size_t* index)
+{
+    size_t i;
+    hg_return_t hret;
+    symbiomon_request_t r;
+    margo_request* mreqs;
+
+    /* requests that completed locally need no waiting */
+    for(i = 0; i < count; i++) {
+        if(reqs[i] && reqs[i]->handle == HG_HANDLE_NULL)
+            break;
+    }
+    if(i < count) {
+        r = reqs[i];
+        reqs[i] = NULL;
+        *index = i;
+        return finish_request(r, HG_SUCCESS);
+    }
+
+    *index = count;
+    mreqs = (margo_request*)malloc((count ? count : 1)*sizeof(*mreqs));
+    if(!mreqs)
+        return SYMBIOMON_ERR_ALLOCATION;
+    for(i = 0; i < count; i++)
+        mreqs[i] = reqs[i] ? reqs[i]->req : MARGO_REQUEST_NULL;
+    i = count;
+    hret = margo_wait_any(count, mreqs, &i);
+    free(mreqs);
+    if(hret != HG_SUCCESS)
+        return SYMBIOMON_ERR_FROM_MERCURY;
+    if(i >= count || !reqs[i])
+        return SYMBIOMON_ERR_INVALID_ARGS;
+
+    r = reqs[i];
+    reqs[i] = NULL;
+    *index = i;
+    return finish_request(r, hret);
+}
+
+/* starts the query of one target of a fan-out */
+typedef symbiomon_return_t (*fanout_start_fn)(symbiomon_metric_handle_t handle, size_t i, void* uarg, symbiomon_request_t* req);
+
+static int compare_doubles(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Queries the metric on every target, keeping at most max_inflight
+ * requests in flight, and fills in the ret and latency of each result.
+ * Targets answering more than straggler_factor times slower than the
+ * median are then flagged as stragglers.
+ */
+static symbiomon_return_t fanout(symbiomon_client_t client, size_t num_targets, const symbiomon_target* targets,
+        symbiomon_metric_id_t metric_id, const struct symbiomon_fanout_args* args,
+        symbiomon_fanout_result* results, fanout_start_fn start, void* uarg)
+{
+    struct symbiomon_fanout_args a = SYMBIOMON_FANOUT_ARGS_INIT;
+    size_t i, slot, next = 0, inflight = 0, num_ok = 0;
+    symbiomon_return_t ret;
+    if(args) a = *args;
+    memset(results, 0, num_targets*sizeof(*results));
+    if(num_targets == 0) return SYMBIOMON_SUCCESS;
+    if(a.max_inflight == 0) a.max_inflight = 1;
+    if(a.max_inflight > num_targets) a.max_inflight = num_targets;
+
+    symbiomon_request_t*       reqs    = (symbiomon_request_t*)calloc(a.max_inflight, sizeof(*reqs));
+    size_t*                    owner   = (size_t*)calloc(a.max_inflight, sizeof(*owner));
+    symbiomon_metric_handle_t* handles = (symbiomon_metric_handle_t*)calloc(a.max_inflight, sizeof(*handles));
+    double*                    start_t = (double*)calloc(a.max_inflight, sizeof(*start_t));
+    double*                    lat     = (double*)calloc(num_targets, sizeof(*lat));
+    if(!reqs || !owner || !handles || !start_t || !lat) {
+        ret = SYMBIOMON_ERR_ALLOCATION;
+        goto finish;
+    }
+
+    while(next < num_targets || inflight) {
+        /* refill the window */
+        for(slot = 0; slot < a.max_inflight && next < num_targets; slot++) {
+            if(reqs[slot]) continue;
+            i = next++;
+            start_t[slot] = ABT_get_wtime();
+            ret = symbiomon_remote_metric_handle_create(client, targets[i].addr, targets[i].provider_id, metric_id, &handles[slot]);
+            if(ret == SYMBIOMON_SUCCESS) {
+                ret = start(handles[slot], i, uarg, &reqs[slot]);
+                if(ret != SYMBIOMON_SUCCESS)
+                    symbiomon_remote_metric_handle_release(handles[slot]);
+            }
+            if(ret != SYMBIOMON_SUCCESS) {
+                results[i].ret = ret;
+                results[i].latency = ABT_get_wtime() - start_t[slot];
+                continue;
+            }
+            owner[slot] = i;
+            inflight++;
+        }
+        if(!inflight) continue;
+
+        ret = symbiomon_request_wait_any(a.max_inflight, reqs, &slot);
+        if(slot >= a.max_inflight) {
+            /* the wait failed, the requests still in flight are
+             * waited for one by one and the fan-out stops there */
+            for(i = next; i < num_targets; i++)
+                results[i].ret = ret;
+            for(slot = 0; slot < a.max_inflight; slot++) {
+                if(!reqs[slot]) continue;
+                i = owner[slot];
+                results[i].ret = symbiomon_request_wait(reqs[slot]);
+                results[i].latency = ABT_get_wtime() - start_t[slot];
+                symbiomon_remote_metric_handle_release(handles[slot]);
+            }
+            goto finish;
+        }
+        i = owner[slot];
+        results[i].ret = ret;
+        results[i].latency = ABT_get_wtime() - start_t[slot];
+        symbiomon_remote_metric_handle_release(handles[slot]);
+        inflight--;
+        if(ret == SYMBIOMON_SUCCESS)
+            lat[num_ok++] = results[i].latency;
+    }
+
+    if(num_ok && a.straggler_factor > 0.0) {
+        qsort(lat, num_ok, sizeof(*lat), compare_doubles);
+        double median = lat[num_ok/2];
+        for(i = 0; i < num_targets; i++)
+            results[i].straggler = results[i].latency > a.straggler_factor*median;
+    }
+    ret = SYMBIOMON_SUCCESS;
+
+finish:
+    free(reqs);
+    free(owner);
+    free(handles);
+    free(start_t);
+    free(lat);
+    return ret;
+}
+
+struct fanout_fetch {
+    int64_t count;
+    int64_t* counts;
+    symbiomon_metric_buffer* bufs;
+};
+
+static symbiomon_return_t start_fetch(symbiomon_metric_handle_t handle, size_t i, void* uarg, symbiomon_request_t* req)
+{
+    struct fanout_fetch* f = (struct fanout_fetch*)uarg;
+    f->counts[i] = f->count;
+    return symbiomon_remote_metric_ifetch(handle, &f->counts[i], &f->bufs[i], req);
+}
+
+static int compare_fanout_samples(const void* a, const void* b)
+{
+    const symbiomon_fanout_sample* x = (const symbiomon_fanout_sample*)a;
+    const symbiomon_fanout_sample* y = (const symbiomon_fanout_sample*)b;
+    if(x->time != y->time) return x->time < y->time ? -1 : 1;
+    if(x->target != y->target) return x->target < y->target ? -1 : 1;
+    return x->sample_id < y->sample_id ? -1 : x->sample_id > y->sample_id;
+}
+
+symbiomon_return_t symbiomon_remote_fanout_fetch(symbiomon_client_t client, size_t num_targets, const symbiomon_target* targets, symbiomon_metric_id_t metric_id, int64_t num_samples_requested, const struct symbiomon_fanout_args* args, symbiomon_fanout_result* results, symbiomon_fanout_sample** table, size_t* table_size)
+{
+    struct fanout_fetch f;
+    symbiomon_fanout_sample* t = NULL;
+    symbiomon_return_t ret;
+    size_t i, n = 0;
+    int64_t j;
+
+    f.count  = num_samples_requested;
+    f.counts = (int64_t*)calloc(num_targets ? num_targets : 1, sizeof(*f.counts));
+    f.bufs   = (symbiomon_metric_buffer*)calloc(num_targets ? num_targets : 1, sizeof(*f.bufs));
+    if(!f.counts || !f.bufs) {
+        ret = SYMBIOMON_ERR_ALLOCATION;
+        goto finish;
+    }
+
+    ret = fanout(client, num_targets, targets, metric_id, args, results, start_fetch, &f);
+    if(ret != SYMBIOMON_SUCCESS)
+        goto finish;
+
+    /* one table of the samples of every target, ordered by time */
+    for(i = 0; i < num_targets; i++) {
+        if(results[i].ret == SYMBIOMON_SUCCESS)
+            results[i].count = f.counts[i];
+        n += results[i].count;
+    }
+    t = (symbiomon_fanout_sample*)malloc((n ? n : 1)*sizeof(*t));
+    if(!t) {
+        ret = SYMBIOMON_ERR_ALLOCATION;
+        goto finish;
+    }
+    n = 0;
+    for(i = 0; i < num_targets; i++) {
+        for(j = 0; j < results[i].count; j++, n++) {
+            t[n].time      = f.bufs[i][j].time;
+            t[n].val       = f.bufs[i][j].val;
+            t[n].sample_id = f.bufs[i][j].sample_id;
+            t[n].target    = i;
+        }
+    }
+    qsort(t, n, sizeof(*t), compare_fanout_samples);
+    *table = t;
+    *table_size = n;
+
+finish:
+    if(f.bufs) {
+        for(i = 0; i < num_targets; i++)
+            if(results[i].ret == SYMBIOMON_SUCCESS)
+                free(f.bufs[i]);
+    }
+    free(f.bufs);
+    free(f.counts);
+    return ret;
+}
+
+struct fanout_aggregate {
+    double t0;
+    double t1;
+    symbiomon_fanout_result* results;
+};
+
+static symbiomon_return_t start_aggregate(symbiomon_metric_handle_t handle, size_t i, void* uarg, symbiomon_request_t* req)
+{
+    struct fanout_aggregate* f = (struct fanout_aggregate*)uarg;
+    return symbiomon_remote_metric_iaggregate(handle, f->t0, f->t1, &f->results[i].aggregate, req);
+}
+
+symbiomon_return_t symbiomon_remote_fanout_aggregate(symbiomon_client_t client, size_t num_targets, const symbiomon_target* targets, symbiomon_metric_id_t metric_id, double t0, double t1, const struct symbiomon_fanout_args* args, symbiomon_fanout_result* results, symbiomon_metric_aggregate* global)
+{
+    struct fanout_aggregate f = { t0, t1, results };
+    symbiomon_summary total, s;
+    symbiomon_return_t ret;
+    size_t i;
+
+    ret = fanout(client, num_targets, targets, metric_id, args, results, start_aggregate, &f);
+    if(ret != SYMBIOMON_SUCCESS)
+        return ret;
+
+    /* moments merge exactly, percentiles do not */
+    symbiomon_summary_init(&total);
+    for(i = 0; i < num_targets; i++) {
+        const symbiomon_metric_stats* st = &results[i].aggregate.stats;
+        if(results[i].ret != SYMBIOMON_SUCCESS || st->count == 0)
+            continue;
+        results[i].count = st->count;
+        s.count = st->count;
+        s.sum   = st->sum;
+        s.min   = st->min;
+        s.max   = st->max;
+        s.mean  = st->mean;
+        s.m2    = st->variance*(double)st->count;
+        symbiomon_summary_merge(&total, &s);
+    }
+    memset(global, 0, sizeof(*global));
+    global->stats.count    = total.count;
+    global->stats.sum      = total.sum;
+    global->stats.min      = total.count ? total.min : 0.0;
+    global->stats.max      = total.count ? total.max : 0.0;
+    global->stats.mean     = total.mean;
+    global->stats.variance = symbiomon_summary_variance(&total);
+    global->p50 = global->p90 = global->p99 = NAN;
+    return SYMBIOMON_SUCCESS;
+}
+
+static symbiomon_return_t start_histogram(symbiomon_metric_handle_t handle, size_t i, void* uarg, symbiomon_request_t* req)
+{
+    symbiomon_histogram* hists = (symbiomon_histogram*)uarg;
+    return symbiomon_remote_metric_ifetch_histogram(handle, &hists[i], req);
+}
+
+symbiomon_return_t symbiomon_remote_fanout_histogram(symbiomon_client_t client, size_t num_targets, const symbiomon_target* targets, symbiomon_metric_id_t metric_id, const struct symbiomon_fanout_args* args, symbiomon_fanout_result* results, symbiomon_histogram* global)
+{
+    symbiomon_return_t ret;
+    size_t i;
+
+    symbiomon_histogram* hists = (symbiomon_histogram*)calloc(num_targets ? num_targets : 1, sizeof(*hists));
+    if(!hists)
+        return SYMBIOMON_ERR_ALLOCATION;
+
+    ret = fanout(client, num_targets, targets, metric_id, args, results, start_histogram, hists);
+    if(ret == SYMBIOMON_SUCCESS) {
+        /* unlike percentiles, buckets add up exactly */
+        memset(global, 0, sizeof(*global));
+        for(i = 0; i < num_targets; i++) {
+            if(results[i].ret != SYMBIOMON_SUCCESS)
+                continue;
+            results[i].count = hists[i].count;
+            symbiomon_histogram_merge(global, &hists[i]);
+        }
+    }
+    free(hists);
+    return ret;
+}
+
+symbiomon_return_t symbiomon_remote_subscribe(symbiomon_client_t client, hg_addr_t addr, uint16_t provider_id, const struct symbiomon_subscription_args* args, symbiomon_subscription_fn fn, void* uarg, symbiomon_subscription_t* subscription)
+{
+    hg_handle_t h;
+    subscribe_in_t  in;
+    subscribe_out_t out;
+    symbiomon_subscription *sub, **p;
+    symbiomon_return_t ret;
+    hg_return_t hret;
+
+    if(!args || !fn)
+        return SYMBIOMON_ERR_INVALID_ARGS;
+
+    sub = (symbiomon_subscription*)calloc(1, sizeof(*sub));
+    if(!sub)
+        return SYMBIOMON_ERR_ALLOCATION;
+    hret = margo_addr_dup(client->mid, addr, &sub->addr);
+    if(hret != HG_SUCCESS) {
+        free(sub);
+        return SYMBIOMON_ERR_FROM_MERCURY;
+    }
+    sub->client      = client;
+    sub->provider_id = provider_id;
+    sub->fn          = fn;
+    sub->uarg        = uarg;
+
+    /* notifications may arrive before the response */
+    ABT_mutex_lock(client->subscriptions_mutex);
+    sub->token = ++client->next_token;
+    sub->next = client->subscriptions;
+    client->subscriptions = sub;
+    ABT_mutex_unlock(client->subscriptions_mutex);
+
+    in.token      = sub->token;
+    in.callback_provider_id = client->notify_provider_id;
+    in.filter     = args->filter;
+    in.metric_id  = args->metric_id;
+    in.pattern    = args->pattern ? args->pattern : "";
+    in.interval   = args->interval;
+    in.batch_size = args->batch_size;
+
+    ret = SYMBIOMON_ERR_FROM_MERCURY;
+    hret = margo_create(client->mid, addr, client->subscribe_id, &h);
+    if(hret == HG_SUCCESS) {
+        hret = margo_provider_forward(provider_id, h, &in);
+        if(hret == HG_SUCCESS)
+            hret = margo_get_output(h, &out);
+        if(hret == HG_SUCCESS) {
+            ret = out.ret;
+            sub->id = out.id;
+            margo_free_output(h, &out);
+        }
+        margo_destroy(h);
+    }
+
+    if(ret != SYMBIOMON_SUCCESS) {
+        ABT_mutex_lock(client->subscriptions_mutex);
+        for(p = &client->subscriptions; *p != sub; p = &(*p)->next);
+        *p = sub->next;
+        ABT_mutex_unlock(client->subscriptions_mutex);
+        margo_addr_free(client->mid, sub->addr);
+        free(sub);
+        return ret;
+    }
+    *subscription = sub;
+    return SYMBIOMON_SUCCESS;
+}
+
+symbiomon_return_t symbiomon_remote_unsubscribe(symbiomon_subscription_t sub)
+{
+    hg_handle_t h;
+    unsubscribe_in_t  in;
+    unsubscribe_out_t out;
+    symbiomon_client_t client = sub->client;
+    symbiomon_subscription **p;
+    symbiomon_return_t ret;
+    hg_return_t hret;
+
+    in.id = sub->id;
+
+    ret = SYMBIOMON_ERR_FROM_MERCURY;
+    hret = margo_create(client->mid, sub->addr, client->unsubscribe_id, &h);
+    if(hret == HG_SUCCESS) {
+        hret = margo_provider_forward(sub->provider_id, h, &in);
+        if(hret == HG_SUCCESS)
+            hret = margo_get_output(h, &out);
+        if(hret == HG_SUCCESS) {
+            ret = out.ret;
+            margo_free_output(h, &out);
+        }
+        margo_destroy(h);
+    }
+
+    /* the subscription goes away even if the provider could not be
+     * reached: its notifications are refused from now on */
+    ABT_mutex_lock(client->subscriptions_mutex);
+    for(p = &client->subscriptions; *p != sub; p = &(*p)->next);
+    *p = sub->next;
+    ABT_mutex_unlock(client->subscriptions_mutex);
+    margo_addr_free(client->mid, sub->addr);
+    free(sub);
+    return ret;
+}
+
+static void symbiomon_subscription_notify_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    notify_in_t  in;
+    notify_out_t out;
+    symbiomon_subscription* sub;
+    size_t i, j;
+
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+    const struct hg_info* info = margo_get_info(h);
+    symbiomon_client_t client = (symbiomon_client_t)margo_registered_data(mid, info->id);
+
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+        margo_respond(h, &out);
+        margo_destroy(h);
+        return;
+    }
+
+    /* the lock keeps the subscription alive while its callback runs */
+    ABT_mutex_lock(client->subscriptions_mutex);
+    for(sub = client->subscriptions; sub && sub->token != in.token; sub = sub->next);
+    if(sub) {
+        for(i = 0; i < in.count; i = j) {
+            for(j = i + 1; j < in.count && in.ids[j] == in.ids[i]; j++);
+            sub->fn(sub->uarg, in.ids[i], in.samples + i, j - i);
+        }
+        out.ret = SYMBIOMON_SUCCESS;
+    } else {
+        out.ret = SYMBIOMON_ERR_INVALID_TOKEN;
+    }
+    ABT_mutex_unlock(client->subscriptions_mutex);
+
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(symbiomon_subscription_notify_ult)
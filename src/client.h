@@ -10,19 +10,72 @@
 #include "symbiomon/symbiomon-client.h"
 #include "symbiomon/symbiomon-metric.h"
 
+typedef struct symbiomon_subscription symbiomon_subscription;
+
 typedef struct symbiomon_client {
    margo_instance_id mid;
    hg_id_t           metric_fetch_id;
+   hg_id_t           metric_fetch_encoded_id;
+   hg_id_t           metric_fetch_columns_id;
+   hg_id_t           metric_expose_id;
+   hg_id_t           metric_fetch_since_id;
+   hg_id_t           metrics_fetch_multi_id;
+   hg_id_t           metric_fetch_range_id;
+   hg_id_t           metric_aggregate_id;
+   hg_id_t           metric_fetch_downsampled_id;
+   hg_id_t           metric_fetch_rollup_id;
+   hg_id_t           metric_fetch_histogram_id;
    hg_id_t           list_metrics_id;
+   hg_id_t           subscribe_id;
+   hg_id_t           unsubscribe_id;
+   hg_id_t           notify_id;          /* handles the notifications of this client's subscriptions */
+   uint16_t          notify_provider_id;
+   symbiomon_fetch_encoding_t fetch_encoding; /* requested from providers by fetches */
+   ABT_mutex         subscriptions_mutex;
+   symbiomon_subscription* subscriptions; /* list of active subscriptions */
+   uint64_t          next_token;
    uint64_t          num_metric_handles;
 } symbiomon_client;
 
+/* operation started by one of the i* calls */
+typedef struct symbiomon_request {
+    hg_handle_t        handle;   /* HG_HANDLE_NULL if the operation completed locally */
+    margo_request      req;
+    symbiomon_return_t ret;      /* result of an operation that completed locally */
+    symbiomon_return_t (*complete)(struct symbiomon_request* r); /* reads the response */
+    hg_bulk_t          bulk;
+    symbiomon_metric_buffer  samples;     /* fetch: buffer the provider pushes into */
+    int64_t*                 num_samples;
+    symbiomon_metric_buffer* buf;
+    symbiomon_metric_id_t**  ids;         /* list: caller's output */
+    size_t*                  count;
+    symbiomon_metric_aggregate* aggregate; /* aggregate: caller's output */
+} symbiomon_request;
+
+struct symbiomon_subscription {
+    symbiomon_client_t        client;
+    hg_addr_t                 addr;
+    uint16_t                  provider_id;
+    uint64_t                  id;     /* provider's name for the subscription */
+    uint64_t                  token;  /* our name for it, sent back with each notification */
+    symbiomon_subscription_fn fn;
+    void*                     uarg;
+    struct symbiomon_subscription* next;
+};
+
 typedef struct symbiomon_metric_handle {
     symbiomon_client_t      client;
     hg_addr_t           addr;
     uint16_t            provider_id;
     uint64_t            refcount;
     symbiomon_metric_id_t metric_id;
+    /* one-sided pulls, see symbiomon_remote_metric_enable_pull */
+    hg_bulk_t           pull_bulk;       /* provider's count and ring, or HG_BULK_NULL */
+    uint64_t            pull_capacity;   /* number of samples in the remote ring */
+    uint64_t            pull_chunk_size; /* number of samples per remote chunk */
+    uint64_t            pull_cursor;     /* sequence number of the next sample to pull */
+    uint64_t            pull_count;      /* remote count, as last pulled */
+    hg_bulk_t           pull_count_bulk; /* registration of pull_count */
 } symbiomon_metric_handle;
 
 #endif
@@ -0,0 +1,326 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "compress.h"
+
+typedef struct bit_writer {
+    uint8_t* buf;
+    size_t   cap;    /* bytes */
+    size_t   nbits;
+    int      failed;
+} bit_writer;
+
+typedef struct bit_reader {
+    const uint8_t* buf;
+    size_t         pos;  /* bits */
+    size_t         end;  /* bits */
+    int            overrun;
+} bit_reader;
+
+/* appends the n (at most 64) low bits of v, most significant first */
+static void put_bits(bit_writer* w, uint64_t v, unsigned n)
+{
+    if(w->failed) return;
+    if(((w->nbits + n + 7) >> 3) > w->cap) {
+        size_t cap = 2*w->cap + 16;
+        uint8_t* buf = (uint8_t*)realloc(w->buf, cap);
+        if(!buf) {
+            w->failed = 1;
+            return;
+        }
+        w->buf = buf;
+        w->cap = cap;
+    }
+    while(n) {
+        unsigned used = w->nbits & 7;
+        unsigned room = 8 - used;
+        unsigned take = n < room ? n : room;
+        uint8_t  bits = (uint8_t)((v >> (n - take)) & ((1u << take) - 1));
+        if(!used) w->buf[w->nbits >> 3] = 0;
+        w->buf[w->nbits >> 3] |= (uint8_t)(bits << (room - take));
+        w->nbits += take;
+        n -= take;
+    }
+}
+
+/* reads n (at most 64) bits; past the end, flags the overrun and
+ * returns 0 */
+static uint64_t get_bits(bit_reader* r, unsigned n)
+{
+    uint64_t v = 0;
+    if(n > r->end - r->pos) {
+        r->overrun = 1;
+        r->pos = r->end;
+        return 0;
+    }
+    while(n) {
+        unsigned used = r->pos & 7;
+        unsigned room = 8 - used;
+        unsigned take = n < room ? n : room;
+        uint8_t  byte = r->buf[r->pos >> 3];
+        v = (v << take) | ((byte >> (room - take)) & ((1u << take) - 1));
+        r->pos += take;
+        n -= take;
+    }
+    return v;
+}
+
+static inline uint64_t double_bits(double d)
+{
+    uint64_t b;
+    memcpy(&b, &d, sizeof(b));
+    return b;
+}
+
+static inline double bits_double(uint64_t b)
+{
+    double d;
+    memcpy(&d, &b, sizeof(d));
+    return d;
+}
+
+/*
+ * Per sample after the first:
+ *   time:  '0' if the delta is unchanged, else a zigzagged delta-of-delta
+ *          behind '10' (7 bits), '110' (15 bits), '1110' (31 bits) or
+ *          '1111' (64 bits);
+ *   value: '0' if unchanged, '10' and the meaningful bits if they fit in
+ *          the previous window, else '11', 6 bits of leading zeros,
+ *          6 bits of length - 1 and the meaningful bits;
+ *   id:    '0' if unchanged, else '1' and 64 bits.
+ */
+size_t symbiomon_block_encode(const symbiomon_metric_sample* in, size_t n, uint8_t** out)
+{
+    bit_writer w = { NULL, 0, 0, 0 };
+    uint64_t t, v, id, delta = 0;
+    unsigned lead = 0, trail = 0, window = 0;
+    size_t i;
+
+    t  = double_bits(in[0].time);
+    v  = double_bits(in[0].val);
+    id = in[0].sample_id;
+    put_bits(&w, t, 64);
+    put_bits(&w, v, 64);
+    put_bits(&w, id, 64);
+
+    for(i = 1; i < n; i++) {
+        uint64_t tb  = double_bits(in[i].time);
+        uint64_t d   = tb - t;
+        uint64_t dod = d - delta;
+        uint64_t z   = (dod << 1) ^ (uint64_t)((int64_t)dod >> 63);
+        delta = d;
+        t = tb;
+        if(z == 0) {
+            put_bits(&w, 0, 1);
+        } else if(z < (1ull << 7)) {
+            put_bits(&w, 2, 2);
+            put_bits(&w, z, 7);
+        } else if(z < (1ull << 15)) {
+            put_bits(&w, 6, 3);
+            put_bits(&w, z, 15);
+        } else if(z < (1ull << 31)) {
+            put_bits(&w, 14, 4);
+            put_bits(&w, z, 31);
+        } else {
+            put_bits(&w, 15, 4);
+            put_bits(&w, z, 64);
+        }
+
+        uint64_t vb = double_bits(in[i].val);
+        uint64_t x  = vb ^ v;
+        v = vb;
+        if(!x) {
+            put_bits(&w, 0, 1);
+        } else {
+            unsigned l  = (unsigned)__builtin_clzll(x);
+            unsigned tr = (unsigned)__builtin_ctzll(x);
+            if(window && l >= lead && tr >= trail) {
+                put_bits(&w, 2, 2);
+                put_bits(&w, x >> trail, 64 - lead - trail);
+            } else {
+                lead = l;
+                trail = tr;
+                window = 1;
+                put_bits(&w, 3, 2);
+                put_bits(&w, lead, 6);
+                put_bits(&w, 63 - lead - trail, 6);
+                put_bits(&w, x >> trail, 64 - lead - trail);
+            }
+        }
+
+        if(in[i].sample_id == id) {
+            put_bits(&w, 0, 1);
+        } else {
+            id = in[i].sample_id;
+            put_bits(&w, 1, 1);
+            put_bits(&w, id, 64);
+        }
+    }
+
+    if(w.failed) {
+        free(w.buf);
+        return 0;
+    }
+    *out = w.buf;
+    return (w.nbits + 7) >> 3;
+}
+
+symbiomon_return_t symbiomon_block_decode(const uint8_t* data, size_t size, size_t n, symbiomon_metric_sample* out)
+{
+    bit_reader r = { data, 0, 0, 0 };
+    uint64_t t, v, id, delta = 0;
+    unsigned lead = 0, trail = 0, len;
+    size_t i;
+
+    if(!n)
+        return SYMBIOMON_SUCCESS;
+    if(size > SIZE_MAX/8)
+        return SYMBIOMON_ERR_INVALID_ARGS;
+    r.end = size*8;
+
+    t  = get_bits(&r, 64);
+    v  = get_bits(&r, 64);
+    id = get_bits(&r, 64);
+    out[0].time = bits_double(t);
+    out[0].val  = bits_double(v);
+    out[0].sample_id = id;
+
+    for(i = 1; i < n; i++) {
+        uint64_t z = 0;
+        if(get_bits(&r, 1)) {
+            if(!get_bits(&r, 1))      z = get_bits(&r, 7);
+            else if(!get_bits(&r, 1)) z = get_bits(&r, 15);
+            else if(!get_bits(&r, 1)) z = get_bits(&r, 31);
+            else                      z = get_bits(&r, 64);
+        }
+        delta += (z >> 1) ^ (0 - (z & 1));
+        t += delta;
+
+        if(get_bits(&r, 1)) {
+            if(get_bits(&r, 1)) {
+                lead = (unsigned)get_bits(&r, 6);
+                len  = (unsigned)get_bits(&r, 6) + 1;
+                if(lead + len > 64)
+                    return SYMBIOMON_ERR_INVALID_ARGS;
+                trail = 64 - lead - len;
+            }
+            v ^= get_bits(&r, 64 - lead - trail) << trail;
+        }
+
+        if(get_bits(&r, 1))
+            id = get_bits(&r, 64);
+        if(r.overrun)
+            return SYMBIOMON_ERR_INVALID_ARGS;
+
+        out[i].time = bits_double(t);
+        out[i].val  = bits_double(v);
+        out[i].sample_id = id;
+    }
+    return r.overrun ? SYMBIOMON_ERR_INVALID_ARGS : SYMBIOMON_SUCCESS;
+}
+
+symbiomon_return_t symbiomon_history_init(symbiomon_history* h, uint64_t capacity)
+{
+    memset(h, 0, sizeof(*h));
+    if(capacity == 0)
+        return SYMBIOMON_SUCCESS;
+    h->capacity   = capacity;
+    h->max_blocks = capacity/SYMBIOMON_CHUNK_SIZE + 2;
+    h->blocks  = (symbiomon_block*)calloc(h->max_blocks, sizeof(*h->blocks));
+    h->scratch = (symbiomon_metric_sample*)malloc(SYMBIOMON_CHUNK_SIZE*sizeof(*h->scratch));
+    if(!h->blocks || !h->scratch) {
+        symbiomon_history_finalize(h);
+        return SYMBIOMON_ERR_ALLOCATION;
+    }
+    return SYMBIOMON_SUCCESS;
+}
+
+static void drop_oldest_block(symbiomon_history* h)
+{
+    symbiomon_block* b = &h->blocks[h->head];
+    h->num_samples -= b->count;
+    h->size -= b->size;
+    free(b->data);
+    b->data = NULL;
+    h->head = (h->head + 1) % h->max_blocks;
+    h->num_blocks -= 1;
+}
+
+void symbiomon_history_finalize(symbiomon_history* h)
+{
+    while(h->num_blocks)
+        drop_oldest_block(h);
+    free(h->blocks);
+    free(h->scratch);
+    memset(h, 0, sizeof(*h));
+}
+
+symbiomon_return_t symbiomon_history_seal(symbiomon_history* h, const symbiomon_series* s, uint64_t first, size_t n)
+{
+    symbiomon_block* b;
+    uint8_t* data;
+    size_t i, size;
+
+    if(n == 0 || n > h->capacity)
+        return SYMBIOMON_SUCCESS;
+
+    /* no writer can race with us, so unlike symbiomon_series_copy the
+     * oldest sample of a full ring is not treated as torn */
+    for(i = 0; i < n; i++)
+        symbiomon_series_get(s, first + i, &h->scratch[i]);
+    size = symbiomon_block_encode(h->scratch, n, &data);
+    if(!size)
+        return SYMBIOMON_ERR_ALLOCATION;
+
+    while(h->num_blocks && (h->num_blocks == h->max_blocks || h->num_samples + n > h->capacity))
+        drop_oldest_block(h);
+    b = &h->blocks[(h->head + h->num_blocks) % h->max_blocks];
+    b->first = first;
+    b->count = (uint32_t)n;
+    b->size  = size;
+    b->data  = data;
+    h->num_blocks += 1;
+    h->num_samples += n;
+    h->size += size;
+    return SYMBIOMON_SUCCESS;
+}
+
+size_t symbiomon_history_copy(symbiomon_history* h, uint64_t first, size_t n, symbiomon_metric_sample* out)
+{
+    uint64_t end = first + n;
+    size_t i, copied = 0;
+
+    for(i = 0; i < h->num_blocks; i++) {
+        const symbiomon_block* b = &h->blocks[(h->head + i) % h->max_blocks];
+        uint64_t lo = b->first > first ? b->first : first;
+        uint64_t hi = b->first + b->count < end ? b->first + b->count : end;
+        if(lo >= hi) continue;
+        /* blocks are encoded in place, they cannot be malformed */
+        symbiomon_block_decode(b->data, b->size, b->count, h->scratch);
+        memcpy(out + copied, h->scratch + (lo - b->first), (hi - lo)*sizeof(*out));
+        copied += hi - lo;
+    }
+    return copied;
+}
+
+size_t symbiomon_history_copy_last(symbiomon_history* h, const symbiomon_series* s, size_t n, symbiomon_metric_sample* out)
+{
+    uint64_t end   = s->count;
+    uint64_t first = symbiomon_series_first(s);
+    uint64_t lo    = h->num_blocks && symbiomon_history_first(h) < first ? symbiomon_history_first(h) : first;
+    uint64_t seq;
+    size_t copied = 0;
+
+    if(end - lo > n) lo = end - n;
+    if(lo < first)
+        copied = symbiomon_history_copy(h, lo, first - lo, out);
+    else
+        first = lo;
+    for(seq = first; seq < end; seq++)
+        symbiomon_series_get(s, seq, &out[copied++]);
+    return copied;
+}
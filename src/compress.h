@@ -0,0 +1,87 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _COMPRESS_H
+#define _COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "symbiomon/symbiomon-common.h"
+#include "series.h"
+
+/*
+ * Gorilla-style encoding of a run of samples. Timestamps are stored as
+ * delta-of-deltas of their bit patterns, which keeps the encoding
+ * lossless since the timestamps of a series are positive and never
+ * decrease; values are XORed with the previous one and only their
+ * meaningful bits kept; sample ids cost one bit when they repeat.
+ */
+
+/* Encodes n samples (n > 0) into a buffer allocated with malloc and
+ * returns its size in bytes, or 0 if the allocation failed. */
+size_t symbiomon_block_encode(const symbiomon_metric_sample* in, size_t n, uint8_t** out);
+
+/* Decodes the n samples of a block of size bytes produced by
+ * symbiomon_block_encode. Returns SYMBIOMON_ERR_INVALID_ARGS, leaving
+ * out partly written, if the block is shorter or malformed. */
+symbiomon_return_t symbiomon_block_decode(const uint8_t* data, size_t size, size_t n, symbiomon_metric_sample* out);
+
+typedef struct symbiomon_block {
+    uint64_t first;   /* sequence number of the first sample */
+    uint32_t count;   /* number of samples */
+    size_t   size;    /* bytes of data */
+    uint8_t* data;
+} symbiomon_block;
+
+/*
+ * Compressed samples that left a series' ring, in blocks of at most
+ * SYMBIOMON_CHUNK_SIZE samples. Blocks are sealed as their samples are
+ * about to be overwritten and the oldest are dropped to keep at most
+ * "capacity" samples. Sequence numbers are those of the series.
+ */
+typedef struct symbiomon_history {
+    symbiomon_block* blocks;      /* ring of blocks, oldest at head */
+    size_t   max_blocks;
+    size_t   head;
+    size_t   num_blocks;
+    uint64_t capacity;            /* maximum number of samples retained */
+    uint64_t num_samples;         /* samples currently retained */
+    size_t   size;                /* bytes of compressed data retained */
+    symbiomon_metric_sample* scratch; /* one block of decoded samples */
+} symbiomon_history;
+
+symbiomon_return_t symbiomon_history_init(symbiomon_history* h, uint64_t capacity);
+
+void symbiomon_history_finalize(symbiomon_history* h);
+
+/* Compresses the n samples of s starting at first (n at most
+ * SYMBIOMON_CHUNK_SIZE) into a new block, dropping the oldest blocks
+ * to make room. The caller must hold the lock protecting s. */
+symbiomon_return_t symbiomon_history_seal(symbiomon_history* h, const symbiomon_series* s, uint64_t first, size_t n);
+
+/* Decodes the retained samples of sequence numbers [first, first + n)
+ * into out and returns how many were copied. */
+size_t symbiomon_history_copy(symbiomon_history* h, uint64_t first, size_t n, symbiomon_metric_sample* out);
+
+/* Copies the last n samples of s into out, continuing into h for those
+ * the ring no longer holds, and returns how many were copied. The caller
+ * must hold the lock protecting s. */
+size_t symbiomon_history_copy_last(symbiomon_history* h, const symbiomon_series* s, size_t n, symbiomon_metric_sample* out);
+
+/* sequence number of the oldest sample retained */
+static inline uint64_t symbiomon_history_first(const symbiomon_history* h)
+{
+    return h->num_blocks ? h->blocks[h->head].first : 0;
+}
+
+/* sequence number following the most recent sample retained */
+static inline uint64_t symbiomon_history_end(const symbiomon_history* h)
+{
+    if(!h->num_blocks) return 0;
+    const symbiomon_block* b = &h->blocks[(h->head + h->num_blocks - 1) % h->max_blocks];
+    return b->first + b->count;
+}
+
+#endif
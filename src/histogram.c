@@ -0,0 +1,183 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <math.h>
+#include "symbiomon/symbiomon-metric.h"
+#include "histogram.h"
+
+#define SUB_BUCKETS (1u << SYMBIOMON_HISTOGRAM_SUB_BITS)
+
+void symbiomon_histogram_init(symbiomon_histogram* h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+double symbiomon_histogram_bucket_lower(size_t i)
+{
+    if(i == 0)
+        return 0.0;
+    return ldexp(1.0 + (double)(i % SUB_BUCKETS)/SUB_BUCKETS,
+                 (int)(i / SUB_BUCKETS) + SYMBIOMON_HISTOGRAM_MIN_EXP);
+}
+
+double symbiomon_histogram_bucket_upper(size_t i)
+{
+    if(i >= SYMBIOMON_HISTOGRAM_BUCKETS - 1)
+        return INFINITY;
+    return ldexp(1.0 + (double)(i % SUB_BUCKETS + 1)/SUB_BUCKETS,
+                 (int)(i / SUB_BUCKETS) + SYMBIOMON_HISTOGRAM_MIN_EXP);
+}
+
+void symbiomon_histogram_subtract(symbiomon_histogram* h, const symbiomon_histogram* since)
+{
+    size_t i;
+    for(i = 0; i < SYMBIOMON_HISTOGRAM_BUCKETS; i++)
+        h->buckets[i] -= since->buckets[i];
+    h->count -= since->count;
+    h->sum   -= since->sum;
+}
+
+void symbiomon_histogram_merge(symbiomon_histogram* h, const symbiomon_histogram* other)
+{
+    size_t i;
+    if(!other->count)
+        return;
+    for(i = 0; i < SYMBIOMON_HISTOGRAM_BUCKETS; i++)
+        h->buckets[i] += other->buckets[i];
+    if(!h->count || other->min < h->min) h->min = other->min;
+    if(!h->count || other->max > h->max) h->max = other->max;
+    h->count += other->count;
+    h->sum   += other->sum;
+}
+
+double symbiomon_histogram_quantile(const symbiomon_histogram* h, double q)
+{
+    uint64_t rank, seen = 0;
+    size_t i;
+    double v;
+
+    if(!h->count)
+        return NAN;
+    if(q <= 0.0) return h->min;
+    if(q >= 1.0) return h->max;
+
+    /* nearest rank, answered with the middle of its bucket */
+    rank = (uint64_t)ceil(q*(double)h->count);
+    for(i = 0; i < SYMBIOMON_HISTOGRAM_BUCKETS - 1; i++) {
+        seen += h->buckets[i];
+        if(seen >= rank)
+            break;
+    }
+    if(i == SYMBIOMON_HISTOGRAM_BUCKETS - 1)
+        return h->max;
+    v = 0.5*(symbiomon_histogram_bucket_lower(i) + symbiomon_histogram_bucket_upper(i));
+    if(v < h->min) v = h->min;
+    if(v > h->max) v = h->max;
+    return v;
+}
+
+/*
+ * Sketch layout: count, sum, min and max, the first non-empty bucket and
+ * the number of buckets up to the last non-empty one, then their counts
+ * as LEB128 varints, so that empty buckets in the range cost one byte.
+ */
+typedef struct sketch_header {
+    uint64_t count;
+    double   sum;
+    double   min;
+    double   max;
+    uint32_t first;
+    uint32_t num;
+} sketch_header;
+
+static size_t put_varint(uint8_t* p, uint64_t v)
+{
+    size_t n = 0;
+    while(v >= 0x80) {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+/* returns the number of bytes read, or 0 if the varint overruns end */
+static size_t get_varint(const uint8_t* p, const uint8_t* end, uint64_t* v)
+{
+    size_t n = 0;
+    unsigned shift = 0;
+    *v = 0;
+    while(p + n < end && shift < 64) {
+        uint8_t b = p[n++];
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if(!(b & 0x80))
+            return n;
+        shift += 7;
+    }
+    return 0;
+}
+
+size_t symbiomon_histogram_encode(const symbiomon_histogram* h, void** sketch)
+{
+    sketch_header hdr = { h->count, h->sum, h->min, h->max, 0, 0 };
+    size_t i, size, last = 0;
+    uint8_t* p;
+
+    for(i = 0; i < SYMBIOMON_HISTOGRAM_BUCKETS; i++) {
+        if(!h->buckets[i]) continue;
+        if(!hdr.num) hdr.first = (uint32_t)i;
+        hdr.num = 1;
+        last = i;
+    }
+    if(hdr.num)
+        hdr.num = (uint32_t)(last - hdr.first + 1);
+
+    p = (uint8_t*)malloc(sizeof(hdr) + (size_t)hdr.num*10);
+    if(!p)
+        return 0;
+    memcpy(p, &hdr, sizeof(hdr));
+    size = sizeof(hdr);
+    for(i = 0; i < hdr.num; i++)
+        size += put_varint(p + size, h->buckets[hdr.first + i]);
+    *sketch = p;
+    return size;
+}
+
+symbiomon_return_t symbiomon_histogram_merge_encoded(symbiomon_histogram* h, const void* sketch, size_t size)
+{
+    const uint8_t* p   = (const uint8_t*)sketch;
+    const uint8_t* end = p + size;
+    sketch_header hdr;
+    uint64_t v, total = 0;
+    size_t i, n, pos;
+
+    if(size < sizeof(hdr))
+        return SYMBIOMON_ERR_INVALID_ARGS;
+    memcpy(&hdr, p, sizeof(hdr));
+    if((uint64_t)hdr.first + hdr.num > SYMBIOMON_HISTOGRAM_BUCKETS)
+        return SYMBIOMON_ERR_INVALID_ARGS;
+
+    /* check the whole sketch before touching h */
+    for(i = 0, pos = sizeof(hdr); i < hdr.num; i++, pos += n) {
+        n = get_varint(p + pos, end, &v);
+        if(!n) return SYMBIOMON_ERR_INVALID_ARGS;
+        total += v;
+    }
+    if(pos != size || total != hdr.count)
+        return SYMBIOMON_ERR_INVALID_ARGS;
+    if(!hdr.count)
+        return SYMBIOMON_SUCCESS;
+
+    for(i = 0, pos = sizeof(hdr); i < hdr.num; i++, pos += n) {
+        n = get_varint(p + pos, end, &v);
+        h->buckets[hdr.first + i] += v;
+    }
+    if(!h->count || hdr.min < h->min) h->min = hdr.min;
+    if(!h->count || hdr.max > h->max) h->max = hdr.max;
+    h->count += hdr.count;
+    h->sum   += hdr.sum;
+    return SYMBIOMON_SUCCESS;
+}
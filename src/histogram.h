@@ -0,0 +1,53 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _HISTOGRAM_H
+#define _HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "symbiomon/symbiomon-common.h"
+
+void symbiomon_histogram_init(symbiomon_histogram* h);
+
+/* bounds of bucket i: [lower, upper) */
+double symbiomon_histogram_bucket_lower(size_t i);
+double symbiomon_histogram_bucket_upper(size_t i);
+
+/* Removes from h the values already counted in since, an earlier copy of
+ * h. The min and max of h are left unchanged. */
+void symbiomon_histogram_subtract(symbiomon_histogram* h, const symbiomon_histogram* since);
+
+/*
+ * Bucket of a non-negative value, read off its bits: the exponent picks
+ * the power of two and the top SYMBIOMON_HISTOGRAM_SUB_BITS bits of the
+ * mantissa the bucket within it. Zero and subnormals fall in the first
+ * bucket, infinity and NaN in the last one.
+ */
+static inline size_t symbiomon_histogram_index(double val)
+{
+    uint64_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    int64_t e = (int64_t)((bits >> 52) & 0x7ff) - 1023;
+    if(e < SYMBIOMON_HISTOGRAM_MIN_EXP)
+        return 0;
+    if(e >= SYMBIOMON_HISTOGRAM_MAX_EXP)
+        return SYMBIOMON_HISTOGRAM_BUCKETS - 1;
+    return ((size_t)(e - SYMBIOMON_HISTOGRAM_MIN_EXP) << SYMBIOMON_HISTOGRAM_SUB_BITS)
+         | (size_t)((bits >> (52 - SYMBIOMON_HISTOGRAM_SUB_BITS)) & ((1u << SYMBIOMON_HISTOGRAM_SUB_BITS) - 1));
+}
+
+/* counts a non-negative value; the caller holds the lock protecting h */
+static inline void symbiomon_histogram_add(symbiomon_histogram* h, double val)
+{
+    h->buckets[symbiomon_histogram_index(val)] += 1;
+    if(!h->count || val < h->min) h->min = val;
+    if(!h->count || val > h->max) h->max = val;
+    h->count += 1;
+    h->sum += val;
+}
+
+#endif
@@ -0,0 +1,484 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <math.h>
+#include <string.h>
+#include "kernels.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define SYMBIOMON_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+void symbiomon_summary_init(symbiomon_summary* s)
+{
+    s->count = 0;
+    s->sum   = 0.0;
+    s->min   = INFINITY;
+    s->max   = -INFINITY;
+    s->mean  = 0.0;
+    s->m2    = 0.0;
+}
+
+void symbiomon_summary_merge(symbiomon_summary* a, const symbiomon_summary* b)
+{
+    if(b->count == 0) return;
+    if(a->count == 0) {
+        *a = *b;
+        return;
+    }
+
+    double na = (double)a->count;
+    double nb = (double)b->count;
+    double n  = na + nb;
+    double delta = b->mean - a->mean;
+
+    a->m2   += b->m2 + delta*delta*na*nb/n;
+    a->mean += delta*nb/n;
+    a->sum  += b->sum;
+    a->min   = b->min < a->min ? b->min : a->min;
+    a->max   = b->max > a->max ? b->max : a->max;
+    a->count += b->count;
+}
+
+double symbiomon_quantile(double* vals, size_t n, double q)
+{
+    size_t k = (size_t)ceil(q*(double)n);
+    size_t lo = 0, hi = n - 1;
+    k = k ? k - 1 : 0;
+    if(k > hi) k = hi;
+
+    /* Hoare partitioning around the median of three until k is in place */
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo)/2;
+        double a = vals[lo], b = vals[mid], c = vals[hi];
+        double pivot = a < b ? (b < c ? b : (a < c ? c : a))
+                             : (a < c ? a : (b < c ? c : b));
+        size_t i = lo, j = hi;
+        while(i <= j) {
+            while(vals[i] < pivot) i++;
+            while(vals[j] > pivot) j--;
+            if(i <= j) {
+                double t = vals[i];
+                vals[i] = vals[j];
+                vals[j] = t;
+                i++;
+                if(j == 0) break;
+                j--;
+            }
+        }
+        if(k <= j) hi = j;
+        else if(k >= i) lo = i;
+        else break;
+    }
+    return vals[k];
+}
+
+size_t symbiomon_downsample_buckets(const symbiomon_metric_sample* in, size_t n, size_t target,
+        symbiomon_downsample_mode_t mode, symbiomon_metric_sample* out)
+{
+    size_t i, k = 0, bucket = 0, len = 0;
+    double t0, width, tsum = 0.0, vsum = 0.0;
+
+    if(n <= target) {
+        memcpy(out, in, n*sizeof(*in));
+        return n;
+    }
+    if(target == 0)
+        return 0;
+
+    t0 = in[0].time;
+    width = (in[n-1].time - t0)/(double)target;
+    for(i = 0; i < n; i++) {
+        size_t b = width > 0.0 ? (size_t)((in[i].time - t0)/width) : 0;
+        if(b >= target) b = target - 1;
+        if(len && b != bucket) {
+            if(mode == SYMBIOMON_DOWNSAMPLE_AVG) {
+                out[k].time = tsum/(double)len;
+                out[k].val  = vsum/(double)len;
+            }
+            k++;
+            len = 0;
+        }
+        bucket = b;
+        switch(mode) {
+        case SYMBIOMON_DOWNSAMPLE_MIN:
+            if(!len || in[i].val < out[k].val) out[k] = in[i];
+            break;
+        case SYMBIOMON_DOWNSAMPLE_MAX:
+            if(!len || in[i].val > out[k].val) out[k] = in[i];
+            break;
+        default:
+            if(!len) {
+                out[k].sample_id = in[i].sample_id;
+                tsum = vsum = 0.0;
+            }
+            tsum += in[i].time;
+            vsum += in[i].val;
+            break;
+        }
+        len++;
+    }
+    if(mode == SYMBIOMON_DOWNSAMPLE_AVG) {
+        out[k].time = tsum/(double)len;
+        out[k].val  = vsum/(double)len;
+    }
+    return k + 1;
+}
+
+size_t symbiomon_downsample_lttb(const symbiomon_metric_sample* in, size_t n, size_t target,
+        symbiomon_metric_sample* out)
+{
+    size_t i, j, a = 0, k = 0;
+    double every, t0;
+
+    if(n <= target) {
+        memcpy(out, in, n*sizeof(*in));
+        return n;
+    }
+    if(target < 3) {
+        if(target > 0) out[k++] = in[0];
+        if(target > 1) out[k++] = in[n-1];
+        return k;
+    }
+
+    /* times relative to the first sample keep the areas accurate */
+    t0 = in[0].time;
+    every = (double)(n - 2)/(double)(target - 2);
+    out[k++] = in[0];
+    for(i = 0; i < target - 2; i++) {
+        size_t next_start = (size_t)((double)(i + 1)*every) + 1;
+        size_t next_end   = (size_t)((double)(i + 2)*every) + 1;
+        size_t start      = (size_t)((double)i*every) + 1;
+        double cx = 0.0, cy = 0.0, ax, ay, max_area = -1.0;
+        size_t best = start;
+
+        if(next_end > n) next_end = n;
+        for(j = next_start; j < next_end; j++) {
+            cx += in[j].time - t0;
+            cy += in[j].val;
+        }
+        cx /= (double)(next_end - next_start);
+        cy /= (double)(next_end - next_start);
+
+        ax = in[a].time - t0;
+        ay = in[a].val;
+        for(j = start; j < next_start; j++) {
+            double area = fabs((ax - cx)*(in[j].val - ay) - (ax - (in[j].time - t0))*(cy - ay));
+            if(area > max_area) {
+                max_area = area;
+                best = j;
+            }
+        }
+        out[k++] = in[best];
+        a = best;
+    }
+    out[k++] = in[n-1];
+    return k;
+}
+
+/*
+ * The summary kernels accumulate sum(x - k) and sum((x - k)^2) with
+ * k = vals[0]. Shifting by a value from the data keeps the one-pass
+ * variance accurate without Welford's per-sample division.
+ */
+static void finish_summary(symbiomon_summary* out, size_t n, double k,
+        double sum, double s1, double s2, double min, double max)
+{
+    out->count = n;
+    out->sum   = sum;
+    out->min   = min;
+    out->max   = max;
+    out->mean  = k + s1/(double)n;
+    out->m2    = s2 - s1*s1/(double)n;
+    if(out->m2 < 0.0) out->m2 = 0.0;
+}
+
+/* Portable implementation */
+
+static double scalar_sum(const double* vals, size_t n)
+{
+    double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4) {
+        s0 += vals[i];
+        s1 += vals[i+1];
+        s2 += vals[i+2];
+        s3 += vals[i+3];
+    }
+    for(; i < n; i++)
+        s0 += vals[i];
+    return (s0 + s1) + (s2 + s3);
+}
+
+static double scalar_min(const double* vals, size_t n)
+{
+    double m = INFINITY;
+    size_t i;
+    for(i = 0; i < n; i++)
+        m = vals[i] < m ? vals[i] : m;
+    return m;
+}
+
+static double scalar_max(const double* vals, size_t n)
+{
+    double m = -INFINITY;
+    size_t i;
+    for(i = 0; i < n; i++)
+        m = vals[i] > m ? vals[i] : m;
+    return m;
+}
+
+static void scalar_summary(const double* vals, size_t n, symbiomon_summary* out)
+{
+    symbiomon_summary_init(out);
+    if(n == 0) return;
+
+    double k = vals[0];
+    double sum = 0, s1 = 0, s2 = 0;
+    double min = vals[0], max = vals[0];
+    size_t i;
+    for(i = 0; i < n; i++) {
+        double d = vals[i] - k;
+        sum += vals[i];
+        s1  += d;
+        s2  += d*d;
+        min = vals[i] < min ? vals[i] : min;
+        max = vals[i] > max ? vals[i] : max;
+    }
+    finish_summary(out, n, k, sum, s1, s2, min, max);
+}
+
+static const symbiomon_kernels scalar_kernels = {
+    "scalar", scalar_sum, scalar_min, scalar_max, scalar_summary
+};
+
+#ifdef SYMBIOMON_X86_KERNELS
+
+/* AVX2 implementation */
+
+__attribute__((target("avx2")))
+static inline double avx2_hsum(__m256d v)
+{
+    __m128d lo = _mm256_castpd256_pd128(v);
+    __m128d hi = _mm256_extractf128_pd(v, 1);
+    lo = _mm_add_pd(lo, hi);
+    return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+}
+
+__attribute__((target("avx2")))
+static inline double avx2_hmin(__m256d v)
+{
+    __m128d lo = _mm256_castpd256_pd128(v);
+    __m128d hi = _mm256_extractf128_pd(v, 1);
+    lo = _mm_min_pd(lo, hi);
+    return _mm_cvtsd_f64(_mm_min_sd(lo, _mm_unpackhi_pd(lo, lo)));
+}
+
+__attribute__((target("avx2")))
+static inline double avx2_hmax(__m256d v)
+{
+    __m128d lo = _mm256_castpd256_pd128(v);
+    __m128d hi = _mm256_extractf128_pd(v, 1);
+    lo = _mm_max_pd(lo, hi);
+    return _mm_cvtsd_f64(_mm_max_sd(lo, _mm_unpackhi_pd(lo, lo)));
+}
+
+__attribute__((target("avx2")))
+static double avx2_sum(const double* vals, size_t n)
+{
+    __m256d a0 = _mm256_setzero_pd();
+    __m256d a1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        a0 = _mm256_add_pd(a0, _mm256_loadu_pd(vals + i));
+        a1 = _mm256_add_pd(a1, _mm256_loadu_pd(vals + i + 4));
+    }
+    double s = avx2_hsum(_mm256_add_pd(a0, a1));
+    for(; i < n; i++)
+        s += vals[i];
+    return s;
+}
+
+__attribute__((target("avx2")))
+static double avx2_min(const double* vals, size_t n)
+{
+    __m256d m = _mm256_set1_pd(INFINITY);
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4)
+        m = _mm256_min_pd(m, _mm256_loadu_pd(vals + i));
+    double r = avx2_hmin(m);
+    for(; i < n; i++)
+        r = vals[i] < r ? vals[i] : r;
+    return r;
+}
+
+__attribute__((target("avx2")))
+static double avx2_max(const double* vals, size_t n)
+{
+    __m256d m = _mm256_set1_pd(-INFINITY);
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4)
+        m = _mm256_max_pd(m, _mm256_loadu_pd(vals + i));
+    double r = avx2_hmax(m);
+    for(; i < n; i++)
+        r = vals[i] > r ? vals[i] : r;
+    return r;
+}
+
+__attribute__((target("avx2")))
+static void avx2_summary(const double* vals, size_t n, symbiomon_summary* out)
+{
+    symbiomon_summary_init(out);
+    if(n == 0) return;
+
+    double k = vals[0];
+    __m256d vk  = _mm256_set1_pd(k);
+    __m256d vs  = _mm256_setzero_pd();
+    __m256d vs1 = _mm256_setzero_pd();
+    __m256d vs2 = _mm256_setzero_pd();
+    __m256d vmn = _mm256_set1_pd(k);
+    __m256d vmx = _mm256_set1_pd(k);
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4) {
+        __m256d x = _mm256_loadu_pd(vals + i);
+        __m256d d = _mm256_sub_pd(x, vk);
+        vs  = _mm256_add_pd(vs, x);
+        vs1 = _mm256_add_pd(vs1, d);
+        vs2 = _mm256_add_pd(vs2, _mm256_mul_pd(d, d));
+        vmn = _mm256_min_pd(vmn, x);
+        vmx = _mm256_max_pd(vmx, x);
+    }
+    double sum = avx2_hsum(vs), s1 = avx2_hsum(vs1), s2 = avx2_hsum(vs2);
+    double min = avx2_hmin(vmn), max = avx2_hmax(vmx);
+    for(; i < n; i++) {
+        double d = vals[i] - k;
+        sum += vals[i];
+        s1  += d;
+        s2  += d*d;
+        min = vals[i] < min ? vals[i] : min;
+        max = vals[i] > max ? vals[i] : max;
+    }
+    finish_summary(out, n, k, sum, s1, s2, min, max);
+}
+
+static const symbiomon_kernels avx2_kernels = {
+    "avx2", avx2_sum, avx2_min, avx2_max, avx2_summary
+};
+
+/* AVX-512 implementation */
+
+__attribute__((target("avx512f")))
+static double avx512_sum(const double* vals, size_t n)
+{
+    __m512d a0 = _mm512_setzero_pd();
+    __m512d a1 = _mm512_setzero_pd();
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        a0 = _mm512_add_pd(a0, _mm512_loadu_pd(vals + i));
+        a1 = _mm512_add_pd(a1, _mm512_loadu_pd(vals + i + 8));
+    }
+    double s = _mm512_reduce_add_pd(_mm512_add_pd(a0, a1));
+    for(; i < n; i++)
+        s += vals[i];
+    return s;
+}
+
+__attribute__((target("avx512f")))
+static double avx512_min(const double* vals, size_t n)
+{
+    __m512d m = _mm512_set1_pd(INFINITY);
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8)
+        m = _mm512_min_pd(m, _mm512_loadu_pd(vals + i));
+    double r = _mm512_reduce_min_pd(m);
+    for(; i < n; i++)
+        r = vals[i] < r ? vals[i] : r;
+    return r;
+}
+
+__attribute__((target("avx512f")))
+static double avx512_max(const double* vals, size_t n)
+{
+    __m512d m = _mm512_set1_pd(-INFINITY);
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8)
+        m = _mm512_max_pd(m, _mm512_loadu_pd(vals + i));
+    double r = _mm512_reduce_max_pd(m);
+    for(; i < n; i++)
+        r = vals[i] > r ? vals[i] : r;
+    return r;
+}
+
+__attribute__((target("avx512f")))
+static void avx512_summary(const double* vals, size_t n, symbiomon_summary* out)
+{
+    symbiomon_summary_init(out);
+    if(n == 0) return;
+
+    double k = vals[0];
+    __m512d vk  = _mm512_set1_pd(k);
+    __m512d vs  = _mm512_setzero_pd();
+    __m512d vs1 = _mm512_setzero_pd();
+    __m512d vs2 = _mm512_setzero_pd();
+    __m512d vmn = _mm512_set1_pd(k);
+    __m512d vmx = _mm512_set1_pd(k);
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        __m512d x = _mm512_loadu_pd(vals + i);
+        __m512d d = _mm512_sub_pd(x, vk);
+        vs  = _mm512_add_pd(vs, x);
+        vs1 = _mm512_add_pd(vs1, d);
+        vs2 = _mm512_fmadd_pd(d, d, vs2);
+        vmn = _mm512_min_pd(vmn, x);
+        vmx = _mm512_max_pd(vmx, x);
+    }
+    double sum = _mm512_reduce_add_pd(vs);
+    double s1  = _mm512_reduce_add_pd(vs1);
+    double s2  = _mm512_reduce_add_pd(vs2);
+    double min = _mm512_reduce_min_pd(vmn);
+    double max = _mm512_reduce_max_pd(vmx);
+    for(; i < n; i++) {
+        double d = vals[i] - k;
+        sum += vals[i];
+        s1  += d;
+        s2  += d*d;
+        min = vals[i] < min ? vals[i] : min;
+        max = vals[i] > max ? vals[i] : max;
+    }
+    finish_summary(out, n, k, sum, s1, s2, min, max);
+}
+
+static const symbiomon_kernels avx512_kernels = {
+    "avx512", avx512_sum, avx512_min, avx512_max, avx512_summary
+};
+
+#endif
+
+const symbiomon_kernels* symbiomon_kernels_find(const char* name)
+{
+    if(strcmp(name, "scalar") == 0)
+        return &scalar_kernels;
+#ifdef SYMBIOMON_X86_KERNELS
+    __builtin_cpu_init();
+    if(strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2"))
+        return &avx2_kernels;
+    if(strcmp(name, "avx512") == 0 && __builtin_cpu_supports("avx512f"))
+        return &avx512_kernels;
+#endif
+    return NULL;
+}
+
+const symbiomon_kernels* symbiomon_kernels_get(void)
+{
+    static const symbiomon_kernels* selected = NULL;
+    if(selected) return selected;
+
+    const symbiomon_kernels* k = symbiomon_kernels_find("avx512");
+    if(!k) k = symbiomon_kernels_find("avx2");
+    if(!k) k = &scalar_kernels;
+    selected = k;
+    return selected;
+}
@@ -0,0 +1,87 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _KERNELS_H
+#define _KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "symbiomon/symbiomon-common.h"
+
+/*
+ * Summary statistics over a set of values. m2 is the sum of squared
+ * deviations from the mean, so the variance is m2/count.
+ */
+typedef struct symbiomon_summary {
+    uint64_t count;
+    double   sum;
+    double   min;
+    double   max;
+    double   mean;
+    double   m2;
+} symbiomon_summary;
+
+/*
+ * Reduction kernels over contiguous arrays of doubles. Several
+ * implementations exist (scalar, AVX2, AVX-512); the widest one
+ * supported by the CPU is picked the first time the table is needed.
+ */
+typedef struct symbiomon_kernels {
+    const char* name;
+    double (*sum)(const double* vals, size_t n);
+    double (*min)(const double* vals, size_t n);
+    double (*max)(const double* vals, size_t n);
+    /* count, sum, min, max, mean and m2 in a single pass */
+    void   (*summary)(const double* vals, size_t n, symbiomon_summary* out);
+} symbiomon_kernels;
+
+/* kernels selected for the current CPU */
+const symbiomon_kernels* symbiomon_kernels_get(void);
+
+/* kernels of a given implementation ("scalar", "avx2", "avx512"),
+ * or NULL if it is not available on the current CPU */
+const symbiomon_kernels* symbiomon_kernels_find(const char* name);
+
+void symbiomon_summary_init(symbiomon_summary* s);
+
+/* Combines b into a (Chan et al. parallel variance update) */
+void symbiomon_summary_merge(symbiomon_summary* a, const symbiomon_summary* b);
+
+/* Adds one value (Welford's online update) */
+static inline void symbiomon_summary_add(symbiomon_summary* s, double x)
+{
+    double delta = x - s->mean;
+    s->count++;
+    s->sum  += x;
+    s->mean += delta / (double)s->count;
+    s->m2   += delta * (x - s->mean);
+    if(x < s->min) s->min = x;
+    if(x > s->max) s->max = x;
+}
+
+/* Nearest-rank q-quantile of vals (q in [0, 1]), found by quickselect;
+ * reorders vals. n must not be 0. */
+double symbiomon_quantile(double* vals, size_t n, double q);
+
+/* Downsamples the n samples of in, oldest first, into at most target
+ * points written to out and returns their number. The time span of in
+ * is cut into target equal intervals and each non-empty one yields its
+ * smallest or largest sample, or a point at the mean time and value. */
+size_t symbiomon_downsample_buckets(const symbiomon_metric_sample* in, size_t n, size_t target,
+        symbiomon_downsample_mode_t mode, symbiomon_metric_sample* out);
+
+/* Same with Largest-Triangle-Three-Buckets, which keeps the first and
+ * last samples and, from each bucket in between, the sample forming the
+ * largest triangle with the previous point kept and the next bucket's
+ * average. Returns min(n, target) points. */
+size_t symbiomon_downsample_lttb(const symbiomon_metric_sample* in, size_t n, size_t target,
+        symbiomon_metric_sample* out);
+
+static inline double symbiomon_summary_variance(const symbiomon_summary* s)
+{
+    return s->count ? s->m2 / (double)s->count : 0.0;
+}
+
+#endif
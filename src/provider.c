@@ -6,11 +6,13 @@
 #include <assert.h>
 #include <math.h>
 #include<time.h>
+#include <sys/time.h>
 #include "symbiomon/symbiomon-server.h"
 #include "symbiomon/symbiomon-common.h"
 #include "symbiomon/symbiomon-backend.h"
 #include "provider.h"
 #include "types.h"
+#include "kernels.h"
 #ifdef USE_AGGREGATOR
 #include <sdskv-client.h>
 #endif
@@ -38,13 +40,48 @@ static inline symbiomon_return_t remove_metric(
 static inline void remove_all_metrics(
         symbiomon_provider_t provider);
 
+static inline void free_metric(
+        symbiomon_metric* metric);
+
+static void snapshot_ult(void* arg);
+
+static void subscriber_ult(void* arg);
+
+static void stop_subscribers(
+        symbiomon_subscriber* list);
+
 /* Admin RPCs */
 
 /* Client RPCs */
 static DECLARE_MARGO_RPC_HANDLER(symbiomon_metric_fetch_ult)
 static void symbiomon_metric_fetch_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(symbiomon_metric_fetch_encoded_ult)
+static void symbiomon_metric_fetch_encoded_ult(hg_handle_t h);
 static DECLARE_MARGO_RPC_HANDLER(symbiomon_list_metrics_ult)
 static void symbiomon_list_metrics_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(symbiomon_metric_fetch_columns_ult)
+static void symbiomon_metric_fetch_columns_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(symbiomon_metric_expose_ult)
+static void symbiomon_metric_expose_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(symbiomon_metric_fetch_since_ult)
+static void symbiomon_metric_fetch_since_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(symbiomon_metrics_fetch_multi_ult)
+static void symbiomon_metrics_fetch_multi_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(symbiomon_metric_fetch_range_ult)
+static void symbiomon_metric_fetch_range_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(symbiomon_metric_aggregate_ult)
+static void symbiomon_metric_aggregate_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(symbiomon_metric_fetch_downsampled_ult)
+static void symbiomon_metric_fetch_downsampled_ult(hg_handle_t h);
+
+static DECLARE_MARGO_RPC_HANDLER(symbiomon_metric_fetch_rollup_ult)
+static void symbiomon_metric_fetch_rollup_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(symbiomon_metric_fetch_histogram_ult)
+static void symbiomon_metric_fetch_histogram_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(symbiomon_subscribe_ult)
+static void symbiomon_subscribe_ult(hg_handle_t h);
+static DECLARE_MARGO_RPC_HANDLER(symbiomon_unsubscribe_ult)
+static void symbiomon_unsubscribe_ult(hg_handle_t h);
 
 /* add other RPC declarations here */
 
@@ -83,6 +120,14 @@ int symbiomon_provider_register(
     p->mid = mid;
     p->provider_id = provider_id;
     p->pool = a.pool;
+    if(symbiomon_chunk_pool_init(&p->chunk_pool, mid) != SYMBIOMON_SUCCESS) {
+        margo_error(mid, "Could not create chunk pool for provider");
+        free(p);
+        return SYMBIOMON_ERR_FROM_ARGOBOTS;
+    }
+    ABT_mutex_create(&p->metrics_mutex);
+    ABT_mutex_create(&p->subscribers_mutex);
+    p->max_subscribers = a.max_subscribers;
     //p->abtio = a.abtio;
 
     /* Admin RPCs */
@@ -94,11 +139,89 @@ int symbiomon_provider_register(
     margo_register_data(mid, id, (void*)p, NULL);
     p->metric_fetch_id = id;
 
+    id = MARGO_REGISTER_PROVIDER(mid, "symbiomon_remote_metric_fetch_encoded",
+            metric_fetch_encoded_in_t, metric_fetch_encoded_out_t,
+            symbiomon_metric_fetch_encoded_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->metric_fetch_encoded_id = id;
+
     id = MARGO_REGISTER_PROVIDER(mid, "symbiomon_remote_list_metrics",
             list_metrics_in_t, list_metrics_out_t,
             symbiomon_list_metrics_ult, provider_id, p->pool);
     margo_register_data(mid, id, (void*)p, NULL);
     p->list_metrics_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "symbiomon_remote_metric_fetch_columns",
+            metric_fetch_columns_in_t, metric_fetch_out_t,
+            symbiomon_metric_fetch_columns_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->metric_fetch_columns_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "symbiomon_remote_metric_expose",
+            metric_expose_in_t, metric_expose_out_t,
+            symbiomon_metric_expose_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->metric_expose_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "symbiomon_remote_metric_fetch_since",
+            metric_fetch_since_in_t, metric_fetch_since_out_t,
+            symbiomon_metric_fetch_since_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->metric_fetch_since_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "symbiomon_remote_metrics_fetch_multi",
+            metrics_fetch_multi_in_t, metrics_fetch_multi_out_t,
+            symbiomon_metrics_fetch_multi_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->metrics_fetch_multi_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "symbiomon_remote_metric_fetch_range",
+            metric_fetch_range_in_t, metric_fetch_out_t,
+            symbiomon_metric_fetch_range_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->metric_fetch_range_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "symbiomon_remote_metric_aggregate",
+            metric_aggregate_in_t, metric_aggregate_out_t,
+            symbiomon_metric_aggregate_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->metric_aggregate_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "symbiomon_remote_metric_fetch_downsampled",
+            metric_fetch_downsampled_in_t, metric_fetch_out_t,
+            symbiomon_metric_fetch_downsampled_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->metric_fetch_downsampled_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "symbiomon_remote_metric_fetch_rollup",
+            metric_fetch_rollup_in_t, metric_fetch_rollup_out_t,
+            symbiomon_metric_fetch_rollup_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->metric_fetch_rollup_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "symbiomon_remote_metric_fetch_histogram",
+            metric_fetch_histogram_in_t, metric_fetch_histogram_out_t,
+            symbiomon_metric_fetch_histogram_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->metric_fetch_histogram_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "symbiomon_remote_subscribe",
+            subscribe_in_t, subscribe_out_t,
+            symbiomon_subscribe_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->subscribe_id = id;
+
+    id = MARGO_REGISTER_PROVIDER(mid, "symbiomon_remote_unsubscribe",
+            unsubscribe_in_t, unsubscribe_out_t,
+            symbiomon_unsubscribe_ult, provider_id, p->pool);
+    margo_register_data(mid, id, (void*)p, NULL);
+    p->unsubscribe_id = id;
+
+    /* notifications are handled by clients, which may live in this process */
+    margo_registered_name(mid, "symbiomon_subscription_notify", &id, &flag);
+    if(flag == HG_FALSE)
+        id = MARGO_REGISTER(mid, "symbiomon_subscription_notify", notify_in_t, notify_out_t, NULL);
+    p->notify_id = id;
     p->use_aggregator = 0;
     p->use_reducer = 0;
 
@@ -174,9 +297,30 @@ static void symbiomon_finalize_provider(void* p)
     symbiomon_provider_t provider = (symbiomon_provider_t)p;
     margo_info(provider->mid, "Finalizing SYMBIOMON provider");
     margo_deregister(provider->mid, provider->metric_fetch_id);
+    margo_deregister(provider->mid, provider->metric_fetch_encoded_id);
     margo_deregister(provider->mid, provider->list_metrics_id);
+    margo_deregister(provider->mid, provider->metric_fetch_columns_id);
+    margo_deregister(provider->mid, provider->metric_expose_id);
+    margo_deregister(provider->mid, provider->metric_fetch_since_id);
+    margo_deregister(provider->mid, provider->metrics_fetch_multi_id);
+    margo_deregister(provider->mid, provider->metric_fetch_range_id);
+    margo_deregister(provider->mid, provider->metric_aggregate_id);
+    margo_deregister(provider->mid, provider->metric_fetch_downsampled_id);
+    margo_deregister(provider->mid, provider->metric_fetch_rollup_id);
+    margo_deregister(provider->mid, provider->metric_fetch_histogram_id);
+    margo_deregister(provider->mid, provider->subscribe_id);
+    margo_deregister(provider->mid, provider->unsubscribe_id);
     /* deregister other RPC ids ... */
+    ABT_mutex_lock(provider->subscribers_mutex);
+    symbiomon_subscriber* subscribers = provider->subscribers;
+    provider->subscribers = NULL;
+    provider->num_subscribers = 0;
+    ABT_mutex_unlock(provider->subscribers_mutex);
+    stop_subscribers(subscribers);
+    ABT_mutex_free(&provider->subscribers_mutex);
     remove_all_metrics(provider);
+    ABT_mutex_free(&provider->metrics_mutex);
+    symbiomon_chunk_pool_finalize(&provider->chunk_pool);
     free(provider);
     margo_info(provider->mid, "SYMBIOMON provider successfuly finalized");
 }
@@ -196,67 +340,1550 @@ int symbiomon_provider_destroy(
 
 symbiomon_return_t symbiomon_provider_metric_create_with_reduction(const char *ns, const char *name, symbiomon_metric_type_t t, const char *desc, symbiomon_taglist_t tl, symbiomon_metric_t* m, symbiomon_provider_t provider, symbiomon_metric_reduction_op_t op)
 {
-    int i;
-    symbiomon_return_t ret = symbiomon_provider_metric_create(ns, name, t, desc, tl, m, provider);
-    if(ret != SYMBIOMON_SUCCESS) return ret;
+    struct symbiomon_metric_args args = SYMBIOMON_METRIC_ARGS_INIT;
+    args.reduction_op = op;
+    return symbiomon_provider_metric_create_with_args(ns, name, t, desc, tl, m, provider, &args);
+}
+
+symbiomon_return_t symbiomon_provider_metric_create(const char *ns, const char *name, symbiomon_metric_type_t t, const char *desc, symbiomon_taglist_t tl, symbiomon_metric_t* m, symbiomon_provider_t provider)
+{
+    return symbiomon_provider_metric_create_with_args(ns, name, t, desc, tl, m, provider, NULL);
+}
+
+symbiomon_return_t symbiomon_provider_metric_create_with_args(const char *ns, const char *name, symbiomon_metric_type_t t, const char *desc, symbiomon_taglist_t tl, symbiomon_metric_t* m, symbiomon_provider_t provider, const struct symbiomon_metric_args* args)
+{
+    struct symbiomon_metric_args a = SYMBIOMON_METRIC_ARGS_INIT;
+    if(args) a = *args;
+    if(a.capacity == 0) a.capacity = METRIC_BUFFER_SIZE;
+
+    if(!ns || !name)
+        return SYMBIOMON_ERR_INVALID_NAME;
+
+    /* rollup tiers go from the finest to the coarsest */
+    int i, num_rollups = 0;
+    while(num_rollups < SYMBIOMON_MAX_ROLLUPS && a.rollups[num_rollups].period > 0) {
+        if(a.rollups[num_rollups].retention == 0
+        || (num_rollups && a.rollups[num_rollups].period <= a.rollups[num_rollups-1].period))
+            return SYMBIOMON_ERR_INVALID_ARGS;
+        num_rollups++;
+    }
+    if(a.num_shards) num_rollups = 0;
+
+    /* histogram metrics keep buckets and no samples */
+    if(t == SYMBIOMON_TYPE_HISTOGRAM) {
+        a.capacity = 1;
+        a.num_shards = 0;
+        a.history_capacity = 0;
+        num_rollups = 0;
+    }
+
+    /* the percentile sketch has no buckets below zero, it is only kept
+     * for the types whose values are checked to be non-negative */
+    if((a.reduction_op == SYMBIOMON_REDUCTION_OP_P50
+     || a.reduction_op == SYMBIOMON_REDUCTION_OP_P95
+     || a.reduction_op == SYMBIOMON_REDUCTION_OP_P99)
+    && t != SYMBIOMON_TYPE_TIMER && t != SYMBIOMON_TYPE_HISTOGRAM)
+        return SYMBIOMON_ERR_OP_UNSUPPORTED;
+
+    /* create an id for the new metric */
+    symbiomon_metric_id_t id;
+    symbiomon_id_from_string_identifiers(ns, name, tl->taglist, tl->num_tags, &id);
+
+    symbiomon_metric* existing = find_metric(provider, &(id));
+    if(existing) {
+        *m = existing;
+        return SYMBIOMON_ERR_METRIC_EXISTS;
+    }
+
+    /* allocate a metric, set it up, and add it to the provider */
+    symbiomon_metric* metric = (symbiomon_metric*)calloc(1, sizeof(*metric));
+    if(!metric)
+        return SYMBIOMON_ERR_ALLOCATION;
+    if(symbiomon_series_init(&metric->series, a.capacity, a.layout, &provider->chunk_pool) != SYMBIOMON_SUCCESS) {
+        free(metric);
+        return SYMBIOMON_ERR_ALLOCATION;
+    }
+    /* blocks are sealed whole, a smaller history would never hold one */
+    size_t block = metric->series.capacity < SYMBIOMON_CHUNK_SIZE ? metric->series.capacity : SYMBIOMON_CHUNK_SIZE;
+    if(a.history_capacity && a.history_capacity < block)
+        a.history_capacity = block;
+    if(symbiomon_history_init(&metric->history, a.num_shards ? 0 : a.history_capacity) != SYMBIOMON_SUCCESS) {
+        symbiomon_series_finalize(&metric->series);
+        free(metric);
+        return SYMBIOMON_ERR_ALLOCATION;
+    }
+    if(t == SYMBIOMON_TYPE_HISTOGRAM) {
+        metric->histogram = (symbiomon_histogram*)malloc(sizeof(*metric->histogram));
+        if(a.reduction_scope == SYMBIOMON_STATS_INTERVAL)
+            metric->reduced_histogram = (symbiomon_histogram*)malloc(sizeof(*metric->reduced_histogram));
+        if(!metric->histogram || (a.reduction_scope == SYMBIOMON_STATS_INTERVAL && !metric->reduced_histogram)) {
+            free_metric(metric);
+            return SYMBIOMON_ERR_ALLOCATION;
+        }
+        symbiomon_histogram_init(metric->histogram);
+        if(metric->reduced_histogram)
+            symbiomon_histogram_init(metric->reduced_histogram);
+    }
+    for(i = 0; i < num_rollups; i++) {
+        if(symbiomon_rollup_tier_init(&metric->rollups[i], a.rollups[i].period, a.rollups[i].retention) != SYMBIOMON_SUCCESS) {
+            free_metric(metric);
+            return SYMBIOMON_ERR_ALLOCATION;
+        }
+        metric->num_rollups = i + 1;
+    }
+    if(a.num_shards) {
+        size_t j;
+        if(posix_memalign((void**)&metric->shards, sizeof(symbiomon_shard), a.num_shards*sizeof(symbiomon_shard)) != 0) {
+            metric->shards = NULL;
+            metric->num_shards = 0;
+            free_metric(metric);
+            return SYMBIOMON_ERR_ALLOCATION;
+        }
+        memset(metric->shards, 0, a.num_shards*sizeof(symbiomon_shard));
+        for(j = 0; j < a.num_shards; j++) {
+            if(symbiomon_series_init(&metric->shards[j].series, a.capacity, a.layout, &provider->chunk_pool) != SYMBIOMON_SUCCESS) {
+                metric->num_shards = j;
+                free_metric(metric);
+                return SYMBIOMON_ERR_ALLOCATION;
+            }
+        }
+        metric->num_shards = a.num_shards;
+    }
+    ABT_mutex_create(&metric->metric_mutex);
+    if(t == SYMBIOMON_TYPE_COUNTER && a.snapshot_interval > 0) {
+        ABT_pool pool = provider->pool;
+        if(pool == ABT_POOL_NULL)
+            margo_get_handler_pool(provider->mid, &pool);
+        metric->snapshot_interval = a.snapshot_interval;
+        ABT_cond_create(&metric->snapshot_cond);
+        if(ABT_thread_create(pool, snapshot_ult, metric, ABT_THREAD_ATTR_NULL, &metric->snapshot_ult) != ABT_SUCCESS) {
+            free_metric(metric);
+            return SYMBIOMON_ERR_FROM_ARGOBOTS;
+        }
+    }
+    metric->id  = id;
+    strcpy(metric->name, name);
+    strcpy(metric->ns, ns);
+    strcpy(metric->desc, desc);
+    metric->type = t;
+    metric->taglist = tl;
+    metric->reduction_op = a.reduction_op;
+    metric->reduction_scope = a.reduction_scope;
+    metric->reduced_index = 0;
+    symbiomon_summary_init(&metric->reduced);
+    symbiomon_summary_init(&metric->interval);
 
 #ifdef USE_AGGREGATOR
-    strcat((*m)->stringify, ns);
-    strcat((*m)->stringify, "_");
-    strcat((*m)->stringify, name);
-    (*m)->aggregator_id = symbiomon_hash((*m)->stringify);
-    (*m)->reduction_op = op;
+    strcat(metric->stringify, ns);
+    strcat(metric->stringify, "_");
+    strcat(metric->stringify, name);
+    metric->aggregator_id = symbiomon_hash(metric->stringify);
 
     for(i = 0; i < tl->num_tags; i++) {
-        strcat((*m)->stringify, "_");
-        strcat((*m)->stringify, tl->taglist[i]);
+        strcat(metric->stringify, "_");
+        strcat(metric->stringify, tl->taglist[i]);
     }
 #endif
 
+    if(add_metric(provider, metric) != SYMBIOMON_SUCCESS) {
+        /* created concurrently since the check above */
+        free_metric(metric);
+        *m = find_metric(provider, &(id));
+        return SYMBIOMON_ERR_METRIC_EXISTS;
+    }
+
+    *m = metric;
+    //fprintf(stderr, "Created metric with id: %lu and name: %s\n", metric->id, name);
+
+    return SYMBIOMON_SUCCESS;
+}
+
+/* number of bulk transfers a fetch keeps in flight at once */
+#define MAX_INFLIGHT_PUSHES 16
+
+/*
+ * Pushes the samples [first, first+n) of a series to the remote bulk
+ * straight from the chunks' registered regions, one transfer per
+ * contiguous run. Entries are elem_size bytes, starting at byte
+ * chunk_offset in each chunk and at remote_offset in the remote bulk.
+ */
+static hg_return_t push_series(margo_instance_id mid, hg_addr_t addr, hg_bulk_t remote, hg_size_t remote_offset,
+        const symbiomon_series* s, uint64_t first, size_t n, hg_size_t elem_size, hg_size_t chunk_offset)
+{
+    margo_request reqs[MAX_INFLIGHT_PUSHES];
+    size_t i, off, len, num_reqs = 0, pushed = 0;
+    hg_return_t hret = HG_SUCCESS;
+
+    while(pushed < n || num_reqs) {
+        if(pushed < n && hret == HG_SUCCESS && num_reqs < MAX_INFLIGHT_PUSHES) {
+            symbiomon_series_chunk(s, first + pushed, &off);
+            len = symbiomon_series_span(s, first + pushed, n - pushed);
+            hret = margo_bulk_itransfer(mid, HG_BULK_PUSH, addr, remote, remote_offset + pushed*elem_size,
+                    symbiomon_series_bulk(s, first + pushed), chunk_offset + off*elem_size, len*elem_size,
+                    &reqs[num_reqs]);
+            if(hret == HG_SUCCESS) num_reqs++;
+            pushed += len;
+            continue;
+        }
+        /* the window is full, or nothing is left to issue */
+        for(i = 0; i < num_reqs; i++) {
+            hg_return_t r = margo_wait(reqs[i]);
+            if(hret == HG_SUCCESS) hret = r;
+        }
+        num_reqs = 0;
+        if(hret != HG_SUCCESS) break;
+    }
+    return hret;
+}
+
+/* range of the last n samples retained by a series */
+static size_t last_window(const symbiomon_series* s, size_t n, uint64_t* first)
+{
+    uint64_t count = symbiomon_series_count(s);
+    *first = count > s->capacity ? count - s->capacity : 0;
+    if(count - *first > (uint64_t)n)
+        *first = count - n;
+    return count - *first;
+}
+
+/* number of samples a metric retains across its series */
+static size_t retained_samples(symbiomon_metric* m)
+{
+    size_t i, total = 0;
+    uint64_t first;
+    for(i = 0; i <= m->num_shards; i++)
+        total += last_window(symbiomon_metric_series(m, i), SIZE_MAX, &first);
+    return total;
+}
+
+/* most samples a fetch of the last ones can return, bounding the
+ * buffers sized from a count sent by a client */
+static size_t fetchable_samples(symbiomon_metric* m)
+{
+    return retained_samples(m) + m->history.capacity;
+}
+
+static void symbiomon_metric_fetch_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    metric_fetch_in_t  in;
+    metric_fetch_out_t out;
+    hg_bulk_t local_bulk = HG_BULK_NULL;
+    symbiomon_metric_buffer b = NULL;
+    size_t count;
+    out.actual_count = 0;
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    symbiomon_provider_t provider = (symbiomon_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_info(provider->mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    if(in.count < 0) {
+        out.ret = SYMBIOMON_ERR_INVALID_ARGS;
+        goto finish;
+    }
+
+    symbiomon_metric_id_t requested_id = in.metric_id;
+    symbiomon_metric* metric = find_metric(provider, &(requested_id));
+    if(!metric) {
+        out.ret = SYMBIOMON_ERR_INVALID_METRIC;
+	goto finish;
+    }
+
+    ABT_mutex_lock(metric->metric_mutex);
+    symbiomon_metric_materialize(metric);
+    ABT_mutex_unlock(metric->metric_mutex);
+
+    count = fetchable_samples(metric);
+    if(count > (uint64_t)in.count) count = in.count;
+
+    /* row series are pushed straight from the ring; if a writer overwrote
+     * the oldest of them during the transfer, the others are sent again
+     * through the copy below so that they start the client's buffer */
+    if(metric->num_shards == 0 && metric->series.layout == SYMBIOMON_LAYOUT_ROWS
+    && (metric->history.capacity == 0 || count <= metric->series.capacity)) {
+        uint64_t first;
+        size_t n = last_window(&metric->series, count, &first);
+        hret = push_series(mid, info->addr, in.bulk, 0, &metric->series, first, n,
+                sizeof(symbiomon_metric_sample), 0);
+        if(hret != HG_SUCCESS) {
+            margo_info(provider->mid, "Could not push samples (mercury error %d)", hret);
+            out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+            goto finish;
+        }
+        if(!symbiomon_series_torn(&metric->series, first, n)) {
+            out.actual_count = n;
+            out.ret = SYMBIOMON_SUCCESS;
+            goto finish;
+        }
+    }
+
+    /* other layouts, and fetches reaching into the compressed history,
+     * go through a contiguous copy */
+    b = calloc(count ? count : 1, sizeof(symbiomon_metric_sample));
+    if(!b) {
+        out.ret = SYMBIOMON_ERR_ALLOCATION;
+        goto finish;
+    }
+    hg_size_t buf_size = (count ? count : 1) * sizeof(symbiomon_metric_sample);
+    hret = margo_bulk_create(mid, 1, (void**)&b, &buf_size, HG_BULK_READ_ONLY, &local_bulk);
+
+    if(hret != HG_SUCCESS) {
+        margo_info(provider->mid, "Could not create bulk_handle (mercury error %d)", hret);
+        out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    /* copyout the last count samples still retained */
+    out.actual_count = symbiomon_provider_metric_copy_last(metric, count, b);
+
+    /* do the bulk transfer */
+    if(out.actual_count) {
+        hret = margo_bulk_transfer(mid, HG_BULK_PUSH, info->addr, in.bulk, 0, local_bulk, 0,
+                out.actual_count*sizeof(symbiomon_metric_sample));
+        if(hret != HG_SUCCESS) {
+            margo_info(provider->mid, "Could not create bulk_handle (mercury error %d)", hret);
+            out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+            goto finish;
+        }
+    }
+
+    /* set the response */
+    out.ret = SYMBIOMON_SUCCESS;
+
+finish:
+    free(b);
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+    if(local_bulk != HG_BULK_NULL)
+        margo_bulk_free(local_bulk);
+}
+static DEFINE_MARGO_RPC_HANDLER(symbiomon_metric_fetch_ult)
+
+static void symbiomon_metric_fetch_encoded_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    metric_fetch_encoded_in_t  in;
+    metric_fetch_encoded_out_t out;
+    hg_bulk_t local_bulk = HG_BULK_NULL;
+    symbiomon_metric_buffer b = NULL;
+    uint8_t* encoded = NULL;
+    void* payload;
+    size_t count;
+    out.actual_count = 0;
+    out.encoding = SYMBIOMON_ENCODING_RAW;
+    out.payload_size = 0;
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    symbiomon_provider_t provider = (symbiomon_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_info(provider->mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    if(in.count < 0) {
+        out.ret = SYMBIOMON_ERR_INVALID_ARGS;
+        goto finish;
+    }
+
+    symbiomon_metric_id_t requested_id = in.metric_id;
+    symbiomon_metric* metric = find_metric(provider, &(requested_id));
+    if(!metric) {
+        out.ret = SYMBIOMON_ERR_INVALID_METRIC;
+	goto finish;
+    }
+
+    ABT_mutex_lock(metric->metric_mutex);
+    symbiomon_metric_materialize(metric);
+    ABT_mutex_unlock(metric->metric_mutex);
+
+    count = fetchable_samples(metric);
+    if(count > (uint64_t)in.count) count = in.count;
+    b = (symbiomon_metric_buffer)malloc((count ? count : 1)*sizeof(*b));
+    if(!b) {
+        out.ret = SYMBIOMON_ERR_ALLOCATION;
+        goto finish;
+    }
+    out.actual_count = symbiomon_provider_metric_copy_last(metric, count, b);
+    payload = b;
+    out.payload_size = out.actual_count*sizeof(*b);
+
+    /* the client's buffer is sized for raw samples, so an encoding is
+     * only used when it makes the payload smaller; unknown encodings
+     * are answered with raw samples */
+    if(in.encoding == SYMBIOMON_ENCODING_BLOCK && out.actual_count) {
+        size_t size = symbiomon_block_encode(b, out.actual_count, &encoded);
+        if(size && size < out.payload_size) {
+            payload = encoded;
+            out.payload_size = size;
+            out.encoding = SYMBIOMON_ENCODING_BLOCK;
+        }
+    }
+
+    if(out.payload_size) {
+        hg_size_t buf_size = out.payload_size;
+        hret = margo_bulk_create(mid, 1, &payload, &buf_size, HG_BULK_READ_ONLY, &local_bulk);
+        if(hret != HG_SUCCESS) {
+            margo_info(provider->mid, "Could not create bulk_handle (mercury error %d)", hret);
+            out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+            goto finish;
+        }
+        hret = margo_bulk_transfer(mid, HG_BULK_PUSH, info->addr, in.bulk, 0, local_bulk, 0, buf_size);
+        if(hret != HG_SUCCESS) {
+            margo_info(provider->mid, "Could not push samples (mercury error %d)", hret);
+            out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+            goto finish;
+        }
+    }
+
+    /* set the response */
+    out.ret = SYMBIOMON_SUCCESS;
+
+finish:
+    free(b);
+    free(encoded);
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+    if(local_bulk != HG_BULK_NULL)
+        margo_bulk_free(local_bulk);
+}
+static DEFINE_MARGO_RPC_HANDLER(symbiomon_metric_fetch_encoded_ult)
+
+static void symbiomon_metric_fetch_columns_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    metric_fetch_columns_in_t  in;
+    metric_fetch_out_t out;
+    hg_bulk_t local_bulk = HG_BULK_NULL;
+    char* b = NULL;
+    out.actual_count = 0;
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    symbiomon_provider_t provider = (symbiomon_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_info(provider->mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    if(in.count < 0) {
+        out.ret = SYMBIOMON_ERR_INVALID_ARGS;
+        goto finish;
+    }
+
+    symbiomon_metric_id_t requested_id = in.metric_id;
+    symbiomon_metric* metric = find_metric(provider, &(requested_id));
+    if(!metric) {
+        out.ret = SYMBIOMON_ERR_INVALID_METRIC;
+	goto finish;
+    }
+
+    /* the requested columns are laid out one after the other in the
+     * client's buffer, each of them holding in.count 8-byte entries;
+     * they are staged here with room for the retained samples only */
+    double* vals = NULL;
+    double* times = NULL;
+    uint64_t* ids = NULL;
+    hg_size_t remote_column, column_size, buf_size = 0;
+    size_t count;
+    int num_columns = !!(in.columns & SYMBIOMON_COLUMN_VAL)
+                    + !!(in.columns & SYMBIOMON_COLUMN_TIME)
+                    + !!(in.columns & SYMBIOMON_COLUMN_SAMPLE_ID);
+    if(num_columns == 0 || (uint64_t)in.count > SIZE_MAX/(3*sizeof(double))) {
+        out.ret = SYMBIOMON_ERR_INVALID_ARGS;
+        goto finish;
+    }
+    if(in.count == 0) {
+        out.ret = SYMBIOMON_SUCCESS;
+        goto finish;
+    }
+    remote_column = in.count*sizeof(double);
+
+    ABT_mutex_lock(metric->metric_mutex);
+    symbiomon_metric_materialize(metric);
+    ABT_mutex_unlock(metric->metric_mutex);
+
+    count = retained_samples(metric);
+    if(count > (uint64_t)in.count) count = in.count;
+    column_size = (count ? count : 1)*sizeof(double);
+
+    /* columnar series are pushed straight from the ring, one column of
+     * the chunks at a time, and copied if a writer tore some of them
+     * (see symbiomon_metric_fetch_ult) */
+    if(metric->num_shards == 0 && metric->series.layout == SYMBIOMON_LAYOUT_COLUMNS) {
+        static const uint32_t column_flags[3] = {
+            SYMBIOMON_COLUMN_VAL, SYMBIOMON_COLUMN_TIME, SYMBIOMON_COLUMN_SAMPLE_ID
+        };
+        uint64_t first;
+        size_t n = last_window(&metric->series, count, &first);
+        int c;
+        for(c = 0; c < 3; c++) {
+            if(!(in.columns & column_flags[c])) continue;
+            hret = push_series(mid, info->addr, in.bulk, buf_size, &metric->series, first, n,
+                    sizeof(double), c*SYMBIOMON_CHUNK_SIZE*sizeof(double));
+            if(hret != HG_SUCCESS) {
+                margo_info(provider->mid, "Could not push samples (mercury error %d)", hret);
+                out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+                goto finish;
+            }
+            buf_size += remote_column;
+        }
+        if(!symbiomon_series_torn(&metric->series, first, n)) {
+            out.actual_count = n;
+            out.ret = SYMBIOMON_SUCCESS;
+            goto finish;
+        }
+        buf_size = 0;
+    }
+
+    b = calloc(num_columns, column_size);
+    if(!b) {
+        out.ret = SYMBIOMON_ERR_ALLOCATION;
+        goto finish;
+    }
+    if(in.columns & SYMBIOMON_COLUMN_VAL) {
+        vals = (double*)(b + buf_size);
+        buf_size += column_size;
+    }
+    if(in.columns & SYMBIOMON_COLUMN_TIME) {
+        times = (double*)(b + buf_size);
+        buf_size += column_size;
+    }
+    if(in.columns & SYMBIOMON_COLUMN_SAMPLE_ID) {
+        ids = (uint64_t*)(b + buf_size);
+        buf_size += column_size;
+    }
+
+    /* copyout the last count samples, column by column */
+    if(metric->num_shards == 0) {
+        uint64_t first;
+        size_t n = last_window(&metric->series, count, &first);
+        out.actual_count = symbiomon_series_copy_columns(&metric->series, first, n, vals, times, ids);
+    } else {
+        /* shards are merged by timestamp before being split into columns */
+        symbiomon_metric_buffer rows = (symbiomon_metric_buffer)malloc((count ? count : 1)*sizeof(*rows));
+        int64_t i;
+        out.actual_count = rows ? symbiomon_provider_metric_copy_last(metric, count, rows) : 0;
+        for(i = 0; i < out.actual_count; i++) {
+            if(vals)  vals[i]  = rows[i].val;
+            if(times) times[i] = rows[i].time;
+            if(ids)   ids[i]   = rows[i].sample_id;
+        }
+        free(rows);
+    }
+
+    hret = margo_bulk_create(mid, 1, (void**)&b, &buf_size, HG_BULK_READ_ONLY, &local_bulk);
+    if(hret != HG_SUCCESS) {
+        margo_info(provider->mid, "Could not create bulk_handle (mercury error %d)", hret);
+        out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    /* do the bulk transfers, one per column since the strides differ */
+    int c;
+    for(c = 0; c < num_columns && out.actual_count; c++) {
+        hret = margo_bulk_transfer(mid, HG_BULK_PUSH, info->addr, in.bulk, c*remote_column,
+                local_bulk, c*column_size, out.actual_count*sizeof(double));
+        if(hret != HG_SUCCESS) {
+            margo_info(provider->mid, "Could not create bulk_handle (mercury error %d)", hret);
+            out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+            goto finish;
+        }
+    }
+
+    /* set the response */
+    out.ret = SYMBIOMON_SUCCESS;
+
+finish:
+    free(b);
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+    if(local_bulk != HG_BULK_NULL)
+        margo_bulk_free(local_bulk);
+}
+static DEFINE_MARGO_RPC_HANDLER(symbiomon_metric_fetch_columns_ult)
+
+static void symbiomon_metric_expose_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    metric_expose_in_t  in;
+    metric_expose_out_t out;
+    out.capacity = 0;
+    out.chunk_size = SYMBIOMON_CHUNK_SIZE;
+    out.bulk = HG_BULK_NULL;
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    symbiomon_provider_t provider = (symbiomon_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_info(provider->mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    symbiomon_metric_id_t requested_id = in.metric_id;
+    symbiomon_metric* metric = find_metric(provider, &(requested_id));
+    if(!metric) {
+        out.ret = SYMBIOMON_ERR_INVALID_METRIC;
+	goto finish;
+    }
+
+    /* remote readers see the ring as it is laid out in memory, so samples
+     * split across shards or columns cannot be pulled directly */
+    if(metric->num_shards != 0 || metric->series.layout != SYMBIOMON_LAYOUT_ROWS) {
+        out.ret = SYMBIOMON_ERR_OP_UNSUPPORTED;
+        goto finish;
+    }
+
+    /* the region is registered once and shared by every client */
+    ABT_mutex_lock(metric->metric_mutex);
+    out.ret = SYMBIOMON_SUCCESS;
+    if(metric->exposed == HG_BULK_NULL)
+        out.ret = symbiomon_series_expose(&metric->series, mid, &metric->exposed);
+    ABT_mutex_unlock(metric->metric_mutex);
+    if(out.ret != SYMBIOMON_SUCCESS)
+        goto finish;
+
+    out.capacity = metric->series.capacity;
+    out.bulk = metric->exposed;
+
+finish:
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(symbiomon_metric_expose_ult)
+
+/* range [first, end) of the retained samples of a series taken between
+ * t0 and t1 (both included, unless after_t0 excludes t0) */
+static void time_window(const symbiomon_series* s, double t0, int after_t0, double t1, uint64_t* first, uint64_t* end)
+{
+    size_t len = last_window(s, SIZE_MAX, first);
+    *end = *first + len;
+    *end = symbiomon_series_after(s, *first, *end, t1);
+    *first = after_t0 ? symbiomon_series_after(s, *first, *end, t0)
+                      : symbiomon_series_from(s, *first, *end, t0);
+}
+
+/* number of retained samples of a metric taken between t0 and t1 */
+static size_t time_range_samples(symbiomon_metric* m, double t0, int after_t0, double t1)
+{
+    size_t i, total = 0;
+    uint64_t first, end;
+    for(i = 0; i <= m->num_shards; i++) {
+        time_window(symbiomon_metric_series(m, i), t0, after_t0, t1, &first, &end);
+        total += end - first;
+    }
+    return total;
+}
+
+/*
+ * Oldest samples taken between t0 and t1 (see time_window), at most n of
+ * them, merged across the metric's series. Returns the number of samples
+ * copied.
+ */
+static size_t copy_time_range(symbiomon_metric* m, double t0, int after_t0, double t1, size_t n, symbiomon_metric_sample* out)
+{
+    size_t i, total = 0, num_series = m->num_shards + 1;
+    const symbiomon_series* series[num_series];
+    uint64_t first[num_series], end[num_series];
+
+    for(i = 0; i < num_series; i++) {
+        series[i] = symbiomon_metric_series(m, i);
+        time_window(series[i], t0, after_t0, t1, &first[i], &end[i]);
+        total += end[i] - first[i];
+    }
+    if(num_series == 1)
+        return symbiomon_series_copy(series[0], first[0], n < total ? n : total, out);
+    if(total <= n)
+        return symbiomon_series_merge(series, first, end, num_series, total, out);
+
+    /* the merge keeps the most recent samples, the oldest ones are wanted */
+    symbiomon_metric_buffer all = (symbiomon_metric_buffer)malloc(total*sizeof(*all));
+    if(!all) return 0;
+    total = symbiomon_series_merge(series, first, end, num_series, total, all);
+    if(n > total) n = total;
+    memcpy(out, all, n*sizeof(*out));
+    free(all);
+    return n;
+}
+
+/*
+ * Oldest samples following a time cursor, at most n of them: those taken
+ * after *since, plus those taken at *since beyond the first *seen ones.
+ * Samples of a batch update share their timestamp, so a reply cut in the
+ * middle of a batch has to resume inside it. Moves the cursor past the
+ * samples copied and returns their number.
+ */
+static size_t copy_after_cursor(symbiomon_metric* m, double* since, uint64_t* seen, size_t n, symbiomon_metric_sample* out)
+{
+    size_t i, tail, skip = 0, got;
+    uint64_t first, end;
+    symbiomon_metric_buffer b = out;
+
+    for(i = 0; i <= m->num_shards; i++) {
+        time_window(symbiomon_metric_series(m, i), *since, 0, *since, &first, &end);
+        skip += end - first;
+    }
+    if(skip > *seen) skip = *seen;
+    if(skip) {
+        b = (symbiomon_metric_buffer)malloc((n + skip)*sizeof(*b));
+        if(!b) return 0;
+    }
+    got = copy_time_range(m, *since, 0, INFINITY, n + skip, b);
+    /* samples at *since come first, the seen ones may have been overwritten */
+    for(i = 0; i < skip && i < got && b[i].time == *since; i++);
+    skip = i;
+    got -= skip;
+    if(b != out) {
+        memcpy(out, b + skip, got*sizeof(*out));
+        free(b);
+    }
+    if(!got)
+        return 0;
+
+    for(tail = 1; tail < got && out[got-1-tail].time == out[got-1].time; tail++);
+    if(out[got-1].time == *since)
+        *seen = skip + tail;
+    else
+        *seen = tail;
+    *since = out[got-1].time;
+    return got;
+}
+
+static void symbiomon_metric_fetch_since_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    metric_fetch_since_in_t  in;
+    metric_fetch_since_out_t out;
+    hg_bulk_t local_bulk = HG_BULK_NULL;
+    symbiomon_metric_buffer b = NULL;
+    out.actual_count = 0;
+    out.skipped = 0;
+    out.dropped = 0;
+    out.next_cursor = 0;
+    out.next_since = 0.0;
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    symbiomon_provider_t provider = (symbiomon_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_info(provider->mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+        goto finish;
+    }
+    out.next_cursor = in.cursor;
+    out.next_since = in.since;
+
+    if(in.count < 0) {
+        out.ret = SYMBIOMON_ERR_INVALID_ARGS;
+        goto finish;
+    }
+
+    symbiomon_metric_id_t requested_id = in.metric_id;
+    symbiomon_metric* metric = find_metric(provider, &(requested_id));
+    if(!metric) {
+        out.ret = SYMBIOMON_ERR_INVALID_METRIC;
+	goto finish;
+    }
+
+    /* sequence numbers are per series, they cannot address merged shards */
+    if(!in.by_time && metric->num_shards != 0) {
+        out.ret = SYMBIOMON_ERR_OP_UNSUPPORTED;
+        goto finish;
+    }
+
+    ABT_mutex_lock(metric->metric_mutex);
+    symbiomon_metric_materialize(metric);
+    ABT_mutex_unlock(metric->metric_mutex);
+
+    if(!in.by_time) {
+        /* samples between the cursor and the oldest retained one are lost */
+        uint64_t first;
+        size_t n = last_window(&metric->series, SIZE_MAX, &first);
+        uint64_t end = first + n;
+        if(in.cursor > first) first = in.cursor < end ? in.cursor : end;
+        else out.dropped = first - in.cursor;
+        n = end - first;
+        if(n > (uint64_t)in.count) n = in.count;
+        out.next_cursor = first + n;
+
+        if(metric->series.layout == SYMBIOMON_LAYOUT_ROWS) {
+            /* pushed straight from the ring (see symbiomon_metric_fetch_ult) */
+            hret = push_series(mid, info->addr, in.bulk, 0, &metric->series, first, n,
+                    sizeof(symbiomon_metric_sample), 0);
+            if(hret != HG_SUCCESS) {
+                margo_info(provider->mid, "Could not push samples (mercury error %d)", hret);
+                out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+                goto finish;
+            }
+            out.skipped = symbiomon_series_torn(&metric->series, first, n);
+            out.actual_count = n - out.skipped;
+            out.dropped += out.skipped;
+            out.ret = SYMBIOMON_SUCCESS;
+            goto finish;
+        }
+        b = (symbiomon_metric_buffer)calloc(n ? n : 1, sizeof(*b));
+        if(!b) {
+            out.ret = SYMBIOMON_ERR_ALLOCATION;
+            goto finish;
+        }
+        out.actual_count = symbiomon_series_copy(&metric->series, first, n, b);
+        out.dropped += n - out.actual_count;
+    } else {
+        /* a timestamp does not tell how many samples were overwritten,
+         * dropped is left at 0 */
+        size_t n = retained_samples(metric);
+        if(n > (uint64_t)in.count) n = in.count;
+        b = (symbiomon_metric_buffer)calloc(n ? n : 1, sizeof(*b));
+        if(!b) {
+            out.ret = SYMBIOMON_ERR_ALLOCATION;
+            goto finish;
+        }
+        out.actual_count = copy_after_cursor(metric, &out.next_since, &out.next_cursor, n, b);
+    }
+
+    if(out.actual_count) {
+        hg_size_t buf_size = out.actual_count*sizeof(symbiomon_metric_sample);
+        hret = margo_bulk_create(mid, 1, (void**)&b, &buf_size, HG_BULK_READ_ONLY, &local_bulk);
+        if(hret != HG_SUCCESS) {
+            margo_info(provider->mid, "Could not create bulk_handle (mercury error %d)", hret);
+            out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+            goto finish;
+        }
+        hret = margo_bulk_transfer(mid, HG_BULK_PUSH, info->addr, in.bulk, 0, local_bulk, 0, buf_size);
+        if(hret != HG_SUCCESS) {
+            margo_info(provider->mid, "Could not push samples (mercury error %d)", hret);
+            out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+            goto finish;
+        }
+    }
+
+    /* set the response */
+    out.ret = SYMBIOMON_SUCCESS;
+
+finish:
+    free(b);
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+    if(local_bulk != HG_BULK_NULL)
+        margo_bulk_free(local_bulk);
+}
+static DEFINE_MARGO_RPC_HANDLER(symbiomon_metric_fetch_since_ult)
+
+static void symbiomon_metric_fetch_range_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    metric_fetch_range_in_t  in;
+    metric_fetch_out_t out;
+    hg_bulk_t local_bulk = HG_BULK_NULL;
+    symbiomon_metric_buffer b = NULL;
+    out.actual_count = 0;
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    symbiomon_provider_t provider = (symbiomon_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_info(provider->mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    if(in.count < 0) {
+        out.ret = SYMBIOMON_ERR_INVALID_ARGS;
+        goto finish;
+    }
+
+    symbiomon_metric_id_t requested_id = in.metric_id;
+    symbiomon_metric* metric = find_metric(provider, &(requested_id));
+    if(!metric) {
+        out.ret = SYMBIOMON_ERR_INVALID_METRIC;
+	goto finish;
+    }
+
+    ABT_mutex_lock(metric->metric_mutex);
+    symbiomon_metric_materialize(metric);
+    ABT_mutex_unlock(metric->metric_mutex);
+
+    /* a single row series is searched and pushed in place, and copied
+     * if a writer tore some of it (see symbiomon_metric_fetch_ult) */
+    if(metric->num_shards == 0 && metric->series.layout == SYMBIOMON_LAYOUT_ROWS) {
+        uint64_t first, end;
+        time_window(&metric->series, in.t0, 0, in.t1, &first, &end);
+        size_t n = end - first;
+        if(n > (uint64_t)in.count) n = in.count;
+        hret = push_series(mid, info->addr, in.bulk, 0, &metric->series, first, n,
+                sizeof(symbiomon_metric_sample), 0);
+        if(hret != HG_SUCCESS) {
+            margo_info(provider->mid, "Could not push samples (mercury error %d)", hret);
+            out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+            goto finish;
+        }
+        if(!symbiomon_series_torn(&metric->series, first, n)) {
+            out.actual_count = n;
+            out.ret = SYMBIOMON_SUCCESS;
+            goto finish;
+        }
+    }
+
+    size_t count = time_range_samples(metric, in.t0, 0, in.t1);
+    if(count > (uint64_t)in.count) count = in.count;
+    b = (symbiomon_metric_buffer)calloc(count ? count : 1, sizeof(*b));
+    if(!b) {
+        out.ret = SYMBIOMON_ERR_ALLOCATION;
+        goto finish;
+    }
+    out.actual_count = copy_time_range(metric, in.t0, 0, in.t1, count, b);
+
+    if(out.actual_count) {
+        hg_size_t buf_size = out.actual_count*sizeof(symbiomon_metric_sample);
+        hret = margo_bulk_create(mid, 1, (void**)&b, &buf_size, HG_BULK_READ_ONLY, &local_bulk);
+        if(hret != HG_SUCCESS) {
+            margo_info(provider->mid, "Could not create bulk_handle (mercury error %d)", hret);
+            out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+            goto finish;
+        }
+        hret = margo_bulk_transfer(mid, HG_BULK_PUSH, info->addr, in.bulk, 0, local_bulk, 0, buf_size);
+        if(hret != HG_SUCCESS) {
+            margo_info(provider->mid, "Could not push samples (mercury error %d)", hret);
+            out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+            goto finish;
+        }
+    }
+
+    /* set the response */
+    out.ret = SYMBIOMON_SUCCESS;
+
+finish:
+    free(b);
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+    if(local_bulk != HG_BULK_NULL)
+        margo_bulk_free(local_bulk);
+}
+static DEFINE_MARGO_RPC_HANDLER(symbiomon_metric_fetch_range_ult)
+
+static void symbiomon_metric_fetch_downsampled_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    metric_fetch_downsampled_in_t  in;
+    metric_fetch_out_t out;
+    hg_bulk_t local_bulk = HG_BULK_NULL;
+    symbiomon_metric_buffer all = NULL, b = NULL;
+    size_t i, total = 0;
+    out.actual_count = 0;
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    symbiomon_provider_t provider = (symbiomon_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_info(provider->mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    if(in.count <= 0 || in.mode > SYMBIOMON_DOWNSAMPLE_LTTB) {
+        out.ret = SYMBIOMON_ERR_INVALID_ARGS;
+        goto finish;
+    }
+
+    symbiomon_metric_id_t requested_id = in.metric_id;
+    symbiomon_metric* metric = find_metric(provider, &(requested_id));
+    if(!metric) {
+        out.ret = SYMBIOMON_ERR_INVALID_METRIC;
+	goto finish;
+    }
+
+    ABT_mutex_lock(metric->metric_mutex);
+    symbiomon_metric_materialize(metric);
+    total = metric->history.num_samples;
+    ABT_mutex_unlock(metric->metric_mutex);
+
+    /* the whole retained history is gathered, oldest first, and only
+     * the downsampled points are sent back */
+    for(i = 0; i <= metric->num_shards; i++)
+        total += symbiomon_series_size(symbiomon_metric_series(metric, i));
+    all = (symbiomon_metric_buffer)malloc((total ? total : 1)*sizeof(*all));
+    if(!all) {
+        out.ret = SYMBIOMON_ERR_ALLOCATION;
+        goto finish;
+    }
+    total = symbiomon_provider_metric_copy_last(metric, total, all);
+
+    /* both kernels return all the samples when asked for more */
+    size_t count = total < (uint64_t)in.count ? total : (size_t)in.count;
+    b = (symbiomon_metric_buffer)malloc((count ? count : 1)*sizeof(*b));
+    if(!b) {
+        out.ret = SYMBIOMON_ERR_ALLOCATION;
+        goto finish;
+    }
+    if(in.mode == SYMBIOMON_DOWNSAMPLE_LTTB)
+        out.actual_count = symbiomon_downsample_lttb(all, total, count, b);
+    else
+        out.actual_count = symbiomon_downsample_buckets(all, total, count, in.mode, b);
+
+    if(out.actual_count) {
+        hg_size_t buf_size = out.actual_count*sizeof(symbiomon_metric_sample);
+        hret = margo_bulk_create(mid, 1, (void**)&b, &buf_size, HG_BULK_READ_ONLY, &local_bulk);
+        if(hret != HG_SUCCESS) {
+            margo_info(provider->mid, "Could not create bulk_handle (mercury error %d)", hret);
+            out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+            goto finish;
+        }
+        hret = margo_bulk_transfer(mid, HG_BULK_PUSH, info->addr, in.bulk, 0, local_bulk, 0, buf_size);
+        if(hret != HG_SUCCESS) {
+            margo_info(provider->mid, "Could not push samples (mercury error %d)", hret);
+            out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+            goto finish;
+        }
+    }
+
+    /* set the response */
+    out.ret = SYMBIOMON_SUCCESS;
+
+finish:
+    free(all);
+    free(b);
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+    if(local_bulk != HG_BULK_NULL)
+        margo_bulk_free(local_bulk);
+}
+static DEFINE_MARGO_RPC_HANDLER(symbiomon_metric_fetch_downsampled_ult)
+
+/* time a subscriber has to acknowledge a notification, and number of
+ * failed notifications in a row after which it is dropped */
+#define SUBSCRIBER_TIMEOUT_MS   1000.0
+#define SUBSCRIBER_MAX_FAILURES 3
+
+/* whether a subscriber follows a metric */
+static int subscriber_matches(const symbiomon_subscriber* sub, const symbiomon_metric* m)
+{
+    int i;
+    switch(sub->filter) {
+    case SYMBIOMON_SUBSCRIBE_METRIC:
+        return m->id == sub->metric_id;
+    case SYMBIOMON_SUBSCRIBE_NAMESPACE:
+        return strcmp(m->ns, sub->pattern) == 0;
+    case SYMBIOMON_SUBSCRIBE_TAG:
+        for(i = 0; m->taglist && i < m->taglist->num_tags; i++)
+            if(strcmp(m->taglist->taglist[i], sub->pattern) == 0)
+                return 1;
+        return 0;
+    }
+    return 0;
+}
+
+/*
+ * Pushes the samples recorded since the previous round to a subscriber,
+ * in notifications of at most batch_size samples, until it is caught up.
+ * Cursors only move once the subscriber has acknowledged a notification.
+ */
+static symbiomon_return_t notify_subscriber(symbiomon_subscriber* sub)
+{
+    symbiomon_provider_t provider = sub->provider;
+    symbiomon_subscription_cursor *c, *ctmp;
+    symbiomon_metric *m, *tmp;
+    notify_in_t in;
+    notify_out_t out;
+    hg_handle_t h;
+    hg_return_t hret;
+    symbiomon_return_t ret;
+    size_t i, n;
+
+    in.token   = sub->token;
+    in.ids     = sub->ids;
+    in.samples = sub->samples;
+    do {
+        in.count = 0;
+        /* metrics cannot be freed under the walk, lock order is
+         * metrics_mutex then metric_mutex */
+        ABT_mutex_lock(provider->metrics_mutex);
+        HASH_ITER(hh, provider->metrics, m, tmp) {
+            if(in.count == sub->batch_size) break;
+            if(!subscriber_matches(sub, m)) continue;
+            HASH_FIND(hh, sub->cursors, &m->id, sizeof(m->id), c);
+            if(!c) {
+                c = (symbiomon_subscription_cursor*)calloc(1, sizeof(*c));
+                if(!c) {
+                    ABT_mutex_unlock(provider->metrics_mutex);
+                    return SYMBIOMON_ERR_ALLOCATION;
+                }
+                c->id = m->id;
+                c->since = c->next = sub->start;
+                HASH_ADD(hh, sub->cursors, id, sizeof(c->id), c);
+            }
+            ABT_mutex_lock(m->metric_mutex);
+            symbiomon_metric_materialize(m);
+            ABT_mutex_unlock(m->metric_mutex);
+            /* next equals since here, it only moves within a round */
+            n = copy_after_cursor(m, &c->next, &c->next_seen, sub->batch_size - in.count, in.samples + in.count);
+            for(i = 0; i < n; i++)
+                in.ids[in.count + i] = m->id;
+            in.count += n;
+        }
+        ABT_mutex_unlock(provider->metrics_mutex);
+        if(in.count == 0)
+            return SYMBIOMON_SUCCESS;
+
+        hret = margo_create(provider->mid, sub->addr, provider->notify_id, &h);
+        if(hret != HG_SUCCESS)
+            return SYMBIOMON_ERR_FROM_MERCURY;
+        /* a slow subscriber only delays its own ULT, and not for long */
+        hret = margo_provider_forward_timed(sub->callback_provider_id, h, &in, SUBSCRIBER_TIMEOUT_MS);
+        if(hret == HG_SUCCESS)
+            hret = margo_get_output(h, &out);
+        if(hret != HG_SUCCESS) {
+            margo_destroy(h);
+            ret = SYMBIOMON_ERR_FROM_MERCURY;
+        } else {
+            ret = out.ret;
+            margo_free_output(h, &out);
+            margo_destroy(h);
+        }
+
+        HASH_ITER(hh, sub->cursors, c, ctmp) {
+            if(ret == SYMBIOMON_SUCCESS) {
+                c->since = c->next;
+                c->seen  = c->next_seen;
+            } else {
+                c->next      = c->since;
+                c->next_seen = c->seen;
+            }
+        }
+        if(ret != SYMBIOMON_SUCCESS)
+            return ret;
+    } while(in.count == sub->batch_size);
+    return SYMBIOMON_SUCCESS;
+}
+
+/* Pushes new samples to a subscriber every interval seconds until it is
+ * stopped or has failed SUBSCRIBER_MAX_FAILURES pushes in a row */
+static void subscriber_ult(void* arg)
+{
+    symbiomon_subscriber* sub = (symbiomon_subscriber*)arg;
+    symbiomon_provider_t provider = sub->provider;
+    symbiomon_return_t ret;
+    struct timeval now;
+    struct timespec deadline;
+    double t;
+
+    ABT_mutex_lock(provider->subscribers_mutex);
+    while(!sub->stop) {
+        gettimeofday(&now, NULL);
+        t = now.tv_sec + now.tv_usec*1e-6 + sub->interval;
+        deadline.tv_sec  = (time_t)t;
+        deadline.tv_nsec = (long)((t - (double)deadline.tv_sec)*1e9);
+        ABT_cond_timedwait(sub->cond, provider->subscribers_mutex, &deadline);
+        if(sub->stop) break;
+        ABT_mutex_unlock(provider->subscribers_mutex);
+        ret = notify_subscriber(sub);
+        ABT_mutex_lock(provider->subscribers_mutex);
+        if(ret == SYMBIOMON_SUCCESS) {
+            sub->failures = 0;
+        } else if(ret == SYMBIOMON_ERR_INVALID_TOKEN || ++sub->failures >= SUBSCRIBER_MAX_FAILURES) {
+            margo_info(provider->mid, "Dropping subscriber %lu (error %d)", (unsigned long)sub->id, ret);
+            sub->stop = 1;
+        }
+    }
+    ABT_mutex_unlock(provider->subscribers_mutex);
+}
+
+static void free_subscriber(symbiomon_subscriber* sub)
+{
+    symbiomon_subscription_cursor *c, *tmp;
+    HASH_ITER(hh, sub->cursors, c, tmp) {
+        HASH_DEL(sub->cursors, c);
+        free(c);
+    }
+    if(sub->cond != ABT_COND_NULL)
+        ABT_cond_free(&sub->cond);
+    if(sub->addr != HG_ADDR_NULL)
+        margo_addr_free(sub->provider->mid, sub->addr);
+    free(sub->ids);
+    free(sub->samples);
+    free(sub);
+}
+
+/* Stops, joins and frees a list of subscribers already unlinked from
+ * the provider */
+static void stop_subscribers(
+        symbiomon_subscriber* list)
+{
+    symbiomon_subscriber* sub;
+    while((sub = list)) {
+        list = sub->next;
+        ABT_mutex_lock(sub->provider->subscribers_mutex);
+        sub->stop = 1;
+        ABT_cond_signal(sub->cond);
+        ABT_mutex_unlock(sub->provider->subscribers_mutex);
+        ABT_thread_join(sub->ult);
+        ABT_thread_free(&sub->ult);
+        free_subscriber(sub);
+    }
+}
+
+/* Unlinks the subscribers that stopped themselves; must be called with
+ * the subscribers mutex held. Returns them as a list for stop_subscribers. */
+static symbiomon_subscriber* unlink_stopped_subscribers(symbiomon_provider_t provider)
+{
+    symbiomon_subscriber *stopped = NULL, **p = &provider->subscribers;
+    while(*p) {
+        symbiomon_subscriber* sub = *p;
+        if(sub->stop) {
+            *p = sub->next;
+            sub->next = stopped;
+            stopped = sub;
+            provider->num_subscribers -= 1;
+        } else {
+            p = &sub->next;
+        }
+    }
+    return stopped;
+}
+
+static void symbiomon_subscribe_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    subscribe_in_t  in;
+    subscribe_out_t out;
+    symbiomon_subscriber* sub = NULL;
+    symbiomon_subscriber* stopped;
+    out.id = 0;
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    symbiomon_provider_t provider = (symbiomon_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_info(provider->mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    if(in.filter > SYMBIOMON_SUBSCRIBE_TAG || !(in.interval > 0.0)
+    || in.batch_size == 0 || in.batch_size > METRIC_BUFFER_SIZE
+    || (in.filter != SYMBIOMON_SUBSCRIBE_METRIC && (!in.pattern || strlen(in.pattern) >= sizeof(sub->pattern)))) {
+        out.ret = SYMBIOMON_ERR_INVALID_ARGS;
+        goto finish;
+    }
+
+    sub = (symbiomon_subscriber*)calloc(1, sizeof(*sub));
+    if(!sub) {
+        out.ret = SYMBIOMON_ERR_ALLOCATION;
+        goto finish;
+    }
+    sub->provider   = provider;
+    sub->token      = in.token;
+    sub->callback_provider_id = in.callback_provider_id;
+    sub->filter     = in.filter;
+    sub->metric_id  = in.metric_id;
+    if(in.filter != SYMBIOMON_SUBSCRIBE_METRIC)
+        strcpy(sub->pattern, in.pattern);
+    sub->interval   = in.interval;
+    sub->batch_size = in.batch_size;
+    sub->start      = ABT_get_wtime();
+    sub->addr       = HG_ADDR_NULL;
+    sub->cond       = ABT_COND_NULL;
+    sub->ids     = (symbiomon_metric_id_t*)malloc(in.batch_size*sizeof(*sub->ids));
+    sub->samples = (symbiomon_metric_sample*)malloc(in.batch_size*sizeof(*sub->samples));
+    if(!sub->ids || !sub->samples) {
+        out.ret = SYMBIOMON_ERR_ALLOCATION;
+        goto finish;
+    }
+    hret = margo_addr_dup(mid, info->addr, &sub->addr);
+    if(hret != HG_SUCCESS) {
+        out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+        goto finish;
+    }
+    ABT_cond_create(&sub->cond);
+
+    ABT_mutex_lock(provider->subscribers_mutex);
+    stopped = unlink_stopped_subscribers(provider);
+    if(provider->num_subscribers >= provider->max_subscribers) {
+        ABT_mutex_unlock(provider->subscribers_mutex);
+        stop_subscribers(stopped);
+        out.ret = SYMBIOMON_ERR_OP_FORBIDDEN;
+        goto finish;
+    }
+    ABT_pool pool = provider->pool;
+    if(pool == ABT_POOL_NULL)
+        margo_get_handler_pool(provider->mid, &pool);
+    if(ABT_thread_create(pool, subscriber_ult, sub, ABT_THREAD_ATTR_NULL, &sub->ult) != ABT_SUCCESS) {
+        ABT_mutex_unlock(provider->subscribers_mutex);
+        stop_subscribers(stopped);
+        out.ret = SYMBIOMON_ERR_FROM_ARGOBOTS;
+        goto finish;
+    }
+    sub->id = ++provider->next_subscriber_id;
+    sub->next = provider->subscribers;
+    provider->subscribers = sub;
+    provider->num_subscribers += 1;
+    ABT_mutex_unlock(provider->subscribers_mutex);
+    stop_subscribers(stopped);
+
+    out.id = sub->id;
+    sub = NULL;
+    out.ret = SYMBIOMON_SUCCESS;
+
+finish:
+    if(sub)
+        free_subscriber(sub);
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(symbiomon_subscribe_ult)
+
+static void symbiomon_unsubscribe_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    unsubscribe_in_t  in;
+    unsubscribe_out_t out;
+    symbiomon_subscriber *stopped, **p;
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    symbiomon_provider_t provider = (symbiomon_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_info(provider->mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    /* a subscriber that stopped itself is reclaimed here as well, so
+     * unsubscribing from it still succeeds */
+    out.ret = SYMBIOMON_ERR_INVALID_TOKEN;
+    ABT_mutex_lock(provider->subscribers_mutex);
+    for(p = &provider->subscribers; *p; p = &(*p)->next) {
+        if((*p)->id == in.id) {
+            (*p)->stop = 1;
+            out.ret = SYMBIOMON_SUCCESS;
+            break;
+        }
+    }
+    stopped = unlink_stopped_subscribers(provider);
+    ABT_mutex_unlock(provider->subscribers_mutex);
+    stop_subscribers(stopped);
+
+finish:
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+}
+static DEFINE_MARGO_RPC_HANDLER(symbiomon_unsubscribe_ult)
+
+/* time of the oldest raw sample of a metric without shards, or +inf;
+ * must be called with the metric's mutex held */
+static double raw_oldest(symbiomon_metric* m)
+{
+    if(!symbiomon_series_size(&m->series))
+        return INFINITY;
+    return symbiomon_series_time(&m->series, symbiomon_series_first(&m->series));
+}
+
+/*
+ * Source answering a query from t0 with buckets of at most "resolution"
+ * seconds: -1 for the raw samples, otherwise a rollup tier. The coarsest
+ * source reaching back to t0 is picked or, if none does, the one reaching
+ * back the furthest. Must be called with the metric's mutex held.
+ */
+static int pick_rollup(symbiomon_metric* m, double t0, double resolution)
+{
+    double oldest = raw_oldest(m);
+    int i, best = -1, covers = oldest <= t0;
+    for(i = 0; i < (int)m->num_rollups && m->rollups[i].period <= resolution; i++) {
+        double o = symbiomon_rollup_tier_oldest(&m->rollups[i]);
+        if(o <= t0 || (!covers && o <= oldest)) {
+            best = i;
+            oldest = o;
+            covers = o <= t0;
+        }
+    }
+    return best;
+}
+
+symbiomon_return_t symbiomon_provider_metric_aggregate(symbiomon_metric_t m, double t0, double t1, symbiomon_metric_aggregate* out)
+{
+    size_t i, total = 0, num_series = m->num_shards + 1;
+    symbiomon_series* series[num_series];
+    uint64_t first[num_series], end[num_series];
+    symbiomon_summary s;
+    double* vals = NULL;
+
+    ABT_mutex_lock(m->metric_mutex);
+    symbiomon_metric_materialize(m);
+    /* once the raw samples no longer reach back to t0, the finest rollup
+     * tier that does answers instead, without variance nor percentiles */
+    if(m->num_rollups && raw_oldest(m) > t0) {
+        symbiomon_rollup r;
+        for(i = 0; i + 1 < m->num_rollups && symbiomon_rollup_tier_oldest(&m->rollups[i]) > t0; i++);
+        if(symbiomon_rollup_tier_oldest(&m->rollups[i]) < raw_oldest(m)) {
+            symbiomon_rollup_tier_summarize(&m->rollups[i], t0, t1, &r);
+            ABT_mutex_unlock(m->metric_mutex);
+            out->stats.count    = r.count;
+            out->stats.sum      = r.sum;
+            out->stats.min      = r.min;
+            out->stats.max      = r.max;
+            out->stats.mean     = r.count ? r.sum/r.count : 0.0;
+            out->stats.variance = NAN;
+            out->p50 = out->p90 = out->p99 = NAN;
+            return SYMBIOMON_SUCCESS;
+        }
+    }
+    ABT_mutex_unlock(m->metric_mutex);
+
+    /* moments come from the same kernels as the reductions */
+    symbiomon_summary_init(&s);
+    for(i = 0; i < num_series; i++) {
+        series[i] = symbiomon_metric_series(m, i);
+        time_window(series[i], t0, 0, t1, &first[i], &end[i]);
+        symbiomon_series_summarize(series[i], first[i], end[i], &s);
+        total += end[i] - first[i];
+    }
+
+    memset(out, 0, sizeof(*out));
+    out->stats.count    = s.count;
+    out->stats.sum      = s.sum;
+    out->stats.min      = s.count ? s.min : 0.0;
+    out->stats.max      = s.count ? s.max : 0.0;
+    out->stats.mean     = s.mean;
+    out->stats.variance = symbiomon_summary_variance(&s);
+    if(total == 0)
+        return SYMBIOMON_SUCCESS;
+
+    /* percentiles need the values themselves */
+    vals = (double*)malloc(total*sizeof(*vals));
+    if(!vals)
+        return SYMBIOMON_ERR_ALLOCATION;
+    total = 0;
+    for(i = 0; i < num_series; i++)
+        total += symbiomon_series_copy_columns(series[i], first[i], end[i] - first[i], vals + total, NULL, NULL);
+    if(total) {
+        out->p50 = symbiomon_quantile(vals, total, 0.50);
+        out->p90 = symbiomon_quantile(vals, total, 0.90);
+        out->p99 = symbiomon_quantile(vals, total, 0.99);
+    }
+    free(vals);
     return SYMBIOMON_SUCCESS;
 }
 
-symbiomon_return_t symbiomon_provider_metric_create(const char *ns, const char *name, symbiomon_metric_type_t t, const char *desc, symbiomon_taglist_t tl, symbiomon_metric_t* m, symbiomon_provider_t provider)
+static void symbiomon_metric_aggregate_ult(hg_handle_t h)
 {
-    if(!ns || !name)
-        return SYMBIOMON_ERR_INVALID_NAME;
+    hg_return_t hret;
+    metric_aggregate_in_t  in;
+    metric_aggregate_out_t out;
+    memset(&out.aggregate, 0, sizeof(out.aggregate));
 
-    /* create an id for the new metric */
-    symbiomon_metric_id_t id;
-    symbiomon_id_from_string_identifiers(ns, name, tl->taglist, tl->num_tags, &id);
-    int i;
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
 
-    symbiomon_metric* existing = find_metric(provider, &(id));
-    if(existing) {
-        *m = existing;
-        return SYMBIOMON_ERR_METRIC_EXISTS;
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    symbiomon_provider_t provider = (symbiomon_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_info(provider->mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+        goto finish;
     }
 
-    /* allocate a metric, set it up, and add it to the provider */
-    symbiomon_metric* metric = (symbiomon_metric*)calloc(1, sizeof(*metric));
-    ABT_mutex_create(&metric->metric_mutex);
-    metric->id  = id;
-    strcpy(metric->name, name);
-    strcpy(metric->ns, ns);
-    strcpy(metric->desc, desc);
-    metric->type = t;
-    metric->taglist = tl;
-    metric->buffer_index = 0;
-    metric->buffer = (symbiomon_metric_buffer)calloc(METRIC_BUFFER_SIZE, sizeof(symbiomon_metric_sample));
-    add_metric(provider, metric);
+    symbiomon_metric_id_t requested_id = in.metric_id;
+    symbiomon_metric* metric = find_metric(provider, &(requested_id));
+    if(!metric) {
+        out.ret = SYMBIOMON_ERR_INVALID_METRIC;
+	goto finish;
+    }
 
-    *m = metric;
-    //fprintf(stderr, "Created metric with id: %lu and name: %s\n", metric->id, name);
+    out.ret = symbiomon_provider_metric_aggregate(metric, in.t0, in.t1, &out.aggregate);
 
-    return SYMBIOMON_SUCCESS;
+finish:
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
 }
+static DEFINE_MARGO_RPC_HANDLER(symbiomon_metric_aggregate_ult)
 
-static void symbiomon_metric_fetch_ult(hg_handle_t h)
+static void symbiomon_metric_fetch_rollup_ult(hg_handle_t h)
 {
     hg_return_t hret;
-    metric_fetch_in_t  in;
-    metric_fetch_out_t out;
-    hg_bulk_t local_bulk;
+    metric_fetch_rollup_in_t  in;
+    metric_fetch_rollup_out_t out;
+    hg_bulk_t local_bulk = HG_BULK_NULL;
+    symbiomon_rollup* b = NULL;
+    symbiomon_metric_buffer samples = NULL;
+    int64_t i;
+    int tier;
+    out.actual_count = 0;
+    out.period = 0.0;
 
     /* find the margo instance */
     margo_instance_id mid = margo_hg_handle_get_instance(h);
@@ -273,13 +1900,105 @@ static void symbiomon_metric_fetch_ult(hg_handle_t h)
         goto finish;
     }
 
-    /* create a bulk region */
-    symbiomon_metric_buffer b = calloc(in.count, sizeof(symbiomon_metric_sample));
-    hg_size_t buf_size = in.count * sizeof(symbiomon_metric_sample);
-    hret = margo_bulk_create(mid, 1, (void**)&b, &buf_size, HG_BULK_READ_ONLY, &local_bulk);
+    if(in.count <= 0 || in.t1 < in.t0) {
+        out.ret = SYMBIOMON_ERR_INVALID_ARGS;
+        goto finish;
+    }
+
+    symbiomon_metric_id_t requested_id = in.metric_id;
+    symbiomon_metric* metric = find_metric(provider, &(requested_id));
+    if(!metric) {
+        out.ret = SYMBIOMON_ERR_INVALID_METRIC;
+	goto finish;
+    }
+
+    /* buffers are sized by the retained buckets or samples, at most */
+    size_t count = 0;
+    ABT_mutex_lock(metric->metric_mutex);
+    symbiomon_metric_materialize(metric);
+    tier = pick_rollup(metric, in.t0, in.resolution);
+    if(tier >= 0) {
+        count = metric->rollups[tier].retention;
+        if(count > (uint64_t)in.count) count = in.count;
+        b = (symbiomon_rollup*)malloc((count ? count : 1)*sizeof(*b));
+        out.period = metric->rollups[tier].period;
+        if(b) out.actual_count = symbiomon_rollup_tier_copy(&metric->rollups[tier], in.t0, in.t1, count, b);
+    }
+    ABT_mutex_unlock(metric->metric_mutex);
+    if(tier >= 0 && !b) {
+        out.ret = SYMBIOMON_ERR_ALLOCATION;
+        goto finish;
+    }
+
+    /* raw samples are sent as buckets of a single sample */
+    if(tier < 0) {
+        count = time_range_samples(metric, in.t0, 0, in.t1);
+        if(count > (uint64_t)in.count) count = in.count;
+        b = (symbiomon_rollup*)malloc((count ? count : 1)*sizeof(*b));
+        samples = (symbiomon_metric_buffer)malloc((count ? count : 1)*sizeof(*samples));
+        if(!b || !samples) {
+            out.ret = SYMBIOMON_ERR_ALLOCATION;
+            goto finish;
+        }
+        out.actual_count = copy_time_range(metric, in.t0, 0, in.t1, count, samples);
+        for(i = 0; i < out.actual_count; i++) {
+            b[i].time  = samples[i].time;
+            b[i].count = 1;
+            b[i].sum   = samples[i].val;
+            b[i].min   = samples[i].val;
+            b[i].max   = samples[i].val;
+        }
+    }
+
+    if(out.actual_count) {
+        hg_size_t buf_size = out.actual_count*sizeof(*b);
+        hret = margo_bulk_create(mid, 1, (void**)&b, &buf_size, HG_BULK_READ_ONLY, &local_bulk);
+        if(hret != HG_SUCCESS) {
+            margo_info(provider->mid, "Could not create bulk_handle (mercury error %d)", hret);
+            out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+            goto finish;
+        }
+        hret = margo_bulk_transfer(mid, HG_BULK_PUSH, info->addr, in.bulk, 0, local_bulk, 0, buf_size);
+        if(hret != HG_SUCCESS) {
+            margo_info(provider->mid, "Could not push buckets (mercury error %d)", hret);
+            out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+            goto finish;
+        }
+    }
+
+    /* set the response */
+    out.ret = SYMBIOMON_SUCCESS;
+
+finish:
+    free(b);
+    free(samples);
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+    if(local_bulk != HG_BULK_NULL)
+        margo_bulk_free(local_bulk);
+}
+static DEFINE_MARGO_RPC_HANDLER(symbiomon_metric_fetch_rollup_ult)
+
+static void symbiomon_metric_fetch_histogram_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    metric_fetch_histogram_in_t  in;
+    metric_fetch_histogram_out_t out;
+    hg_bulk_t local_bulk = HG_BULK_NULL;
+    symbiomon_histogram* hist = NULL;
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    symbiomon_provider_t provider = (symbiomon_provider_t)margo_registered_data(mid, info->id);
 
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
     if(hret != HG_SUCCESS) {
-        margo_info(provider->mid, "Could not create bulk_handle (mercury error %d)", hret);
+        margo_info(provider->mid, "Could not deserialize output (mercury error %d)", hret);
         out.ret = SYMBIOMON_ERR_FROM_MERCURY;
         goto finish;
     }
@@ -290,35 +2009,209 @@ static void symbiomon_metric_fetch_ult(hg_handle_t h)
         out.ret = SYMBIOMON_ERR_INVALID_METRIC;
 	goto finish;
     }
+    if(!metric->histogram) {
+        out.ret = SYMBIOMON_ERR_OP_UNSUPPORTED;
+        goto finish;
+    }
 
-    /* copyout metric buffer of requested size */
-    if(metric->buffer_index < in.count) {
-        out.actual_count = metric->buffer_index;
-        memcpy(b, metric->buffer, out.actual_count*sizeof(symbiomon_metric_sample));
-    } else {
-	out.actual_count = in.count;
-        memcpy(b, metric->buffer + (metric->buffer_index - out.actual_count), out.actual_count*sizeof(symbiomon_metric_sample));
+    hist = (symbiomon_histogram*)malloc(sizeof(*hist));
+    if(!hist) {
+        out.ret = SYMBIOMON_ERR_ALLOCATION;
+        goto finish;
     }
+    ABT_mutex_lock(metric->metric_mutex);
+    *hist = *metric->histogram;
+    ABT_mutex_unlock(metric->metric_mutex);
 
-    /* do the bulk transfer */
-    hret = margo_bulk_transfer(mid, HG_BULK_PUSH, info->addr, in.bulk, 0, local_bulk, 0, buf_size);
+    hg_size_t buf_size = sizeof(*hist);
+    hret = margo_bulk_create(mid, 1, (void**)&hist, &buf_size, HG_BULK_READ_ONLY, &local_bulk);
     if(hret != HG_SUCCESS) {
         margo_info(provider->mid, "Could not create bulk_handle (mercury error %d)", hret);
         out.ret = SYMBIOMON_ERR_FROM_MERCURY;
         goto finish;
     }
+    hret = margo_bulk_transfer(mid, HG_BULK_PUSH, info->addr, in.bulk, 0, local_bulk, 0, buf_size);
+    if(hret != HG_SUCCESS) {
+        margo_info(provider->mid, "Could not push histogram (mercury error %d)", hret);
+        out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+        goto finish;
+    }
 
     /* set the response */
     out.ret = SYMBIOMON_SUCCESS;
 
 finish:
-    free(b);
+    free(hist);
     hret = margo_respond(h, &out);
     hret = margo_free_input(h, &in);
     margo_destroy(h);
-    margo_bulk_free(local_bulk);
+    if(local_bulk != HG_BULK_NULL)
+        margo_bulk_free(local_bulk);
+}
+static DEFINE_MARGO_RPC_HANDLER(symbiomon_metric_fetch_histogram_ult)
+
+/*
+ * Pushes the last samples of one metric of a multi-metric fetch at the
+ * given offset of the packed samples, and fills its index entry.
+ * staging is grown as needed for the metrics that must be copied first.
+ */
+static void push_multi_entry(margo_instance_id mid, hg_addr_t addr, hg_bulk_t remote, hg_size_t samples_offset,
+        symbiomon_metric* metric, size_t count, uint64_t offset, metric_fetch_index* index,
+        symbiomon_metric_buffer* staging, size_t* staging_size)
+{
+    hg_return_t hret;
+    hg_bulk_t local_bulk = HG_BULK_NULL;
+    hg_size_t remote_offset = samples_offset + offset*sizeof(symbiomon_metric_sample);
+
+    index->offset = offset;
+    index->count = 0;
+    index->skipped = 0;
+
+    ABT_mutex_lock(metric->metric_mutex);
+    symbiomon_metric_materialize(metric);
+    ABT_mutex_unlock(metric->metric_mutex);
+
+    /* the staging buffer never outgrows what the metric retains */
+    if(count > fetchable_samples(metric))
+        count = fetchable_samples(metric);
+
+    if(metric->num_shards == 0 && metric->series.layout == SYMBIOMON_LAYOUT_ROWS) {
+        uint64_t first;
+        size_t n = last_window(&metric->series, count, &first);
+        hret = push_series(mid, addr, remote, remote_offset, &metric->series, first, n,
+                sizeof(symbiomon_metric_sample), 0);
+        if(hret != HG_SUCCESS) {
+            index->ret = SYMBIOMON_ERR_FROM_MERCURY;
+            return;
+        }
+        index->skipped = symbiomon_series_torn(&metric->series, first, n);
+        index->count = n - index->skipped;
+        index->ret = SYMBIOMON_SUCCESS;
+        return;
+    }
+
+    if(*staging_size < count) {
+        symbiomon_metric_buffer b = (symbiomon_metric_buffer)realloc(*staging, count*sizeof(*b));
+        if(!b) {
+            index->ret = SYMBIOMON_ERR_ALLOCATION;
+            return;
+        }
+        *staging = b;
+        *staging_size = count;
+    }
+    index->count = symbiomon_provider_metric_copy_last(metric, count, *staging);
+    index->ret = SYMBIOMON_SUCCESS;
+    if(index->count == 0)
+        return;
+
+    void* ptr = *staging;
+    hg_size_t size = index->count*sizeof(symbiomon_metric_sample);
+    hret = margo_bulk_create(mid, 1, &ptr, &size, HG_BULK_READ_ONLY, &local_bulk);
+    if(hret == HG_SUCCESS)
+        hret = margo_bulk_transfer(mid, HG_BULK_PUSH, addr, remote, remote_offset, local_bulk, 0, size);
+    if(local_bulk != HG_BULK_NULL)
+        margo_bulk_free(local_bulk);
+    if(hret != HG_SUCCESS) {
+        index->count = 0;
+        index->ret = SYMBIOMON_ERR_FROM_MERCURY;
+    }
+}
+
+static void symbiomon_metrics_fetch_multi_ult(hg_handle_t h)
+{
+    hg_return_t hret;
+    metrics_fetch_multi_in_t  in;
+    metrics_fetch_multi_out_t out;
+    hg_bulk_t index_bulk = HG_BULK_NULL;
+    metric_fetch_index* index = NULL;
+    symbiomon_metric_buffer staging = NULL;
+    size_t i, staging_size = 0;
+    uint64_t offset = 0;
+
+    /* find the margo instance */
+    margo_instance_id mid = margo_hg_handle_get_instance(h);
+
+    /* find the provider */
+    const struct hg_info* info = margo_get_info(h);
+    symbiomon_provider_t provider = (symbiomon_provider_t)margo_registered_data(mid, info->id);
+
+    /* deserialize the input */
+    hret = margo_get_input(h, &in);
+    if(hret != HG_SUCCESS) {
+        margo_info(provider->mid, "Could not deserialize output (mercury error %d)", hret);
+        out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+        goto finish;
+    }
+
+    index = (metric_fetch_index*)calloc(in.num_metrics ? in.num_metrics : 1, sizeof(*index));
+    if(!index) {
+        out.ret = SYMBIOMON_ERR_ALLOCATION;
+        goto finish;
+    }
+
+    /* each metric's samples follow those of the previous one */
+    hg_size_t index_size = in.num_metrics*sizeof(*index);
+    for(i = 0; i < in.num_metrics; i++) {
+        symbiomon_metric* metric = find_metric(provider, &(in.ids[i]));
+        if(!metric || in.counts[i] < 0) {
+            index[i].offset = offset;
+            index[i].ret = metric ? SYMBIOMON_ERR_INVALID_ARGS : SYMBIOMON_ERR_INVALID_METRIC;
+            continue;
+        }
+        push_multi_entry(mid, info->addr, in.bulk, index_size, metric, in.counts[i], offset,
+                &index[i], &staging, &staging_size);
+        offset += index[i].skipped + index[i].count;
+    }
+
+    /* then the index, so that the client knows where each metric landed */
+    if(in.num_metrics) {
+        void* ptr = index;
+        hret = margo_bulk_create(mid, 1, &ptr, &index_size, HG_BULK_READ_ONLY, &index_bulk);
+        if(hret == HG_SUCCESS)
+            hret = margo_bulk_transfer(mid, HG_BULK_PUSH, info->addr, in.bulk, 0, index_bulk, 0, index_size);
+        if(hret != HG_SUCCESS) {
+            margo_info(provider->mid, "Could not push index (mercury error %d)", hret);
+            out.ret = SYMBIOMON_ERR_FROM_MERCURY;
+            goto finish;
+        }
+    }
+
+    /* set the response */
+    out.ret = SYMBIOMON_SUCCESS;
+
+finish:
+    free(staging);
+    free(index);
+    hret = margo_respond(h, &out);
+    hret = margo_free_input(h, &in);
+    margo_destroy(h);
+    if(index_bulk != HG_BULK_NULL)
+        margo_bulk_free(index_bulk);
+}
+static DEFINE_MARGO_RPC_HANDLER(symbiomon_metrics_fetch_multi_ult)
+
+size_t symbiomon_provider_metric_copy_last(symbiomon_metric_t m, size_t n, symbiomon_metric_sample* out)
+{
+    size_t i, num_series = m->num_shards + 1;
+    const symbiomon_series* series[num_series];
+    uint64_t first[num_series], end[num_series];
+
+    for(i = 0; i < num_series; i++) {
+        series[i] = symbiomon_metric_series(m, i);
+        size_t len = last_window(series[i], n, &first[i]);
+        end[i] = first[i] + len;
+    }
+    if(num_series == 1 && m->history.capacity && n > end[0] - first[0]
+    && symbiomon_series_count(&m->series) > m->series.capacity) {
+        ABT_mutex_lock(m->metric_mutex);
+        n = symbiomon_history_copy_last(&m->history, &m->series, n, out);
+        ABT_mutex_unlock(m->metric_mutex);
+        return n;
+    }
+    if(num_series == 1)
+        return symbiomon_series_copy(series[0], first[0], end[0] - first[0], out);
+    return symbiomon_series_merge(series, first, end, num_series, n, out);
 }
-static DEFINE_MARGO_RPC_HANDLER(symbiomon_metric_fetch_ult)
 
 symbiomon_return_t symbiomon_provider_metric_list_all(symbiomon_provider_t provider, const char *filename)
 {
@@ -350,12 +2243,7 @@ symbiomon_return_t symbiomon_provider_metric_destroy(symbiomon_metric_t m, symbi
     }
 
     /* remove the metric from the provider */
-    remove_metric(provider, &metric->id);
-
-    ABT_mutex_free(&metric->metric_mutex);
-    free(metric->buffer);
-
-    return SYMBIOMON_SUCCESS;
+    return remove_metric(provider, &metric->id);
 }
 
 symbiomon_return_t symbiomon_provider_destroy_all_metrics(symbiomon_provider_t provider)
@@ -366,32 +2254,174 @@ symbiomon_return_t symbiomon_provider_destroy_all_metrics(symbiomon_provider_t p
     return SYMBIOMON_SUCCESS;
 }
 
+#define VALUE_SCRATCH_SIZE 256
+
+/*
+ * Moves the reduction cursors of a metric to its most recent samples.
+ * The statistics of the interval that just ended are returned in
+ * partial and folded into the cumulative ones. The locked series keeps
+ * them up to date as it is written; shards are written without locking
+ * so their new samples are summarized here, and samples that a shard
+ * evicted before they could be reduced are not accounted for.
+ *
+ * series, first and end hold 1 + num_shards entries: for each series
+ * of the metric, the retained samples the reduction covers, which are
+ * the new ones for interval reductions and all of them otherwise.
+ * For histogram metrics, hist (if not NULL) receives the buckets the
+ * reduction covers, in the same way.
+ */
+static void advance_reduction(symbiomon_metric* m, symbiomon_summary* cumulative, symbiomon_summary* partial,
+        const symbiomon_series** series, uint64_t* first, uint64_t* end, symbiomon_histogram* hist)
+{
+    int interval = (m->reduction_scope == SYMBIOMON_STATS_INTERVAL);
+    uint64_t oldest;
+    size_t i;
+
+    ABT_mutex_lock(m->metric_mutex);
+    symbiomon_metric_materialize(m);
+    *partial = m->interval;
+    symbiomon_summary_init(&m->interval);
+    series[0] = &m->series;
+    first[0] = m->reduced_index;
+    end[0] = m->series.count;
+    m->reduced_index = end[0];
+    for(i = 0; i < m->num_shards; i++) {
+        symbiomon_shard* shard = &m->shards[i];
+        series[i+1] = &shard->series;
+        first[i+1] = shard->reduced_index;
+        end[i+1] = symbiomon_series_count(&shard->series);
+        oldest = end[i+1] > shard->series.capacity ? end[i+1] - shard->series.capacity : 0;
+        if(first[i+1] < oldest) first[i+1] = oldest;
+        symbiomon_series_summarize(&shard->series, first[i+1], end[i+1], partial);
+        shard->reduced_index = end[i+1];
+    }
+    symbiomon_summary_merge(&m->reduced, partial);
+    *cumulative = m->reduced;
+    if(hist && m->histogram) {
+        *hist = *m->histogram;
+        if(interval) {
+            symbiomon_histogram_subtract(hist, m->reduced_histogram);
+            hist->min = partial->min;
+            hist->max = partial->max;
+        }
+    }
+    if(m->reduced_histogram)
+        *m->reduced_histogram = *m->histogram;
+    ABT_mutex_unlock(m->metric_mutex);
+
+    for(i = 0; i <= m->num_shards; i++) {
+        oldest = end[i] > series[i]->capacity ? end[i] - series[i]->capacity : 0;
+        if(!interval || first[i] < oldest) first[i] = oldest;
+    }
+}
+
+/* copies the values outside of [lo, hi] into outliers, returns how many */
+static size_t collect_outliers(const symbiomon_series* s, uint64_t first, uint64_t end, double lo, double hi, double* outliers)
+{
+    double scratch[VALUE_SCRATCH_SIZE];
+    const double* vals;
+    size_t i, n, num_outliers = 0;
+
+    for(; first < end; first += n) {
+        n = symbiomon_series_values(s, first, end - first, scratch, VALUE_SCRATCH_SIZE, &vals);
+        for(i = 0; i < n; i++) {
+            if((vals[i] < lo) || (vals[i] > hi))
+                outliers[num_outliers++] = vals[i];
+        }
+    }
+    return num_outliers;
+}
+
+/* counts the values of the samples [first, end) of s in h; only timers
+ * get here, their values are never negative */
+static void sketch_values(const symbiomon_series* s, uint64_t first, uint64_t end, symbiomon_histogram* h)
+{
+    double scratch[VALUE_SCRATCH_SIZE];
+    const double* vals;
+    size_t i, n;
+
+    for(; first < end; first += n) {
+        n = symbiomon_series_values(s, first, end - first, scratch, VALUE_SCRATCH_SIZE, &vals);
+        for(i = 0; i < n; i++)
+            symbiomon_histogram_add(h, vals[i]);
+    }
+}
+
 symbiomon_return_t symbiomon_provider_metric_reduce(symbiomon_metric_t m, symbiomon_provider_t provider)
 {
+    symbiomon_summary cumulative, partial;
+    size_t i, num_series = m->num_shards + 1;
+    const symbiomon_series* series[num_series];
+    uint64_t first[num_series], end[num_series];
+    symbiomon_histogram* hist = NULL;
+
+#ifdef USE_AGGREGATOR
+    int percentile = (m->reduction_op == SYMBIOMON_REDUCTION_OP_P50
+                   || m->reduction_op == SYMBIOMON_REDUCTION_OP_P95
+                   || m->reduction_op == SYMBIOMON_REDUCTION_OP_P99);
+    if(percentile || (m->histogram && m->reduction_op != SYMBIOMON_REDUCTION_OP_NULL)) {
+        hist = (symbiomon_histogram*)malloc(sizeof(*hist));
+        if(!hist && percentile)
+            return SYMBIOMON_ERR_ALLOCATION;
+    }
+#endif
+    advance_reduction(m, &cumulative, &partial, series, first, end, hist);
 
 #ifdef USE_AGGREGATOR
     /* find the metric */
     symbiomon_metric* metric = find_metric(provider, &m->id);
     if(!metric) {
+        free(hist);
         return SYMBIOMON_ERR_INVALID_METRIC;
     }
 
-    unsigned int current_index = m->buffer_index;
-    if (current_index == 0) return SYMBIOMON_SUCCESS;
+    /* interval reductions only cover the samples recorded since the previous one */
+    int interval = (m->reduction_scope == SYMBIOMON_STATS_INTERVAL);
+    symbiomon_summary stats = interval ? partial : cumulative;
+    if (stats.count == 0) {
+        free(hist);
+        return SYMBIOMON_SUCCESS;
+    }
 
     uint32_t agg_id = (uint32_t)(m->aggregator_id)%(provider->num_aggregators);
     int ret;
 
+    /* samples still retained in the ring, for the reductions that need them */
+    uint64_t num_samples = 0;
+    for(i = 0; i < num_series; i++)
+        num_samples += end[i] - first[i];
+
+    /* histogram metrics whatever the reduction, and percentile reductions,
+     * store a sketch that merges with those of the other ranks; other
+     * metrics sketch the retained samples the reduction covers */
+    if(hist) {
+        void* sketch = NULL;
+        size_t sketch_size;
+        if(!m->histogram) {
+            symbiomon_histogram_init(hist);
+            for(i = 0; i < num_series; i++)
+                sketch_values(series[i], first[i], end[i], hist);
+        }
+        sketch_size = symbiomon_histogram_encode(hist, &sketch);
+	char *key = (char *)malloc(256*sizeof(char));
+	strcpy(key, m->stringify);
+	strcat(key, "_SKETCH");
+	ret = sdskv_erase(provider->aggphs[agg_id], provider->aggdbids[agg_id], (const void *)key, strlen(key));
+	assert(ret == SDSKV_SUCCESS);
+        if(sketch_size) {
+	    ret = sdskv_put(provider->aggphs[agg_id], provider->aggdbids[agg_id], (const void *)key, strlen(key), sketch, sketch_size);
+	    assert(ret == SDSKV_SUCCESS);
+        }
+        free(sketch);
+        free(key);
+    }
+
     switch(metric->reduction_op) {
         case SYMBIOMON_REDUCTION_OP_NULL: {
             break;
         }
 	case SYMBIOMON_REDUCTION_OP_SUM: {
-	    int i=0;
-	    double sum = 0;
-	    for(i=0; i < current_index; i++) {
-                sum += m->buffer[i].val; 
-            }
+	    double sum = stats.sum;
 	    char *key = (char *)malloc(256*sizeof(char));
 	    strcpy(key, m->stringify);
 	    strcat(key, "_SUM");
@@ -404,12 +2434,7 @@ symbiomon_return_t symbiomon_provider_metric_reduce(symbiomon_metric_t m, symbio
 	    break;
         }
 	case SYMBIOMON_REDUCTION_OP_AVG: {
-	    int i=0;
-            double sum = 0, avg = 0;
-	    for(i=0; i < current_index; i++) {
-                sum += m->buffer[i].val; 
-            }
-	    avg = sum/(double)current_index;
+            double avg = stats.mean;
 	    char *key = (char *)malloc(256*sizeof(char));
 	    strcpy(key, m->stringify);
 	    strcat(key, "_AVG");
@@ -421,18 +2446,13 @@ symbiomon_return_t symbiomon_provider_metric_reduce(symbiomon_metric_t m, symbio
 	    break;
         }
 	case SYMBIOMON_REDUCTION_OP_MIN: {
-	    int i=0; double min;
-            if(m->type == SYMBIOMON_TYPE_GAUGE) {
-              min = 9999999999.0;
-  	      for(i=0; i < current_index; i++) {
-                  min = (m->buffer[i].val < min ? m->buffer[i].val:min);
-              }
+	    double min;
+            if(m->type == SYMBIOMON_TYPE_GAUGE || m->type == SYMBIOMON_TYPE_HISTOGRAM) {
+              min = stats.min;
             } else {
-              if(current_index) {
-                min = m->buffer[current_index-1].val;
-              } else {
-                min = 0.0;
-              }
+              symbiomon_metric_sample last = { .val = 0.0 };
+              symbiomon_provider_metric_copy_last(m, 1, &last);
+              min = last.val;
             }
 	    char *key = (char *)malloc(256*sizeof(char));
 	    strcpy(key, m->stringify);
@@ -445,19 +2465,13 @@ symbiomon_return_t symbiomon_provider_metric_reduce(symbiomon_metric_t m, symbio
 	    break;
         }
 	case SYMBIOMON_REDUCTION_OP_MAX: {
-	    int i=0;
-            double max;
-            if(m->type == SYMBIOMON_TYPE_GAUGE) {
-              max = -9999999999.0;
-	      for(i=0; i < current_index; i++) {
-                  max = (m->buffer[i].val > max ? m->buffer[i].val:max);
-              }
+	    double max;
+            if(m->type == SYMBIOMON_TYPE_GAUGE || m->type == SYMBIOMON_TYPE_HISTOGRAM) {
+              max = stats.max;
             } else {
-              if(current_index) {
-                max = m->buffer[current_index-1].val;
-              } else {
-                max = 0.0;
-              }
+              symbiomon_metric_sample last = { .val = 0.0 };
+              symbiomon_provider_metric_copy_last(m, 1, &last);
+              max = last.val;
             }
 	    char *key = (char *)malloc(256*sizeof(char));
 	    strcpy(key, m->stringify);
@@ -473,32 +2487,27 @@ symbiomon_return_t symbiomon_provider_metric_reduce(symbiomon_metric_t m, symbio
 	case SYMBIOMON_REDUCTION_OP_STORE: {
 	    char *key = (char *)malloc(256*sizeof(char));
 	    strcpy(key, m->stringify);
-	    symbiomon_metric_buffer buf = (symbiomon_metric_buffer)malloc(current_index*sizeof(symbiomon_metric_sample));
-	    memcpy(buf, m->buffer, current_index*sizeof(symbiomon_metric_sample));
-	    ret = sdskv_put(provider->aggphs[agg_id], provider->aggdbids[agg_id], (const void *)key, strlen(key), (const void *)buf, sizeof(current_index*sizeof(symbiomon_metric_sample)));
+            /* each interval is stored under its own key so earlier ones are kept */
+            if(interval)
+                sprintf(key + strlen(key), "_%lu", cumulative.count - partial.count);
+	    symbiomon_metric_buffer buf = (symbiomon_metric_buffer)malloc(num_samples*sizeof(symbiomon_metric_sample));
+	    num_samples = symbiomon_series_merge(series, first, end, num_series, num_samples, buf);
+	    ret = sdskv_put(provider->aggphs[agg_id], provider->aggdbids[agg_id], (const void *)key, strlen(key), (const void *)buf, num_samples*sizeof(symbiomon_metric_sample));
 	    assert(ret == SDSKV_SUCCESS);
+            free(buf);
             free(key);
 	    break;
         }
 
 	case SYMBIOMON_REDUCTION_OP_ANOMALY: {
-	    int i = 0; int num_outliers = 0;
-            double sum = 0, avg = 0, sd = 0;
-	    for(i=0; i < current_index; i++) {
-                sum += m->buffer[i].val; 
-            }
-
-	    avg = sum/(double)current_index;
-            for(i=0; i < current_index; i++)
-                sd += pow(m->buffer[i].val - avg, 2);
-
-            double * outlier_list = (double*)malloc(sizeof(double)*current_index);
-	    for(i=0; i < current_index; i++) {
-                if ((m->buffer[i].val < avg-3*sd) || (m->buffer[i].val > avg+3*sd)) {
-                    outlier_list[num_outliers] = m->buffer[i].val;
-                    num_outliers++;
-                }
-            }
+	    size_t num_outliers = 0;
+            double avg = 0, sd = 0;
+	    avg = stats.mean;
+            sd = sqrt(symbiomon_summary_variance(&stats));
+
+            double * outlier_list = (double*)malloc(sizeof(double)*num_samples);
+            for(i = 0; i < num_series; i++)
+                num_outliers += collect_outliers(series[i], first[i], end[i], avg-3*sd, avg+3*sd, outlier_list + num_outliers);
                 
 	    char *key = (char *)malloc(256*sizeof(char));
 	    strcpy(key, m->stringify);
@@ -506,15 +2515,34 @@ symbiomon_return_t symbiomon_provider_metric_reduce(symbiomon_metric_t m, symbio
 	    ret = sdskv_erase(provider->aggphs[agg_id], provider->aggdbids[agg_id], (const void *)key, strlen(key));
 	    assert(ret == SDSKV_SUCCESS);
 
-	    ret = sdskv_put(provider->aggphs[agg_id], provider->aggdbids[agg_id], (const void *)key, strlen(key), (const void *)outlier_list, sizeof(num_outliers*sizeof(double)));
+	    ret = sdskv_put(provider->aggphs[agg_id], provider->aggdbids[agg_id], (const void *)key, strlen(key), (const void *)outlier_list, num_outliers*sizeof(double));
 	    assert(ret == SDSKV_SUCCESS);
 
             free(outlier_list);
             free(key);
 	    break;
         }
+
+	case SYMBIOMON_REDUCTION_OP_P50:
+	case SYMBIOMON_REDUCTION_OP_P95:
+	case SYMBIOMON_REDUCTION_OP_P99: {
+            static const double quantiles[] = { 0.50, 0.95, 0.99 };
+            static const char* suffixes[] = { "_P50", "_P95", "_P99" };
+            int k = metric->reduction_op - SYMBIOMON_REDUCTION_OP_P50;
+            double p = symbiomon_histogram_quantile(hist, quantiles[k]);
+	    char *key = (char *)malloc(256*sizeof(char));
+	    strcpy(key, m->stringify);
+	    strcat(key, suffixes[k]);
+	    ret = sdskv_erase(provider->aggphs[agg_id], provider->aggdbids[agg_id], (const void *)key, strlen(key));
+	    assert(ret == SDSKV_SUCCESS);
+	    ret = sdskv_put(provider->aggphs[agg_id], provider->aggdbids[agg_id], (const void *)key, strlen(key), &p, sizeof(p));
+	    assert(ret == SDSKV_SUCCESS);
+            free(key);
+	    break;
+        }
     }
 #endif
+    free(hist);
     return SYMBIOMON_SUCCESS;
 }
 
@@ -571,16 +2599,17 @@ symbiomon_return_t symbiomon_provider_reduce_all_metrics_batched(symbiomon_provi
             return SYMBIOMON_ERR_INVALID_METRIC;
         }
 
-        unsigned int current_index = m->buffer_index;
-        if (current_index == 0) return SYMBIOMON_SUCCESS;
+        symbiomon_summary stats, partial;
+        size_t num_series = m->num_shards + 1;
+        const symbiomon_series* series[num_series];
+        uint64_t first[num_series], end[num_series];
+        advance_reduction(m, &stats, &partial, series, first, end, NULL);
+        if (stats.count == 0) return SYMBIOMON_SUCCESS;
+        if (m->reduction_scope == SYMBIOMON_STATS_INTERVAL) stats = partial;
 
         switch(metric->reduction_op) {
    	    case SYMBIOMON_REDUCTION_OP_MAX: {
-	        int i=0;
-                double max = -9999999999.0;
-    	        for(i=0; i < current_index; i++) {
-                    max = (m->buffer[i].val > max ? m->buffer[i].val:max);
-                }
+                double max = stats.max;
     	        keys[metric_index] = (char *)malloc(256*sizeof(char));
     	        vals[metric_index] = (double *)calloc(1, sizeof(double));
 	        strcpy(keys[metric_index], m->stringify);
@@ -606,6 +2635,107 @@ symbiomon_return_t symbiomon_provider_reduce_all_metrics_batched(symbiomon_provi
     return SYMBIOMON_SUCCESS;
 }
 
+#if defined(USE_REDUCER) && defined(USE_AGGREGATOR)
+#define SKETCH_KEYS_PER_LIST 64
+#define SKETCH_KEY_SIZE      256
+
+/*
+ * Whether key, past a "<ns>_<name>_" prefix of plen bytes, is the
+ * "[<tags>_]SKETCH" of a rank tagged like the local metric: as many tags,
+ * joined by as many underscores in all as the local ones.
+ */
+static int is_cohort_sketch(const char* key, size_t ksize, size_t plen, const symbiomon_taglist* tl)
+{
+    size_t i, seps = 0, found = 0;
+    int t;
+    if(ksize < plen + 6 || memcmp(key + ksize - 6, "SKETCH", 6) != 0)
+        return 0;
+    if(tl->num_tags == 0)
+        return ksize == plen + 6;
+    if(ksize < plen + 8 || key[ksize - 7] != '_')
+        return 0;
+    for(t = 0; t < tl->num_tags; t++)
+        for(i = 0; tl->taglist[t][i]; i++)
+            seps += tl->taglist[t][i] == '_';
+    seps += tl->num_tags - 1;
+    for(i = plen; i < ksize - 7; i++)
+        found += key[i] == '_';
+    return found == seps;
+}
+
+/*
+ * Merges the sketches the ranks of a cohort stored for a metric on its
+ * aggregator, under "<ns>_<name>_[<tags>_]SKETCH" keys, and stores the
+ * percentile of reduction_op over them under "<ns>_<name>_GLOBAL_P<nn>".
+ * Malformed sketches, and those erased while being listed, are skipped.
+ */
+static symbiomon_return_t global_percentile(symbiomon_metric* m, symbiomon_provider_t provider, uint32_t agg_id)
+{
+    static const double quantiles[] = { 0.50, 0.95, 0.99 };
+    static const char* suffixes[] = { "_GLOBAL_P50", "_GLOBAL_P95", "_GLOBAL_P99" };
+    int k = m->reduction_op - SYMBIOMON_REDUCTION_OP_P50;
+    sdskv_provider_handle_t ph = provider->aggphs[agg_id];
+    sdskv_database_id_t db = provider->aggdbids[agg_id];
+    char prefix[SKETCH_KEY_SIZE], start[SKETCH_KEY_SIZE], key[SKETCH_KEY_SIZE];
+    void* keys[SKETCH_KEYS_PER_LIST];
+    hg_size_t ksizes[SKETCH_KEYS_PER_LIST], start_size = 0, num, vsize;
+    symbiomon_return_t sret = SYMBIOMON_SUCCESS;
+    size_t i;
+    double p;
+    int ret;
+
+    symbiomon_histogram* merged = (symbiomon_histogram*)calloc(1, sizeof(*merged));
+    void* sketch = malloc(SYMBIOMON_SKETCH_MAX_SIZE);
+    char* names = (char*)malloc(SKETCH_KEYS_PER_LIST*SKETCH_KEY_SIZE);
+    if(!merged || !sketch || !names) {
+        sret = SYMBIOMON_ERR_ALLOCATION;
+        goto finish;
+    }
+    for(i = 0; i < SKETCH_KEYS_PER_LIST; i++)
+        keys[i] = names + i*SKETCH_KEY_SIZE;
+
+    /* the ranks' keys share the namespace and name and differ in tags */
+    snprintf(prefix, sizeof(prefix), "%s_%s_", m->ns, m->name);
+    do {
+        num = SKETCH_KEYS_PER_LIST;
+        for(i = 0; i < SKETCH_KEYS_PER_LIST; i++)
+            ksizes[i] = SKETCH_KEY_SIZE;
+        ret = sdskv_list_keys_with_prefix(ph, db, start, start_size, prefix, strlen(prefix), keys, ksizes, &num);
+        if(ret != SDSKV_SUCCESS) {
+            sret = SYMBIOMON_ERR_OTHER;
+            goto finish;
+        }
+        for(i = 0; i < num; i++) {
+            if(!is_cohort_sketch((const char*)keys[i], ksizes[i], strlen(prefix), m->taglist))
+                continue;
+            vsize = SYMBIOMON_SKETCH_MAX_SIZE;
+            ret = sdskv_get(ph, db, keys[i], ksizes[i], sketch, &vsize);
+            if(ret == SDSKV_SUCCESS)
+                symbiomon_histogram_merge_encoded(merged, sketch, vsize);
+        }
+        if(num) {
+            memcpy(start, keys[num-1], ksizes[num-1]);
+            start_size = ksizes[num-1];
+        }
+    } while(num == SKETCH_KEYS_PER_LIST);
+
+    if(merged->count) {
+        p = symbiomon_histogram_quantile(merged, quantiles[k]);
+        snprintf(key, sizeof(key), "%s_%s%s", m->ns, m->name, suffixes[k]);
+        ret = sdskv_erase(ph, db, (const void *)key, strlen(key));
+        assert(ret == SDSKV_SUCCESS);
+        ret = sdskv_put(ph, db, (const void *)key, strlen(key), &p, sizeof(p));
+        assert(ret == SDSKV_SUCCESS);
+    }
+
+finish:
+    free(names);
+    free(sketch);
+    free(merged);
+    return sret;
+}
+#endif
+
 static symbiomon_return_t symbiomon_provider_global_metric_reduce(symbiomon_metric_t m, symbiomon_provider_t provider, size_t cohort_size)
 {
 #ifdef USE_REDUCER
@@ -618,6 +2748,8 @@ static symbiomon_return_t symbiomon_provider_global_metric_reduce(symbiomon_metr
     uint32_t agg_id = (uint32_t)(m->aggregator_id)%(provider->num_aggregators);
     int ret;
 
+    /* the reducer combines the scalar keys, the _SKETCH keys of
+     * percentile reductions are merged here */
     switch(metric->reduction_op) {
         case SYMBIOMON_REDUCTION_OP_NULL: {
             break;
@@ -642,6 +2774,16 @@ static symbiomon_return_t symbiomon_provider_global_metric_reduce(symbiomon_metr
             reducer_metric_reduce(m->ns, m->name, m->stringify, agg_id, REDUCER_REDUCTION_OP_ANOMALY, provider->redphl, cohort_size);
 	    break;
         }
+	case SYMBIOMON_REDUCTION_OP_P50:
+	case SYMBIOMON_REDUCTION_OP_P95:
+	case SYMBIOMON_REDUCTION_OP_P99: {
+#ifdef USE_AGGREGATOR
+            /* percentiles of different ranks do not combine, their sketches do */
+            if(provider->use_aggregator)
+                return global_percentile(metric, provider, agg_id);
+#endif
+	    break;
+        }
     }
 #endif
     return SYMBIOMON_SUCCESS;
@@ -722,39 +2864,100 @@ static inline symbiomon_return_t add_metric(
         symbiomon_provider_t provider,
         symbiomon_metric* metric)
 {
-
+    ABT_mutex_lock(provider->metrics_mutex);
     symbiomon_metric* existing = find_metric(provider, &(metric->id));
     if(existing) {
+        ABT_mutex_unlock(provider->metrics_mutex);
         return SYMBIOMON_ERR_INVALID_METRIC;
     }
     HASH_ADD(hh, provider->metrics, id, sizeof(symbiomon_metric_id_t), metric);
     provider->num_metrics += 1;
+    ABT_mutex_unlock(provider->metrics_mutex);
 
     return SYMBIOMON_SUCCESS;
 }
 
+/* metrics are unlinked under metrics_mutex and freed once it is released,
+ * since freeing one joins its snapshot ULT */
 static inline symbiomon_return_t remove_metric(
         symbiomon_provider_t provider,
         const symbiomon_metric_id_t* id)
 {
+    ABT_mutex_lock(provider->metrics_mutex);
     symbiomon_metric* metric = find_metric(provider, id);
     if(!metric) {
+        ABT_mutex_unlock(provider->metrics_mutex);
         return SYMBIOMON_ERR_INVALID_METRIC;
     }
-    symbiomon_return_t ret = SYMBIOMON_SUCCESS;
     HASH_DEL(provider->metrics, metric);
-    free(metric);
     provider->num_metrics -= 1;
-    return ret;
+    ABT_mutex_unlock(provider->metrics_mutex);
+    free_metric(metric);
+    return SYMBIOMON_SUCCESS;
 }
 
 static inline void remove_all_metrics(
         symbiomon_provider_t provider)
 {
-    symbiomon_metric *r, *tmp;
-    HASH_ITER(hh, provider->metrics, r, tmp) {
-        HASH_DEL(provider->metrics, r);
-        free(r);
-    }
+    symbiomon_metric *all, *r, *tmp;
+    ABT_mutex_lock(provider->metrics_mutex);
+    all = provider->metrics;
+    provider->metrics = NULL;
     provider->num_metrics = 0;
+    ABT_mutex_unlock(provider->metrics_mutex);
+    HASH_ITER(hh, all, r, tmp) {
+        HASH_DEL(all, r);
+        free_metric(r);
+    }
+}
+
+static inline void free_metric(
+        symbiomon_metric* metric)
+{
+    size_t i;
+    if(metric->snapshot_ult != ABT_THREAD_NULL) {
+        ABT_mutex_lock(metric->metric_mutex);
+        metric->snapshot_stop = 1;
+        ABT_cond_signal(metric->snapshot_cond);
+        ABT_mutex_unlock(metric->metric_mutex);
+        ABT_thread_join(metric->snapshot_ult);
+        ABT_thread_free(&metric->snapshot_ult);
+    }
+    if(metric->snapshot_cond != ABT_COND_NULL)
+        ABT_cond_free(&metric->snapshot_cond);
+    if(metric->metric_mutex != ABT_MUTEX_NULL)
+        ABT_mutex_free(&metric->metric_mutex);
+    if(metric->exposed != HG_BULK_NULL)
+        margo_bulk_free(metric->exposed);
+    for(i = 0; i < metric->num_shards; i++)
+        symbiomon_series_finalize(&metric->shards[i].series);
+    free(metric->shards);
+    symbiomon_series_finalize(&metric->series);
+    symbiomon_history_finalize(&metric->history);
+    for(i = 0; i < metric->num_rollups; i++)
+        symbiomon_rollup_tier_finalize(&metric->rollups[i]);
+    free(metric->histogram);
+    free(metric->reduced_histogram);
+    free(metric);
+}
+
+/* Records the fast-path counter of a metric every snapshot_interval
+ * seconds, until the metric is destroyed */
+static void snapshot_ult(void* arg)
+{
+    symbiomon_metric* m = (symbiomon_metric*)arg;
+    struct timeval now;
+    struct timespec deadline;
+    double t;
+
+    ABT_mutex_lock(m->metric_mutex);
+    while(!m->snapshot_stop) {
+        gettimeofday(&now, NULL);
+        t = now.tv_sec + now.tv_usec*1e-6 + m->snapshot_interval;
+        deadline.tv_sec  = (time_t)t;
+        deadline.tv_nsec = (long)((t - (double)deadline.tv_sec)*1e9);
+        ABT_cond_timedwait(m->snapshot_cond, m->metric_mutex, &deadline);
+        symbiomon_metric_materialize(m);
+    }
+    ABT_mutex_unlock(m->metric_mutex);
 }
@@ -10,6 +10,7 @@
 //#include <abt-io.h>
 #include "uthash.h"
 #include "types.h"
+#include "symbiomon/symbiomon-metric.h"
 #ifdef USE_AGGREGATOR
 #include <sdskv-client.h>
 #endif
@@ -18,6 +19,44 @@
 #include <reducer/reducer-client.h>
 #endif
 
+/* position of a subscriber in the samples of one metric */
+typedef struct symbiomon_subscription_cursor {
+    symbiomon_metric_id_t id;
+    double since;       /* timestamp of the last sample pushed */
+    uint64_t seen;      /* samples pushed at that timestamp */
+    double next;        /* same after the push in flight */
+    uint64_t next_seen;
+    UT_hash_handle hh;
+} symbiomon_subscription_cursor;
+
+/*
+ * Remote client to which a background ULT pushes the new samples of the
+ * metrics matching a filter every interval seconds. A subscriber whose
+ * pushes keep failing or timing out stops itself and is reclaimed by
+ * the next subscribe or unsubscribe.
+ */
+typedef struct symbiomon_subscriber {
+    struct symbiomon_provider* provider;
+    uint64_t              id;
+    uint64_t              token;                /* client's name for the subscription */
+    hg_addr_t             addr;
+    uint16_t              callback_provider_id; /* provider id of the client's notify RPC */
+    symbiomon_subscription_filter_t filter;
+    symbiomon_metric_id_t metric_id;
+    char                  pattern[128];
+    double                interval;
+    uint64_t              batch_size;
+    double                start;      /* only samples more recent are pushed */
+    symbiomon_subscription_cursor* cursors;
+    symbiomon_metric_id_t*   ids;     /* batch being pushed */
+    symbiomon_metric_sample* samples;
+    unsigned              failures;   /* consecutive failed pushes */
+    int                   stop;
+    ABT_cond              cond;
+    ABT_thread            ult;
+    struct symbiomon_subscriber* next;
+} symbiomon_subscriber;
+
 typedef struct symbiomon_provider {
     /* Margo/Argobots/Mercury environment */
     margo_instance_id  mid;                 // Margo instance
@@ -27,9 +66,29 @@ typedef struct symbiomon_provider {
     /* Resources and backend types */
     size_t               num_metrics;     // number of metrics
     symbiomon_metric*      metrics;         // hash of metrics by id
+    ABT_mutex              metrics_mutex;   // guards the hash against walks from subscriber ULTs
+    symbiomon_chunk_pool   chunk_pool;      // storage chunks shared by all metrics
+    ABT_mutex              subscribers_mutex;
+    symbiomon_subscriber*  subscribers;     // list of subscribers
+    size_t                 num_subscribers;
+    size_t                 max_subscribers;
+    uint64_t               next_subscriber_id;
     /* RPC identifiers for clients */
     hg_id_t list_metrics_id;
     hg_id_t metric_fetch_id;
+    hg_id_t metric_fetch_encoded_id;
+    hg_id_t metric_fetch_columns_id;
+    hg_id_t metric_expose_id;
+    hg_id_t metric_fetch_since_id;
+    hg_id_t metrics_fetch_multi_id;
+    hg_id_t metric_fetch_range_id;
+    hg_id_t metric_aggregate_id;
+    hg_id_t metric_fetch_downsampled_id;
+    hg_id_t metric_fetch_rollup_id;
+    hg_id_t metric_fetch_histogram_id;
+    hg_id_t subscribe_id;
+    hg_id_t unsubscribe_id;
+    hg_id_t notify_id;        // RPC of subscribers receiving samples
     /* ... add other RPC identifiers here ... */
     uint8_t use_aggregator;
     uint8_t use_reducer;
@@ -47,12 +106,20 @@ typedef struct symbiomon_provider {
 
 symbiomon_return_t symbiomon_provider_metric_create_with_reduction(const char *ns, const char *name, symbiomon_metric_type_t t, const char *desc, symbiomon_taglist_t tl, symbiomon_metric_t* m, symbiomon_provider_t provider, symbiomon_metric_reduction_op_t op);
 
+symbiomon_return_t symbiomon_provider_metric_create_with_args(const char *ns, const char *name, symbiomon_metric_type_t t, const char *desc, symbiomon_taglist_t tl, symbiomon_metric_t* m, symbiomon_provider_t provider, const struct symbiomon_metric_args* args);
+
 symbiomon_return_t symbiomon_provider_metric_create(const char *ns, const char *name, symbiomon_metric_type_t t, const char *desc, symbiomon_taglist_t tl, symbiomon_metric_t* m, symbiomon_provider_t provider);
 
 symbiomon_return_t symbiomon_provider_metric_destroy(symbiomon_metric_t m, symbiomon_provider_t provider);
 
 symbiomon_return_t symbiomon_provider_destroy_all_metrics(symbiomon_provider_t provider);
 
+/* Copies the last n retained samples of a metric, merging its shards by
+ * timestamp. Returns the number of samples copied. */
+size_t symbiomon_provider_metric_copy_last(symbiomon_metric_t m, size_t n, symbiomon_metric_sample* out);
+
+symbiomon_return_t symbiomon_provider_metric_aggregate(symbiomon_metric_t m, double t0, double t1, symbiomon_metric_aggregate* out);
+
 symbiomon_return_t symbiomon_provider_metric_reduce(symbiomon_metric_t m, symbiomon_provider_t provider);
 
 symbiomon_return_t symbiomon_provider_reduce_all_metrics(symbiomon_provider_t provider);
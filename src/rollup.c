@@ -0,0 +1,76 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "rollup.h"
+
+symbiomon_return_t symbiomon_rollup_tier_init(symbiomon_rollup_tier* t, double period, size_t retention)
+{
+    if(!(period > 0) || retention == 0)
+        return SYMBIOMON_ERR_INVALID_ARGS;
+    t->buckets = (symbiomon_rollup*)malloc(retention*sizeof(*t->buckets));
+    if(!t->buckets)
+        return SYMBIOMON_ERR_ALLOCATION;
+    t->period = period;
+    t->retention = retention;
+    t->count = 0;
+    return SYMBIOMON_SUCCESS;
+}
+
+void symbiomon_rollup_tier_finalize(symbiomon_rollup_tier* t)
+{
+    free(t->buckets);
+    memset(t, 0, sizeof(*t));
+}
+
+static inline const symbiomon_rollup* bucket(const symbiomon_rollup_tier* t, uint64_t i)
+{
+    return &t->buckets[i % t->retention];
+}
+
+/* numbers of the buckets overlapping [t0, t1], found by binary search */
+static void bucket_window(const symbiomon_rollup_tier* t, double t0, double t1, uint64_t* first, uint64_t* end)
+{
+    uint64_t lo = symbiomon_rollup_tier_first(t), hi = t->count;
+    while(lo < hi) {
+        uint64_t mid = lo + (hi - lo)/2;
+        if(bucket(t, mid)->time + t->period <= t0) lo = mid + 1;
+        else hi = mid;
+    }
+    *first = lo;
+    hi = t->count;
+    while(lo < hi) {
+        uint64_t mid = lo + (hi - lo)/2;
+        if(bucket(t, mid)->time <= t1) lo = mid + 1;
+        else hi = mid;
+    }
+    *end = lo;
+}
+
+size_t symbiomon_rollup_tier_copy(const symbiomon_rollup_tier* t, double t0, double t1, size_t n, symbiomon_rollup* out)
+{
+    uint64_t first, end, i;
+    bucket_window(t, t0, t1, &first, &end);
+    if(end - first < n) n = end - first;
+    for(i = 0; i < n; i++)
+        out[i] = *bucket(t, first + i);
+    return n;
+}
+
+void symbiomon_rollup_tier_summarize(const symbiomon_rollup_tier* t, double t0, double t1, symbiomon_rollup* out)
+{
+    uint64_t first, end, i;
+    bucket_window(t, t0, t1, &first, &end);
+    memset(out, 0, sizeof(*out));
+    out->time = first < end ? bucket(t, first)->time : t0;
+    for(i = first; i < end; i++) {
+        const symbiomon_rollup* b = bucket(t, i);
+        if(!out->count || b->min < out->min) out->min = b->min;
+        if(!out->count || b->max > out->max) out->max = b->max;
+        out->count += b->count;
+        out->sum   += b->sum;
+    }
+}
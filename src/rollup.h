@@ -0,0 +1,77 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _ROLLUP_H
+#define _ROLLUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+#include "symbiomon/symbiomon-common.h"
+
+/*
+ * Ring of the most recent "retention" buckets of "period" seconds each,
+ * summarizing the samples of a metric. Buckets start at multiples of the
+ * period and only buckets that received samples exist, so consecutive
+ * buckets may be more than one period apart. Bucket numbers grow
+ * monotonically like the sequence numbers of a series.
+ */
+typedef struct symbiomon_rollup_tier {
+    double   period;
+    size_t   retention;
+    uint64_t count;            /* number of buckets ever opened */
+    symbiomon_rollup* buckets;
+} symbiomon_rollup_tier;
+
+symbiomon_return_t symbiomon_rollup_tier_init(symbiomon_rollup_tier* t, double period, size_t retention);
+
+void symbiomon_rollup_tier_finalize(symbiomon_rollup_tier* t);
+
+/* Copies the buckets overlapping [t0, t1], oldest first and at most n of
+ * them, and returns how many were copied. */
+size_t symbiomon_rollup_tier_copy(const symbiomon_rollup_tier* t, double t0, double t1, size_t n, symbiomon_rollup* out);
+
+/* Folds the buckets overlapping [t0, t1] into a count, sum, min and max */
+void symbiomon_rollup_tier_summarize(const symbiomon_rollup_tier* t, double t0, double t1, symbiomon_rollup* out);
+
+/* number of the oldest bucket still retained */
+static inline uint64_t symbiomon_rollup_tier_first(const symbiomon_rollup_tier* t)
+{
+    return t->count > t->retention ? t->count - t->retention : 0;
+}
+
+/* start of the oldest bucket retained, or +inf if there is none */
+static inline double symbiomon_rollup_tier_oldest(const symbiomon_rollup_tier* t)
+{
+    return t->count ? t->buckets[symbiomon_rollup_tier_first(t) % t->retention].time : INFINITY;
+}
+
+/*
+ * Folds a sample into the bucket of its timestamp, opening a new bucket
+ * (and dropping the oldest one) when it is past the current one. A sample
+ * older than the current bucket, which only happens when updates racing
+ * for the metric's lock straddle a bucket boundary, is folded into the
+ * current bucket. The caller holds the lock protecting the tier.
+ */
+static inline void symbiomon_rollup_tier_add(symbiomon_rollup_tier* t, double time, double val)
+{
+    double start = floor(time/t->period)*t->period;
+    symbiomon_rollup* b = t->count ? &t->buckets[(t->count - 1) % t->retention] : NULL;
+    if(!b || start > b->time) {
+        b = &t->buckets[t->count % t->retention];
+        b->time  = start;
+        b->count = 0;
+        b->sum   = 0.0;
+        b->min   = val;
+        b->max   = val;
+        t->count += 1;
+    }
+    b->count += 1;
+    b->sum   += val;
+    if(val < b->min) b->min = val;
+    if(val > b->max) b->max = val;
+}
+
+#endif
@@ -0,0 +1,390 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "series.h"
+
+#define CHUNK_BYTES (SYMBIOMON_CHUNK_SIZE*sizeof(symbiomon_metric_sample))
+#define VALUE_SCRATCH_SIZE 256
+
+/* header written at the start of a chunk while it sits in the free list */
+typedef struct free_chunk {
+    struct free_chunk* next;
+    hg_bulk_t          bulk;
+} free_chunk;
+
+symbiomon_return_t symbiomon_chunk_pool_init(symbiomon_chunk_pool* pool, margo_instance_id mid)
+{
+    if(ABT_mutex_create(&pool->mutex) != ABT_SUCCESS)
+        return SYMBIOMON_ERR_FROM_ARGOBOTS;
+    pool->mid = mid;
+    pool->free_list = NULL;
+    pool->num_free = 0;
+    pool->num_allocated = 0;
+    return SYMBIOMON_SUCCESS;
+}
+
+void symbiomon_chunk_pool_finalize(symbiomon_chunk_pool* pool)
+{
+    while(pool->free_list) {
+        free_chunk* chunk = (free_chunk*)pool->free_list;
+        pool->free_list = chunk->next;
+        if(chunk->bulk != HG_BULK_NULL)
+            margo_bulk_free(chunk->bulk);
+        free(chunk);
+    }
+    pool->num_free = 0;
+    pool->num_allocated = 0;
+    ABT_mutex_free(&pool->mutex);
+}
+
+static void* chunk_pool_get(symbiomon_chunk_pool* pool, hg_bulk_t* bulk)
+{
+    free_chunk* chunk = NULL;
+
+    ABT_mutex_lock(pool->mutex);
+    if(pool->free_list) {
+        chunk = (free_chunk*)pool->free_list;
+        pool->free_list = chunk->next;
+        pool->num_free--;
+    }
+    ABT_mutex_unlock(pool->mutex);
+    if(chunk) {
+        *bulk = chunk->bulk;
+        return chunk;
+    }
+
+    /* registration is done once, when the chunk is first allocated */
+    *bulk = HG_BULK_NULL;
+    chunk = (free_chunk*)malloc(CHUNK_BYTES);
+    if(!chunk) return NULL;
+    if(pool->mid != MARGO_INSTANCE_NULL) {
+        void* ptr = chunk;
+        hg_size_t size = CHUNK_BYTES;
+        if(margo_bulk_create(pool->mid, 1, &ptr, &size, HG_BULK_READ_ONLY, bulk) != HG_SUCCESS) {
+            free(chunk);
+            return NULL;
+        }
+    }
+
+    ABT_mutex_lock(pool->mutex);
+    pool->num_allocated++;
+    ABT_mutex_unlock(pool->mutex);
+    return chunk;
+}
+
+static void chunk_pool_put(symbiomon_chunk_pool* pool, void* ptr, hg_bulk_t bulk)
+{
+    free_chunk* chunk = (free_chunk*)ptr;
+    ABT_mutex_lock(pool->mutex);
+    chunk->next = (free_chunk*)pool->free_list;
+    chunk->bulk = bulk;
+    pool->free_list = chunk;
+    pool->num_free++;
+    ABT_mutex_unlock(pool->mutex);
+}
+
+symbiomon_return_t symbiomon_series_init(symbiomon_series* s, uint64_t capacity, symbiomon_metric_layout_t layout, symbiomon_chunk_pool* pool)
+{
+    if(capacity == 0)
+        return SYMBIOMON_ERR_INVALID_ARGS;
+
+    s->num_chunks = (capacity + SYMBIOMON_CHUNK_SIZE - 1) >> SYMBIOMON_CHUNK_SHIFT;
+    s->chunks = (void**)calloc(s->num_chunks, sizeof(*s->chunks));
+    s->bulks = (hg_bulk_t*)calloc(s->num_chunks, sizeof(*s->bulks));
+    if(!s->chunks || !s->bulks) {
+        free(s->chunks);
+        free(s->bulks);
+        return SYMBIOMON_ERR_ALLOCATION;
+    }
+
+    s->capacity = capacity;
+    s->count = 0;
+    s->layout = layout;
+    s->pool = pool;
+    return SYMBIOMON_SUCCESS;
+}
+
+void symbiomon_series_finalize(symbiomon_series* s)
+{
+    size_t i;
+    for(i = 0; i < s->num_chunks; i++) {
+        if(s->chunks[i])
+            chunk_pool_put(s->pool, s->chunks[i], s->bulks[i]);
+    }
+    free(s->chunks);
+    free(s->bulks);
+    s->chunks = NULL;
+    s->bulks = NULL;
+    s->num_chunks = 0;
+    s->capacity = 0;
+    s->count = 0;
+}
+
+symbiomon_return_t symbiomon_series_reserve(symbiomon_series* s)
+{
+    uint64_t c = (s->count % s->capacity) >> SYMBIOMON_CHUNK_SHIFT;
+    if(s->chunks[c])
+        return SYMBIOMON_SUCCESS;
+
+    hg_bulk_t bulk;
+    void* chunk = chunk_pool_get(s->pool, &bulk);
+    if(!chunk)
+        return SYMBIOMON_ERR_ALLOCATION;
+
+    /* another ULT of the writing execution stream may have reserved
+     * the same chunk while we were waiting on the pool */
+    if(s->chunks[c]) {
+        chunk_pool_put(s->pool, chunk, bulk);
+    } else {
+        s->bulks[c] = bulk;
+        s->chunks[c] = chunk;
+    }
+    return SYMBIOMON_SUCCESS;
+}
+
+symbiomon_return_t symbiomon_series_expose(symbiomon_series* s, margo_instance_id mid, hg_bulk_t* bulk)
+{
+    size_t i;
+    uint32_t num_segments = s->num_chunks + 1;
+    void** ptrs = (void**)malloc(num_segments*sizeof(*ptrs));
+    hg_size_t* sizes = (hg_size_t*)malloc(num_segments*sizeof(*sizes));
+    symbiomon_return_t ret = SYMBIOMON_SUCCESS;
+    if(!ptrs || !sizes) {
+        ret = SYMBIOMON_ERR_ALLOCATION;
+        goto done;
+    }
+
+    /* chunks must not move once remote readers know about them */
+    for(i = 0; i < s->num_chunks; i++) {
+        if(!s->chunks[i]) {
+            s->chunks[i] = chunk_pool_get(s->pool, &s->bulks[i]);
+            if(!s->chunks[i]) {
+                ret = SYMBIOMON_ERR_ALLOCATION;
+                goto done;
+            }
+        }
+    }
+
+    ptrs[0] = &s->count;
+    sizes[0] = sizeof(s->count);
+    for(i = 0; i < s->num_chunks; i++) {
+        ptrs[i+1] = s->chunks[i];
+        sizes[i+1] = CHUNK_BYTES;
+    }
+    if(margo_bulk_create(mid, num_segments, ptrs, sizes, HG_BULK_READ_ONLY, bulk) != HG_SUCCESS)
+        ret = SYMBIOMON_ERR_FROM_MERCURY;
+
+done:
+    free(ptrs);
+    free(sizes);
+    return ret;
+}
+
+size_t symbiomon_series_span(const symbiomon_series* s, uint64_t seq, size_t n)
+{
+    uint64_t slot = seq % s->capacity;
+    uint64_t left_in_chunk = SYMBIOMON_CHUNK_SIZE - (slot & SYMBIOMON_CHUNK_MASK);
+    uint64_t left_in_ring = s->capacity - slot;
+
+    if(n > left_in_chunk) n = left_in_chunk;
+    if(n > left_in_ring) n = left_in_ring;
+    return n;
+}
+
+size_t symbiomon_series_values(const symbiomon_series* s, uint64_t seq, size_t n, double* scratch, size_t scratch_len, const double** vals)
+{
+    size_t i, off;
+    void* chunk = symbiomon_series_chunk(s, seq, &off);
+
+    n = symbiomon_series_span(s, seq, n);
+    if(s->layout == SYMBIOMON_LAYOUT_COLUMNS) {
+        *vals = (double*)chunk + off;
+    } else {
+        if(n > scratch_len) n = scratch_len;
+        symbiomon_metric_sample* run = (symbiomon_metric_sample*)chunk + off;
+        for(i = 0; i < n; i++)
+            scratch[i] = run[i].val;
+        *vals = scratch;
+    }
+    return n;
+}
+
+/* first sequence number in [first, end) whose time is above t (or at t
+ * if inclusive) */
+static uint64_t search_time(const symbiomon_series* s, uint64_t first, uint64_t end, double t, int inclusive)
+{
+    while(first < end) {
+        uint64_t mid = first + (end - first)/2;
+        double time = symbiomon_series_time(s, mid);
+        if(time > t || (inclusive && time == t))
+            end = mid;
+        else
+            first = mid + 1;
+    }
+    return first;
+}
+
+uint64_t symbiomon_series_after(const symbiomon_series* s, uint64_t first, uint64_t end, double t)
+{
+    return search_time(s, first, end, t, 0);
+}
+
+uint64_t symbiomon_series_from(const symbiomon_series* s, uint64_t first, uint64_t end, double t)
+{
+    return search_time(s, first, end, t, 1);
+}
+
+/* clips [first, first+n) to the retained window, returns the clipped length */
+static size_t clip_window(const symbiomon_series* s, uint64_t* first, size_t n)
+{
+    uint64_t count = symbiomon_series_count(s);
+    uint64_t oldest = count > s->capacity ? count - s->capacity : 0;
+    if(*first < oldest) *first = oldest;
+    if(*first >= count) return 0;
+    if(n > count - *first) n = count - *first;
+    return n;
+}
+
+/*
+ * A writer only starts storing sample c, which replaces sample
+ * c-capacity, after the count has reached c and a release fence. So if
+ * the count read after the copy is c, every sample from c+1-capacity
+ * onwards was left untouched.
+ */
+size_t symbiomon_series_torn(const symbiomon_series* s, uint64_t first, size_t n)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    uint64_t count = symbiomon_series_count(s);
+    if(count + 1 <= s->capacity || first >= count + 1 - s->capacity)
+        return 0;
+    uint64_t torn = count + 1 - s->capacity - first;
+    return torn < n ? torn : n;
+}
+
+size_t symbiomon_series_copy(const symbiomon_series* s, uint64_t first, size_t n, symbiomon_metric_sample* out)
+{
+    size_t i, off, len, copied = 0;
+
+    n = clip_window(s, &first, n);
+    while(copied < n) {
+        void* chunk = symbiomon_series_chunk(s, first + copied, &off);
+        len = symbiomon_series_span(s, first + copied, n - copied);
+        if(s->layout == SYMBIOMON_LAYOUT_COLUMNS) {
+            for(i = 0; i < len; i++) {
+                out[copied + i].val       = ((double*)chunk)[off + i];
+                out[copied + i].time      = ((double*)chunk)[SYMBIOMON_CHUNK_SIZE + off + i];
+                out[copied + i].sample_id = ((uint64_t*)chunk)[2*SYMBIOMON_CHUNK_SIZE + off + i];
+            }
+        } else {
+            memcpy(out + copied, (symbiomon_metric_sample*)chunk + off, len*sizeof(symbiomon_metric_sample));
+        }
+        copied += len;
+    }
+
+    size_t torn = symbiomon_series_torn(s, first, n);
+    if(torn) {
+        n -= torn;
+        memmove(out, out + torn, n*sizeof(*out));
+    }
+    return n;
+}
+
+size_t symbiomon_series_copy_columns(const symbiomon_series* s, uint64_t first, size_t n, double* vals, double* times, uint64_t* ids)
+{
+    size_t i, off, len, copied = 0;
+
+    n = clip_window(s, &first, n);
+    while(copied < n) {
+        void* chunk = symbiomon_series_chunk(s, first + copied, &off);
+        len = symbiomon_series_span(s, first + copied, n - copied);
+        if(s->layout == SYMBIOMON_LAYOUT_COLUMNS) {
+            if(vals)  memcpy(vals + copied, (double*)chunk + off, len*sizeof(double));
+            if(times) memcpy(times + copied, (double*)chunk + SYMBIOMON_CHUNK_SIZE + off, len*sizeof(double));
+            if(ids)   memcpy(ids + copied, (uint64_t*)chunk + 2*SYMBIOMON_CHUNK_SIZE + off, len*sizeof(uint64_t));
+        } else {
+            symbiomon_metric_sample* run = (symbiomon_metric_sample*)chunk + off;
+            for(i = 0; i < len; i++) {
+                if(vals)  vals[copied + i]  = run[i].val;
+                if(times) times[copied + i] = run[i].time;
+                if(ids)   ids[copied + i]   = run[i].sample_id;
+            }
+        }
+        copied += len;
+    }
+
+    size_t torn = symbiomon_series_torn(s, first, n);
+    if(torn) {
+        n -= torn;
+        if(vals)  memmove(vals, vals + torn, n*sizeof(*vals));
+        if(times) memmove(times, times + torn, n*sizeof(*times));
+        if(ids)   memmove(ids, ids + torn, n*sizeof(*ids));
+    }
+    return n;
+}
+
+size_t symbiomon_series_merge(const symbiomon_series* const* series, const uint64_t* first, const uint64_t* end, size_t num, size_t n, symbiomon_metric_sample* out)
+{
+    size_t i, j, total = 0;
+    size_t* len = (size_t*)calloc(num, sizeof(*len));
+    symbiomon_metric_sample** runs = (symbiomon_metric_sample**)calloc(num, sizeof(*runs));
+    symbiomon_metric_sample* tmp = NULL;
+    if(!len || !runs) {
+        n = 0;
+        goto done;
+    }
+
+    /* only the last n samples of each range can make it into the output */
+    for(i = 0; i < num; i++) {
+        len[i] = end[i] - first[i];
+        if(len[i] > n) len[i] = n;
+        total += len[i];
+    }
+    tmp = (symbiomon_metric_sample*)malloc(total*sizeof(*tmp));
+    if(total && !tmp) {
+        n = 0;
+        goto done;
+    }
+    total = 0;
+    for(i = 0; i < num; i++) {
+        runs[i] = tmp + total;
+        len[i] = symbiomon_series_copy(series[i], end[i] - len[i], len[i], runs[i]);
+        total += len[i];
+    }
+    if(n > total) n = total;
+
+    /* each run is ordered by time: fill the output from its end by
+     * repeatedly taking the most recent of the remaining samples */
+    for(j = n; j-- > 0; ) {
+        size_t best = num;
+        for(i = 0; i < num; i++) {
+            if(len[i] && (best == num || runs[i][len[i]-1].time > runs[best][len[best]-1].time))
+                best = i;
+        }
+        out[j] = runs[best][--len[best]];
+    }
+
+done:
+    free(tmp);
+    free(runs);
+    free(len);
+    return n;
+}
+
+void symbiomon_series_summarize(const symbiomon_series* s, uint64_t first, uint64_t end, symbiomon_summary* out)
+{
+    const symbiomon_kernels* k = symbiomon_kernels_get();
+    double scratch[VALUE_SCRATCH_SIZE];
+    const double* vals;
+    symbiomon_summary part;
+    size_t n;
+
+    for(; first < end; first += n) {
+        n = symbiomon_series_values(s, first, end - first, scratch, VALUE_SCRATCH_SIZE, &vals);
+        k->summary(vals, n, &part);
+        symbiomon_summary_merge(out, &part);
+    }
+}
@@ -0,0 +1,231 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#ifndef _SERIES_H
+#define _SERIES_H
+
+#include <stddef.h>
+#include <abt.h>
+#include <margo.h>
+#include "symbiomon/symbiomon-common.h"
+#include "kernels.h"
+
+/* number of samples per chunk of storage (must be a power of 2) */
+#define SYMBIOMON_CHUNK_SHIFT 10
+#define SYMBIOMON_CHUNK_SIZE  (1 << SYMBIOMON_CHUNK_SHIFT)
+#define SYMBIOMON_CHUNK_MASK  (SYMBIOMON_CHUNK_SIZE - 1)
+
+/*
+ * Provider-wide pool of fixed-size chunks. Chunks released by
+ * destroyed metrics are kept on a free list and handed out again
+ * before any new memory is allocated. When the pool has a margo
+ * instance, each chunk is registered as a bulk region when it is
+ * first allocated and keeps that registration until the pool is
+ * finalized, so fetches can push samples straight out of the ring.
+ */
+typedef struct symbiomon_chunk_pool {
+    ABT_mutex         mutex;
+    margo_instance_id mid;             /* registers chunks, may be MARGO_INSTANCE_NULL */
+    void*             free_list;       /* singly-linked list of free chunks */
+    size_t            num_free;        /* number of chunks in the free list */
+    size_t            num_allocated;   /* number of chunks allocated overall */
+} symbiomon_chunk_pool;
+
+symbiomon_return_t symbiomon_chunk_pool_init(symbiomon_chunk_pool* pool, margo_instance_id mid);
+
+void symbiomon_chunk_pool_finalize(symbiomon_chunk_pool* pool);
+
+/*
+ * Fixed-capacity ring of samples. Samples are addressed by a
+ * monotonically increasing sequence number; only the last
+ * "capacity" samples are retained, older ones are overwritten.
+ * The ring is made of chunks taken from the pool the first time
+ * a sample is written into them, so memory follows the number
+ * of samples actually recorded.
+ *
+ * With SYMBIOMON_LAYOUT_ROWS a chunk is an array of samples; with
+ * SYMBIOMON_LAYOUT_COLUMNS the same chunk holds the values, then the
+ * timestamps, then the sample ids, each as a contiguous column.
+ */
+typedef struct symbiomon_series {
+    void**     chunks;
+    hg_bulk_t* bulks;     /* bulk handle of each chunk, if the pool registers them */
+    size_t     num_chunks;
+    uint64_t   capacity;  /* maximum number of retained samples */
+    uint64_t   count;     /* total number of samples ever appended */
+    symbiomon_metric_layout_t layout;
+    symbiomon_chunk_pool* pool;
+} symbiomon_series;
+
+/*
+ * Series appended to without locking by the ULTs of a single execution
+ * stream. Shards are cache-line aligned so that execution streams
+ * updating neighbouring shards do not contend on the same line.
+ */
+typedef struct symbiomon_shard {
+    symbiomon_series series;
+    uint64_t reduced_index;  /* reduction cursor within this shard */
+} __attribute__((aligned(64))) symbiomon_shard;
+
+symbiomon_return_t symbiomon_series_init(symbiomon_series* s, uint64_t capacity, symbiomon_metric_layout_t layout, symbiomon_chunk_pool* pool);
+
+void symbiomon_series_finalize(symbiomon_series* s);
+
+/* Copies up to n samples starting at sequence number first into out,
+ * handling the wraparound. Returns the number of samples copied.
+ * Readers do not lock the series: once the copy is done, the samples
+ * that a concurrent writer may have overwritten in the meantime are
+ * dropped from the front of the output, so what is returned is always
+ * a consistent, possibly shorter, run of the most recent samples
+ * (see symbiomon_series_torn). */
+size_t symbiomon_series_copy(const symbiomon_series* s, uint64_t first, size_t n, symbiomon_metric_sample* out);
+
+/* Same as symbiomon_series_copy but fills separate value, time and
+ * sample id arrays, any of which may be NULL to skip that column. */
+size_t symbiomon_series_copy_columns(const symbiomon_series* s, uint64_t first, size_t n, double* vals, double* times, uint64_t* ids);
+
+/* Merges the samples in [first[i], end[i]) of each of the num series by
+ * timestamp and copies the last n of them into out (n at most the sum of
+ * the range lengths). Returns the number of samples copied. */
+size_t symbiomon_series_merge(const symbiomon_series* const* series, const uint64_t* first, const uint64_t* end, size_t num, size_t n, symbiomon_metric_sample* out);
+
+/* Folds the values in [first, end) into out with the vector kernels */
+void symbiomon_series_summarize(const symbiomon_series* s, uint64_t first, uint64_t end, symbiomon_summary* out);
+
+/* Returns how many samples (at most n) starting at sequence number seq
+ * are stored contiguously in the same chunk. */
+size_t symbiomon_series_span(const symbiomon_series* s, uint64_t seq, size_t n);
+
+/* Sets *vals to the values of the contiguous run starting at seq and
+ * returns its length (at most n). Columnar series point straight into
+ * their storage; row series copy at most scratch_len values into scratch. */
+size_t symbiomon_series_values(const symbiomon_series* s, uint64_t seq, size_t n, double* scratch, size_t scratch_len, const double** vals);
+
+/* Number of samples at the front of [first, first+n) that a concurrent
+ * writer may have overwritten since they were read. To be called once
+ * the samples have been copied or transferred out of the series. */
+size_t symbiomon_series_torn(const symbiomon_series* s, uint64_t first, size_t n);
+
+/* Allocates every chunk of the ring and registers the count followed by
+ * the chunks, in order, as a single bulk region that remote readers can
+ * pull from. Only meaningful for SYMBIOMON_LAYOUT_ROWS. The caller must
+ * hold the lock protecting the series. */
+symbiomon_return_t symbiomon_series_expose(symbiomon_series* s, margo_instance_id mid, hg_bulk_t* bulk);
+
+/* First sequence number in [first, end) whose sample is more recent than
+ * time t, or end if there is none. The timestamps of a series never
+ * decrease, so this is a binary search. */
+uint64_t symbiomon_series_after(const symbiomon_series* s, uint64_t first, uint64_t end, double t);
+
+/* Same as symbiomon_series_after but also accepts samples taken at t */
+uint64_t symbiomon_series_from(const symbiomon_series* s, uint64_t first, uint64_t end, double t);
+
+/* Makes sure the chunk that will hold the next sample exists. */
+symbiomon_return_t symbiomon_series_reserve(symbiomon_series* s);
+
+/* sequence number of the oldest sample still retained */
+static inline uint64_t symbiomon_series_first(const symbiomon_series* s)
+{
+    return s->count > s->capacity ? s->count - s->capacity : 0;
+}
+
+/* number of samples currently retained */
+static inline uint64_t symbiomon_series_size(const symbiomon_series* s)
+{
+    return s->count - symbiomon_series_first(s);
+}
+
+static inline void* symbiomon_series_chunk(const symbiomon_series* s, uint64_t seq, size_t* offset)
+{
+    uint64_t slot = seq % s->capacity;
+    *offset = slot & SYMBIOMON_CHUNK_MASK;
+    return s->chunks[slot >> SYMBIOMON_CHUNK_SHIFT];
+}
+
+/* bulk handle of the chunk holding sequence number seq */
+static inline hg_bulk_t symbiomon_series_bulk(const symbiomon_series* s, uint64_t seq)
+{
+    return s->bulks[(seq % s->capacity) >> SYMBIOMON_CHUNK_SHIFT];
+}
+
+static inline double symbiomon_series_val(const symbiomon_series* s, uint64_t seq)
+{
+    size_t off;
+    void* chunk = symbiomon_series_chunk(s, seq, &off);
+    if(s->layout == SYMBIOMON_LAYOUT_COLUMNS)
+        return ((double*)chunk)[off];
+    return ((symbiomon_metric_sample*)chunk)[off].val;
+}
+
+static inline double symbiomon_series_time(const symbiomon_series* s, uint64_t seq)
+{
+    size_t off;
+    void* chunk = symbiomon_series_chunk(s, seq, &off);
+    if(s->layout == SYMBIOMON_LAYOUT_COLUMNS)
+        return ((double*)chunk)[SYMBIOMON_CHUNK_SIZE + off];
+    return ((symbiomon_metric_sample*)chunk)[off].time;
+}
+
+static inline void symbiomon_series_get(const symbiomon_series* s, uint64_t seq, symbiomon_metric_sample* sample)
+{
+    size_t off;
+    void* chunk = symbiomon_series_chunk(s, seq, &off);
+    if(s->layout == SYMBIOMON_LAYOUT_COLUMNS) {
+        sample->val       = ((double*)chunk)[off];
+        sample->time      = ((double*)chunk)[SYMBIOMON_CHUNK_SIZE + off];
+        sample->sample_id = ((uint64_t*)chunk)[2*SYMBIOMON_CHUNK_SIZE + off];
+    } else {
+        *sample = ((symbiomon_metric_sample*)chunk)[off];
+    }
+}
+
+/* value of the most recent sample, or dflt if the series is empty */
+static inline double symbiomon_series_last_val(const symbiomon_series* s, double dflt)
+{
+    return s->count ? symbiomon_series_val(s, s->count - 1) : dflt;
+}
+
+/* number of samples appended so far, as seen from another execution stream */
+static inline uint64_t symbiomon_series_count(const symbiomon_series* s)
+{
+    return __atomic_load_n(&s->count, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Appends a sample. The caller either holds the lock protecting the
+ * series or is the only execution stream writing to it. In the latter
+ * case, reserving a chunk may block on the pool mutex and let another
+ * ULT of the same execution stream append first, so the chunk of the
+ * next slot is checked again after each reservation. Nothing yields
+ * once the slot is known.
+ */
+static inline symbiomon_return_t symbiomon_series_append(symbiomon_series* s, double val, double time, uint64_t sample_id)
+{
+    size_t off;
+    void* chunk;
+    while(!(chunk = symbiomon_series_chunk(s, s->count, &off))) {
+        symbiomon_return_t ret = symbiomon_series_reserve(s);
+        if(ret != SYMBIOMON_SUCCESS) return ret;
+    }
+    /* the slot is about to be overwritten: readers copying it concurrently
+     * must find the current count advanced past it once they are done
+     * (see symbiomon_series_copy) */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    if(s->layout == SYMBIOMON_LAYOUT_COLUMNS) {
+        ((double*)chunk)[off] = val;
+        ((double*)chunk)[SYMBIOMON_CHUNK_SIZE + off] = time;
+        ((uint64_t*)chunk)[2*SYMBIOMON_CHUNK_SIZE + off] = sample_id;
+    } else {
+        symbiomon_metric_sample* sample = &((symbiomon_metric_sample*)chunk)[off];
+        sample->val = val;
+        sample->time = time;
+        sample->sample_id = sample_id;
+    }
+    /* publish the sample to readers on other execution streams */
+    __atomic_store_n(&s->count, s->count + 1, __ATOMIC_RELEASE);
+    return SYMBIOMON_SUCCESS;
+}
+
+#endif
@@ -13,8 +13,18 @@
 #include <mercury_proc_string.h>
 #include "symbiomon/symbiomon-common.h"
 #include "uthash.h"
+#include "series.h"
+#include "compress.h"
+#include "rollup.h"
+#include "histogram.h"
+#include "kernels.h"
+
+/* timestamps on the wire */
+typedef double symbiomon_time_t;
 
 static inline hg_return_t hg_proc_symbiomon_metric_id_t(hg_proc_t proc, symbiomon_metric_id_t *id);
+static inline hg_return_t hg_proc_symbiomon_time_t(hg_proc_t proc, symbiomon_time_t *t);
+static inline hg_return_t hg_proc_symbiomon_metric_aggregate(hg_proc_t proc, symbiomon_metric_aggregate *a);
 
 /* Admin RPC types */
 
@@ -64,6 +74,206 @@ MERCURY_GEN_PROC(metric_fetch_out_t,
 	((int64_t)(actual_count))\
         ((int32_t)(ret)))
 
+/* fetch whose samples may come back encoded; the plain fetch keeps its
+ * own types so that clients and providers predating encodings still
+ * understand each other */
+MERCURY_GEN_PROC(metric_fetch_encoded_in_t,
+        ((symbiomon_metric_id_t)(metric_id))\
+	((int64_t)(count))\
+	((uint32_t)(encoding))\
+	((hg_bulk_t)(bulk)))
+
+MERCURY_GEN_PROC(metric_fetch_encoded_out_t,
+	((int64_t)(actual_count))\
+	((uint32_t)(encoding))\
+	((uint64_t)(payload_size))\
+        ((int32_t)(ret)))
+
+MERCURY_GEN_PROC(metric_fetch_columns_in_t,
+        ((symbiomon_metric_id_t)(metric_id))\
+	((int64_t)(count))\
+	((uint32_t)(columns))\
+	((hg_bulk_t)(bulk)))
+
+MERCURY_GEN_PROC(metric_fetch_since_in_t,
+        ((symbiomon_metric_id_t)(metric_id))\
+	((int64_t)(count))\
+	((uint8_t)(by_time))\
+	((uint64_t)(cursor))\
+	((symbiomon_time_t)(since))\
+	((hg_bulk_t)(bulk)))
+
+MERCURY_GEN_PROC(metric_fetch_since_out_t,
+	((int64_t)(actual_count))\
+	((int64_t)(skipped))\
+	((uint64_t)(dropped))\
+	((uint64_t)(next_cursor))\
+	((symbiomon_time_t)(next_since))\
+        ((int32_t)(ret)))
+
+MERCURY_GEN_PROC(metric_fetch_range_in_t,
+        ((symbiomon_metric_id_t)(metric_id))\
+	((int64_t)(count))\
+	((symbiomon_time_t)(t0))\
+	((symbiomon_time_t)(t1))\
+	((hg_bulk_t)(bulk)))
+
+MERCURY_GEN_PROC(metric_fetch_downsampled_in_t,
+        ((symbiomon_metric_id_t)(metric_id))\
+	((int64_t)(count))\
+	((uint32_t)(mode))\
+	((hg_bulk_t)(bulk)))
+
+MERCURY_GEN_PROC(metric_aggregate_in_t,
+        ((symbiomon_metric_id_t)(metric_id))\
+	((symbiomon_time_t)(t0))\
+	((symbiomon_time_t)(t1)))
+
+MERCURY_GEN_PROC(metric_aggregate_out_t,
+	((symbiomon_metric_aggregate)(aggregate))\
+        ((int32_t)(ret)))
+
+MERCURY_GEN_PROC(metric_fetch_rollup_in_t,
+        ((symbiomon_metric_id_t)(metric_id))\
+	((int64_t)(count))\
+	((symbiomon_time_t)(t0))\
+	((symbiomon_time_t)(t1))\
+	((symbiomon_time_t)(resolution))\
+	((hg_bulk_t)(bulk)))
+
+MERCURY_GEN_PROC(metric_fetch_rollup_out_t,
+	((int64_t)(actual_count))\
+	((symbiomon_time_t)(period))\
+        ((int32_t)(ret)))
+
+MERCURY_GEN_PROC(metric_fetch_histogram_in_t,
+        ((symbiomon_metric_id_t)(metric_id))\
+	((hg_bulk_t)(bulk)))
+
+MERCURY_GEN_PROC(metric_fetch_histogram_out_t,
+        ((int32_t)(ret)))
+
+MERCURY_GEN_PROC(subscribe_in_t,
+        ((uint64_t)(token))\
+	((uint16_t)(callback_provider_id))\
+	((uint32_t)(filter))\
+	((symbiomon_metric_id_t)(metric_id))\
+	((hg_const_string_t)(pattern))\
+	((symbiomon_time_t)(interval))\
+	((uint64_t)(batch_size)))
+
+MERCURY_GEN_PROC(subscribe_out_t,
+	((uint64_t)(id))\
+        ((int32_t)(ret)))
+
+MERCURY_GEN_PROC(unsubscribe_in_t,
+        ((uint64_t)(id)))
+
+MERCURY_GEN_PROC(unsubscribe_out_t,
+        ((int32_t)(ret)))
+
+/* samples pushed to a subscriber: ids[i] is the metric of samples[i],
+ * and the samples of a metric are contiguous and oldest first */
+typedef struct notify_in_t {
+    uint64_t token;
+    hg_size_t count;
+    symbiomon_metric_id_t* ids;
+    symbiomon_metric_sample* samples;
+} notify_in_t;
+
+static inline hg_return_t hg_proc_notify_in_t(hg_proc_t proc, void *data)
+{
+    notify_in_t* in = (notify_in_t*)data;
+    hg_return_t ret;
+
+    ret = hg_proc_uint64_t(proc, &(in->token));
+    if(ret != HG_SUCCESS) return ret;
+
+    ret = hg_proc_hg_size_t(proc, &(in->count));
+    if(ret != HG_SUCCESS) return ret;
+
+    switch(hg_proc_get_op(proc)) {
+    case HG_DECODE:
+        in->ids = (symbiomon_metric_id_t*)calloc(in->count, sizeof(*(in->ids)));
+        in->samples = (symbiomon_metric_sample*)calloc(in->count, sizeof(*(in->samples)));
+        if(in->count && (!in->ids || !in->samples)) return HG_NOMEM;
+        /* fall through */
+    case HG_ENCODE:
+        ret = hg_proc_memcpy(proc, in->ids, sizeof(*(in->ids))*in->count);
+        if(ret != HG_SUCCESS) return ret;
+        ret = hg_proc_memcpy(proc, in->samples, sizeof(*(in->samples))*in->count);
+        break;
+    case HG_FREE:
+        free(in->ids);
+        free(in->samples);
+        break;
+    }
+    return ret;
+}
+
+MERCURY_GEN_PROC(notify_out_t,
+        ((int32_t)(ret)))
+
+/* input of a multi-metric fetch: the ids and the number of samples
+ * requested for each metric, and the client's packed bulk */
+typedef struct metrics_fetch_multi_in_t {
+    hg_size_t num_metrics;
+    symbiomon_metric_id_t* ids;
+    int64_t* counts;
+    hg_bulk_t bulk;
+} metrics_fetch_multi_in_t;
+
+static inline hg_return_t hg_proc_metrics_fetch_multi_in_t(hg_proc_t proc, void *data)
+{
+    metrics_fetch_multi_in_t* in = (metrics_fetch_multi_in_t*)data;
+    hg_return_t ret;
+
+    ret = hg_proc_hg_size_t(proc, &(in->num_metrics));
+    if(ret != HG_SUCCESS) return ret;
+
+    switch(hg_proc_get_op(proc)) {
+    case HG_DECODE:
+        in->ids = (symbiomon_metric_id_t*)calloc(in->num_metrics, sizeof(*(in->ids)));
+        in->counts = (int64_t*)calloc(in->num_metrics, sizeof(*(in->counts)));
+        if(in->num_metrics && (!in->ids || !in->counts)) return HG_NOMEM;
+        /* fall through */
+    case HG_ENCODE:
+        ret = hg_proc_memcpy(proc, in->ids, sizeof(*(in->ids))*in->num_metrics);
+        if(ret != HG_SUCCESS) return ret;
+        ret = hg_proc_memcpy(proc, in->counts, sizeof(*(in->counts))*in->num_metrics);
+        if(ret != HG_SUCCESS) return ret;
+        break;
+    case HG_FREE:
+        free(in->ids);
+        free(in->counts);
+        break;
+    }
+    return hg_proc_hg_bulk_t(proc, &(in->bulk));
+}
+
+MERCURY_GEN_PROC(metrics_fetch_multi_out_t,
+        ((int32_t)(ret)))
+
+/*
+ * The client's bulk for a multi-metric fetch holds one index entry per
+ * metric followed by the samples of all the metrics, packed in order.
+ */
+typedef struct metric_fetch_index {
+    uint64_t offset;   /* first sample of the metric in the packed samples */
+    int64_t  count;    /* number of valid samples */
+    int64_t  skipped;  /* samples before them overwritten while being pushed */
+    int64_t  ret;      /* symbiomon_return_t for this metric */
+} metric_fetch_index;
+
+MERCURY_GEN_PROC(metric_expose_in_t,
+        ((symbiomon_metric_id_t)(metric_id)))
+
+MERCURY_GEN_PROC(metric_expose_out_t,
+	((uint64_t)(capacity))\
+	((uint64_t)(chunk_size))\
+	((hg_bulk_t)(bulk))\
+        ((int32_t)(ret)))
+
 /* Extra hand-coded serialization functions */
 
 static inline hg_return_t hg_proc_symbiomon_metric_id_t(
@@ -72,11 +282,40 @@ static inline hg_return_t hg_proc_symbiomon_metric_id_t(
     return hg_proc_memcpy(proc, id, sizeof(*id));
 }
 
+static inline hg_return_t hg_proc_symbiomon_time_t(
+        hg_proc_t proc, symbiomon_time_t *t)
+{
+    return hg_proc_memcpy(proc, t, sizeof(*t));
+}
+
+static inline hg_return_t hg_proc_symbiomon_metric_aggregate(
+        hg_proc_t proc, symbiomon_metric_aggregate *a)
+{
+    return hg_proc_memcpy(proc, a, sizeof(*a));
+}
+
 typedef struct symbiomon_metric {
     symbiomon_metric_type_t type;
     symbiomon_metric_reduction_op_t reduction_op;
-    symbiomon_metric_buffer buffer;
-    unsigned int buffer_index;
+    symbiomon_metric_stats_scope_t reduction_scope;
+    symbiomon_series series; /* ring of the most recent samples */
+    symbiomon_history history;  /* compressed samples older than the ring, if enabled */
+    symbiomon_rollup_tier rollups[SYMBIOMON_MAX_ROLLUPS]; /* by increasing period */
+    size_t num_rollups;
+    symbiomon_histogram* histogram;         /* buckets of a histogram metric, instead of samples */
+    symbiomon_histogram* reduced_histogram; /* copy as of the last interval reduction, if any */
+    symbiomon_shard* shards;    /* lock-free per-xstream series, if any */
+    size_t num_shards;
+    uint64_t reduced_index;     /* reduction cursor: first sample not yet reduced */
+    symbiomon_summary reduced;  /* statistics of every sample before the cursor */
+    symbiomon_summary interval; /* statistics of the samples after the cursor */
+    uint64_t increments;        /* fast-path counter, only accessed atomically */
+    uint64_t materialized;      /* value of increments last recorded in the series */
+    ABT_thread snapshot_ult;    /* periodically records increments, if any */
+    ABT_cond snapshot_cond;
+    double snapshot_interval;
+    int snapshot_stop;
+    hg_bulk_t exposed;          /* count and ring registered for one-sided pulls, if any */
     char desc[200];
     char name[128];
     char ns[128];
@@ -92,4 +331,57 @@ typedef struct symbiomon_metric {
 
 typedef symbiomon_metric* symbiomon_metric_t;
 
+/* i-th series of a metric: 0 is the locked series, 1 to num_shards the shards */
+static inline symbiomon_series* symbiomon_metric_series(symbiomon_metric* m, size_t i)
+{
+    return i ? &m->shards[i-1].series : &m->series;
+}
+
+/* appends a sample to the locked series, or counts it in the buckets of a
+ * histogram metric, and folds it into the running statistics; must be
+ * called with the metric's mutex held */
+static inline symbiomon_return_t symbiomon_metric_record(symbiomon_metric* m, double val, double time, ABT_unit_id self_id)
+{
+    symbiomon_series* s = &m->series;
+    if(m->histogram) {
+        symbiomon_histogram_add(m->histogram, val);
+        symbiomon_summary_add(&m->interval, val);
+        return SYMBIOMON_SUCCESS;
+    }
+
+    /* compress the oldest block of a full ring before it gets overwritten,
+     * the cost noted at symbiomon_metric_args; if that fails the block is
+     * only missing from the history */
+    if(m->history.capacity && s->count >= s->capacity) {
+        uint64_t block = s->capacity < SYMBIOMON_CHUNK_SIZE ? s->capacity : SYMBIOMON_CHUNK_SIZE;
+        if((s->count - s->capacity) % block == 0)
+            symbiomon_history_seal(&m->history, s, s->count - s->capacity, block);
+    }
+
+    symbiomon_return_t ret = symbiomon_series_append(s, val, time, self_id);
+    if(ret != SYMBIOMON_SUCCESS) return ret;
+
+    size_t i;
+    for(i = 0; i < m->num_rollups; i++)
+        symbiomon_rollup_tier_add(&m->rollups[i], time, val);
+    symbiomon_summary_add(&m->interval, val);
+    return SYMBIOMON_SUCCESS;
+}
+
+/* records the value of the fast-path counter as a sample if it changed
+ * since it was last recorded; must be called with the metric's mutex held */
+static inline symbiomon_return_t symbiomon_metric_materialize(symbiomon_metric* m)
+{
+    ABT_unit_id self_id;
+    uint64_t v = __atomic_load_n(&m->increments, __ATOMIC_RELAXED);
+    if(v == m->materialized)
+        return SYMBIOMON_SUCCESS;
+
+    ABT_self_get_thread_id(&self_id);
+    symbiomon_return_t ret = symbiomon_metric_record(m, (double)v, ABT_get_wtime(), self_id);
+    if(ret == SYMBIOMON_SUCCESS)
+        m->materialized = v;
+    return ret;
+}
+
 #endif
@@ -0,0 +1,1256 @@
+/*
+ * (C) 2020 The University of Chicago
+ *
+ * See COPYRIGHT in top-level directory.
+ */
+#include <stdio.h>
+#include <margo.h>
+#include <symbiomon/symbiomon-server.h>
+#include <symbiomon/symbiomon-client.h>
+#include <symbiomon/symbiomon-metric.h>
+#include "munit/munit.h"
+
+struct test_context {
+    margo_instance_id    mid;
+    hg_addr_t            addr;
+    symbiomon_provider_t provider;
+    symbiomon_client_t   client;
+    symbiomon_taglist_t  taglist;
+};
+
+static const uint16_t provider_id = 42;
+
+static void* test_context_setup(const MunitParameter params[], void* user_data)
+{
+    (void) params;
+    (void) user_data;
+    symbiomon_return_t   ret;
+    margo_instance_id    mid;
+    hg_addr_t            addr;
+    symbiomon_provider_t provider;
+    symbiomon_client_t   client;
+    symbiomon_taglist_t  taglist;
+    // create margo instance
+    mid = margo_init("na+sm", MARGO_SERVER_MODE, 0, 0);
+    munit_assert_not_null(mid);
+    // get address of current process
+    hg_return_t hret = margo_addr_self(mid, &addr);
+    munit_assert_int(hret, ==, HG_SUCCESS);
+    // register symbiomon provider
+    struct symbiomon_provider_args args = SYMBIOMON_PROVIDER_ARGS_INIT;
+    ret = symbiomon_provider_register(
+            mid, provider_id, &args, &provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    // create a client
+    ret = symbiomon_client_init(mid, &client);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    // create a taglist shared by the test metrics
+    ret = symbiomon_taglist_create(&taglist, 1, "test");
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    // create test context
+    struct test_context* context = (struct test_context*)calloc(1, sizeof(*context));
+    munit_assert_not_null(context);
+    context->mid      = mid;
+    context->addr     = addr;
+    context->provider = provider;
+    context->client   = client;
+    context->taglist  = taglist;
+    return context;
+}
+
+static void test_context_tear_down(void* fixture)
+{
+    struct test_context* context = (struct test_context*)fixture;
+    symbiomon_client_finalize(context->client);
+    symbiomon_taglist_destroy(context->taglist);
+    // free address
+    margo_addr_free(context->mid, context->addr);
+    // we are not checking the return value of the above function with
+    // munit because we need margo_finalize to be called no matter what.
+    margo_finalize(context->mid);
+    free(context);
+}
+
+static MunitResult test_ring(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    symbiomon_metric_t m;
+    symbiomon_metric_id_t id;
+    symbiomon_metric_handle_t rh;
+    symbiomon_metric_buffer buf;
+    symbiomon_return_t ret;
+    int64_t count;
+    int i;
+    // create a metric that retains only 8 samples
+    struct symbiomon_metric_args args = SYMBIOMON_METRIC_ARGS_INIT;
+    args.capacity = 8;
+    ret = symbiomon_metric_create_with_args("test", "ring", SYMBIOMON_TYPE_GAUGE,
+            "ring metric", context->taglist, &m, context->provider, &args);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    // write more samples than the ring can hold
+    for(i = 0; i < 20; i++) {
+        ret = symbiomon_metric_update(m, (double)i);
+        munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    }
+    // fetch more than what is retained: only the last 8 samples come back
+    ret = symbiomon_remote_metric_get_id("test", "ring", context->taglist, &id);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_remote_metric_handle_create(context->client,
+            context->addr, provider_id, id, &rh);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    count = 100;
+    ret = symbiomon_remote_metric_fetch(rh, &count, &buf);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(count, ==, 8);
+    for(i = 0; i < count; i++)
+        munit_assert_double(buf[i].val, ==, (double)(12 + i));
+    free(buf);
+    // fetch a window smaller than what is retained
+    count = 3;
+    ret = symbiomon_remote_metric_fetch(rh, &count, &buf);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(count, ==, 3);
+    for(i = 0; i < count; i++)
+        munit_assert_double(buf[i].val, ==, (double)(17 + i));
+    free(buf);
+
+    ret = symbiomon_remote_metric_handle_release(rh);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_metric_destroy(m, context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_history(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    symbiomon_metric_t m;
+    symbiomon_metric_id_t id;
+    symbiomon_metric_handle_t rh;
+    symbiomon_metric_buffer buf;
+    symbiomon_return_t ret;
+    int64_t count;
+    int i;
+    // a ring of 1000 samples backed by 5000 compressed ones
+    struct symbiomon_metric_args args = SYMBIOMON_METRIC_ARGS_INIT;
+    args.capacity = 1000;
+    args.history_capacity = 5000;
+    ret = symbiomon_metric_create_with_args("test", "history", SYMBIOMON_TYPE_GAUGE,
+            "history metric", context->taglist, &m, context->provider, &args);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    for(i = 0; i < 10000; i++) {
+        ret = symbiomon_metric_update(m, (double)i);
+        munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    }
+    ret = symbiomon_remote_metric_get_id("test", "history", context->taglist, &id);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_remote_metric_handle_create(context->client,
+            context->addr, provider_id, id, &rh);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    // the fetch continues past the ring into the history
+    count = 100000;
+    ret = symbiomon_remote_metric_fetch(rh, &count, &buf);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(count, ==, 6000);
+    for(i = 0; i < count; i++)
+        munit_assert_double(buf[i].val, ==, (double)(4000 + i));
+    free(buf);
+
+    ret = symbiomon_remote_metric_handle_release(rh);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_metric_destroy(m, context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+
+    // a history smaller than a block still holds one
+    args.history_capacity = 10;
+    ret = symbiomon_metric_create_with_args("test", "history", SYMBIOMON_TYPE_GAUGE,
+            "history metric", context->taglist, &m, context->provider, &args);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    for(i = 0; i < 10000; i++)
+        symbiomon_metric_update(m, (double)i);
+    ret = symbiomon_remote_metric_handle_create(context->client,
+            context->addr, provider_id, id, &rh);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    count = 100000;
+    ret = symbiomon_remote_metric_fetch(rh, &count, &buf);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(count, ==, 2000);
+    munit_assert_double(buf[0].val, ==, 8000.0);
+    free(buf);
+
+    ret = symbiomon_remote_metric_handle_release(rh);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_metric_destroy(m, context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_rollup(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    symbiomon_metric_t m;
+    symbiomon_metric_id_t id;
+    symbiomon_metric_handle_t rh;
+    symbiomon_metric_aggregate agg;
+    symbiomon_rollup* buf;
+    symbiomon_return_t ret;
+    int64_t count;
+    double period, sum;
+    uint64_t total;
+    int i;
+    // a ring of 100 samples with 1 s and 60 s tiers
+    struct symbiomon_metric_args args = SYMBIOMON_METRIC_ARGS_INIT;
+    args.capacity = 100;
+    args.rollups[0].period = 1.0;
+    args.rollups[0].retention = 3600;
+    args.rollups[1].period = 60.0;
+    args.rollups[1].retention = 1440;
+    ret = symbiomon_metric_create_with_args("test", "rollup", SYMBIOMON_TYPE_GAUGE,
+            "rollup metric", context->taglist, &m, context->provider, &args);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    for(i = 0; i < 1000; i++) {
+        ret = symbiomon_metric_update(m, (double)i);
+        munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    }
+    ret = symbiomon_remote_metric_get_id("test", "rollup", context->taglist, &id);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_remote_metric_handle_create(context->client,
+            context->addr, provider_id, id, &rh);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    // the ring wrapped: the coarsest tier allowed still has every sample
+    count = 1000;
+    ret = symbiomon_remote_metric_fetch_rollup(rh, 0.0, 1e300, 60.0, &count, &buf, &period);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_double(period, ==, 60.0);
+    munit_assert_int(count, >, 0);
+    for(i = 0, total = 0, sum = 0.0; i < count; i++) {
+        total += buf[i].count;
+        sum += buf[i].sum;
+    }
+    munit_assert_int(total, ==, 1000);
+    munit_assert_double(sum, ==, 499500.0);
+    munit_assert_double(buf[count-1].max, ==, 999.0);
+    free(buf);
+    // no tier is fine enough: raw samples come back as single-sample buckets
+    count = 1000;
+    ret = symbiomon_remote_metric_fetch_rollup(rh, 0.0, 1e300, 0.5, &count, &buf, &period);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_double(period, ==, 0.0);
+    munit_assert_int(count, >, 0);
+    munit_assert_int(count, <=, 100);
+    for(i = 0; i < count; i++)
+        munit_assert_int(buf[i].count, ==, 1);
+    munit_assert_double(buf[count-1].sum, ==, 999.0);
+    free(buf);
+    // aggregates reaching past the ring are answered from a tier
+    ret = symbiomon_remote_metric_aggregate(rh, 0.0, 1e300, &agg);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(agg.stats.count, ==, 1000);
+    munit_assert_double(agg.stats.sum, ==, 499500.0);
+    munit_assert_double(agg.stats.min, ==, 0.0);
+    munit_assert_double(agg.stats.max, ==, 999.0);
+
+    ret = symbiomon_remote_metric_handle_release(rh);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_metric_destroy(m, context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_fetch_encoded(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    symbiomon_metric_t m;
+    symbiomon_metric_id_t id;
+    symbiomon_metric_handle_t rh;
+    symbiomon_metric_buffer raw, buf;
+    symbiomon_return_t ret;
+    int64_t raw_count, count;
+    int i;
+    ret = symbiomon_metric_create("test", "encoded", SYMBIOMON_TYPE_GAUGE,
+            "encoded metric", context->taglist, &m, context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    for(i = 0; i < 2000; i++)
+        symbiomon_metric_update(m, (double)(i % 10));
+    ret = symbiomon_remote_metric_get_id("test", "encoded", context->taglist, &id);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_remote_metric_handle_create(context->client,
+            context->addr, provider_id, id, &rh);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    raw_count = 2000;
+    ret = symbiomon_remote_metric_fetch(rh, &raw_count, &raw);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(raw_count, ==, 2000);
+    // encoded payloads are decoded into the same samples
+    ret = symbiomon_client_set_fetch_encoding(context->client, SYMBIOMON_ENCODING_BLOCK);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    count = 2000;
+    ret = symbiomon_remote_metric_fetch(rh, &count, &buf);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(count, ==, raw_count);
+    munit_assert_memory_equal(count*sizeof(*buf), buf, raw);
+    free(buf);
+    free(raw);
+    ret = symbiomon_client_set_fetch_encoding(context->client, SYMBIOMON_ENCODING_RAW);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+
+    ret = symbiomon_remote_metric_handle_release(rh);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_metric_destroy(m, context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_histogram(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    symbiomon_metric_t m;
+    symbiomon_metric_id_t id;
+    symbiomon_metric_handle_t rh;
+    symbiomon_histogram* local;
+    symbiomon_histogram* remote;
+    symbiomon_metric_stats stats;
+    symbiomon_return_t ret;
+    double p99;
+    int i;
+    ret = symbiomon_metric_create("test", "histogram", SYMBIOMON_TYPE_HISTOGRAM,
+            "histogram metric", context->taglist, &m, context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    // latencies of 1 to 10000 microseconds
+    for(i = 1; i <= 10000; i++) {
+        ret = symbiomon_metric_update(m, i*1e-6);
+        munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    }
+    ret = symbiomon_metric_update(m, -1.0);
+    munit_assert_int(ret, ==, SYMBIOMON_ERR_INVALID_VALUE);
+    ret = symbiomon_metric_get_stats(m, SYMBIOMON_STATS_LIFETIME, &stats);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(stats.count, ==, 10000);
+
+    ret = symbiomon_remote_metric_get_id("test", "histogram", context->taglist, &id);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_remote_metric_handle_create(context->client,
+            context->addr, provider_id, id, &rh);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    local  = (symbiomon_histogram*)malloc(sizeof(*local));
+    remote = (symbiomon_histogram*)malloc(sizeof(*remote));
+    ret = symbiomon_metric_get_histogram(m, local);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_remote_metric_fetch_histogram(rh, remote);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_memory_equal(sizeof(*local), local, remote);
+    munit_assert_int(remote->count, ==, 10000);
+    munit_assert_double(remote->min, ==, 1e-6);
+    munit_assert_double(remote->max, ==, 1e-2);
+    // percentiles are within the width of a bucket
+    p99 = symbiomon_histogram_quantile(remote, 0.99);
+    munit_assert_double(p99, >=, 9.9e-3*15/16);
+    munit_assert_double(p99, <=, 9.9e-3*17/16);
+    // merged histograms count the values of both
+    symbiomon_histogram_merge(remote, local);
+    munit_assert_int(remote->count, ==, 20000);
+    munit_assert_double(symbiomon_histogram_quantile(remote, 0.99), ==, p99);
+    free(local);
+    free(remote);
+
+    ret = symbiomon_remote_metric_handle_release(rh);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_metric_destroy(m, context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_sketch(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    symbiomon_metric_t m;
+    symbiomon_histogram* h;
+    symbiomon_histogram* merged;
+    symbiomon_return_t ret;
+    void* sketch;
+    size_t size;
+    int i;
+    ret = symbiomon_metric_create_with_reduction("test", "sketch", SYMBIOMON_TYPE_HISTOGRAM,
+            "sketch metric", context->taglist, &m, context->provider, SYMBIOMON_REDUCTION_OP_P99);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    for(i = 1; i <= 10000; i++) {
+        ret = symbiomon_metric_update(m, i*1e-6);
+        munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    }
+    h      = (symbiomon_histogram*)malloc(sizeof(*h));
+    merged = (symbiomon_histogram*)calloc(1, sizeof(*merged));
+    ret = symbiomon_metric_get_histogram(m, h);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    size = symbiomon_histogram_encode(h, &sketch);
+    munit_assert_int(size, >, 0);
+    munit_assert_int(size, <, sizeof(*h)/4);
+    // two ranks' sketches merge into the sum of their histograms
+    ret = symbiomon_histogram_merge_encoded(merged, sketch, size);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_histogram_merge_encoded(merged, sketch, size);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(merged->count, ==, 20000);
+    munit_assert_double(symbiomon_histogram_quantile(merged, 0.99), ==, symbiomon_histogram_quantile(h, 0.99));
+    symbiomon_histogram_merge(h, h);
+    munit_assert_memory_equal(sizeof(*h), h, merged);
+    // truncated sketches are rejected
+    ret = symbiomon_histogram_merge_encoded(merged, sketch, size - 1);
+    munit_assert_int(ret, ==, SYMBIOMON_ERR_INVALID_ARGS);
+    munit_assert_int(merged->count, ==, 20000);
+    free(sketch);
+    free(merged);
+    free(h);
+
+    ret = symbiomon_metric_destroy(m, context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    // gauges can go negative, which the sketch cannot count
+    ret = symbiomon_metric_create_with_reduction("test", "sketch", SYMBIOMON_TYPE_GAUGE,
+            "sketch metric", context->taglist, &m, context->provider, SYMBIOMON_REDUCTION_OP_P50);
+    munit_assert_int(ret, ==, SYMBIOMON_ERR_OP_UNSUPPORTED);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_columns(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    symbiomon_metric_t m;
+    symbiomon_metric_id_t id;
+    symbiomon_metric_handle_t rh;
+    symbiomon_metric_columns cols;
+    symbiomon_return_t ret;
+    int64_t count;
+    int i;
+    // create a metric stored column by column
+    struct symbiomon_metric_args args = SYMBIOMON_METRIC_ARGS_INIT;
+    args.layout = SYMBIOMON_LAYOUT_COLUMNS;
+    ret = symbiomon_metric_create_with_args("test", "columns", SYMBIOMON_TYPE_GAUGE,
+            "columnar metric", context->taglist, &m, context->provider, &args);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    for(i = 0; i < 10; i++) {
+        ret = symbiomon_metric_update(m, (double)i);
+        munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    }
+    ret = symbiomon_remote_metric_get_id("test", "columns", context->taglist, &id);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_remote_metric_handle_create(context->client,
+            context->addr, provider_id, id, &rh);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    // fetch only the values and the timestamps
+    count = 4;
+    ret = symbiomon_remote_metric_fetch_columns(rh, &count,
+            SYMBIOMON_COLUMN_VAL | SYMBIOMON_COLUMN_TIME, &cols);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(count, ==, 4);
+    munit_assert_null(cols.sample_id);
+    for(i = 0; i < count; i++) {
+        munit_assert_double(cols.val[i], ==, (double)(6 + i));
+        if(i) munit_assert_double(cols.time[i], >=, cols.time[i-1]);
+    }
+    free(cols.val);
+    free(cols.time);
+
+    ret = symbiomon_remote_metric_handle_release(rh);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_stats(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    symbiomon_metric_t m;
+    symbiomon_metric_stats stats;
+    symbiomon_return_t ret;
+    int i;
+    // statistics cover every sample, even those evicted from the ring
+    struct symbiomon_metric_args args = SYMBIOMON_METRIC_ARGS_INIT;
+    args.capacity = 4;
+    ret = symbiomon_metric_create_with_args("test", "stats", SYMBIOMON_TYPE_GAUGE,
+            "stats metric", context->taglist, &m, context->provider, &args);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    for(i = 1; i <= 10; i++) {
+        ret = symbiomon_metric_update(m, (double)i);
+        munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    }
+    ret = symbiomon_metric_get_stats(m, SYMBIOMON_STATS_LIFETIME, &stats);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(stats.count, ==, 10);
+    munit_assert_double(stats.sum, ==, 55.0);
+    munit_assert_double(stats.min, ==, 1.0);
+    munit_assert_double(stats.max, ==, 10.0);
+    munit_assert_double_equal(stats.mean, 5.5, 9);
+    munit_assert_double_equal(stats.variance, 8.25, 9);
+    // a reduction starts a new interval; lifetime statistics are kept
+    ret = symbiomon_metric_reduce(m, context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_metric_update(m, 11.0);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_metric_get_stats(m, SYMBIOMON_STATS_INTERVAL, &stats);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(stats.count, ==, 1);
+    munit_assert_double(stats.sum, ==, 11.0);
+    ret = symbiomon_metric_get_stats(m, SYMBIOMON_STATS_LIFETIME, &stats);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(stats.count, ==, 11);
+    munit_assert_double(stats.sum, ==, 66.0);
+    munit_assert_double_equal(stats.variance, 10.0, 9);
+
+    ret = symbiomon_metric_destroy(m, context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_shards(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    symbiomon_metric_t m;
+    symbiomon_metric_id_t id;
+    symbiomon_metric_handle_t rh;
+    symbiomon_metric_buffer buf;
+    symbiomon_metric_stats stats;
+    symbiomon_return_t ret;
+    int64_t count;
+    int i;
+    // the test runs on the primary execution stream, which gets shard 0
+    struct symbiomon_metric_args args = SYMBIOMON_METRIC_ARGS_INIT;
+    args.num_shards = 1;
+    ret = symbiomon_metric_create_with_args("test", "shards", SYMBIOMON_TYPE_GAUGE,
+            "sharded metric", context->taglist, &m, context->provider, &args);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    for(i = 0; i < 10; i++) {
+        ret = symbiomon_metric_update(m, (double)i);
+        munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    }
+    ret = symbiomon_metric_get_stats(m, SYMBIOMON_STATS_LIFETIME, &stats);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(stats.count, ==, 10);
+    munit_assert_double(stats.sum, ==, 45.0);
+
+    ret = symbiomon_remote_metric_get_id("test", "shards", context->taglist, &id);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_remote_metric_handle_create(context->client,
+            context->addr, provider_id, id, &rh);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    count = 10;
+    ret = symbiomon_remote_metric_fetch(rh, &count, &buf);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(count, ==, 10);
+    for(i = 0; i < count; i++)
+        munit_assert_double(buf[i].val, ==, (double)i);
+    free(buf);
+
+    ret = symbiomon_remote_metric_handle_release(rh);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_metric_destroy(m, context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_increment(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    symbiomon_metric_t m;
+    symbiomon_metric_id_t id;
+    symbiomon_metric_handle_t rh;
+    symbiomon_metric_buffer buf;
+    symbiomon_return_t ret;
+    int64_t count;
+    int i;
+    ret = symbiomon_metric_create("test", "increment", SYMBIOMON_TYPE_COUNTER,
+            "fast-path counter", context->taglist, &m, context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    for(i = 0; i < 5; i++) {
+        ret = symbiomon_metric_increment(m, 2);
+        munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    }
+    ret = symbiomon_remote_metric_get_id("test", "increment", context->taglist, &id);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_remote_metric_handle_create(context->client,
+            context->addr, provider_id, id, &rh);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    // increments become a single sample when the metric is fetched
+    count = 10;
+    ret = symbiomon_remote_metric_fetch(rh, &count, &buf);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(count, ==, 1);
+    munit_assert_double(buf[0].val, ==, 10.0);
+    free(buf);
+    // no new sample unless the counter changed
+    count = 10;
+    ret = symbiomon_remote_metric_fetch(rh, &count, &buf);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(count, ==, 1);
+    free(buf);
+    ret = symbiomon_metric_increment(m, 1);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    count = 10;
+    ret = symbiomon_remote_metric_fetch(rh, &count, &buf);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(count, ==, 2);
+    munit_assert_double(buf[1].val, ==, 11.0);
+    free(buf);
+
+    ret = symbiomon_remote_metric_handle_release(rh);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_metric_destroy(m, context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_batch(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    symbiomon_metric_t m[2];
+    symbiomon_metric_stats stats;
+    symbiomon_return_t ret;
+    double vals[] = { 1.0, 2.0, 3.0, 4.0 };
+    double decreasing[] = { 5.0, 4.0 };
+    double multi[] = { 5.0, 6.0 };
+    ret = symbiomon_metric_create("test", "batch1", SYMBIOMON_TYPE_COUNTER,
+            "batch metric", context->taglist, &m[0], context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_metric_create("test", "batch2", SYMBIOMON_TYPE_GAUGE,
+            "batch metric", context->taglist, &m[1], context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    // many values into one metric
+    ret = symbiomon_metric_update_batch(m[0], vals, 4);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    // a batch that breaks counter monotonicity is rejected as a whole
+    ret = symbiomon_metric_update_batch(m[0], decreasing, 2);
+    munit_assert_int(ret, ==, SYMBIOMON_ERR_INVALID_VALUE);
+    ret = symbiomon_metric_get_stats(m[0], SYMBIOMON_STATS_LIFETIME, &stats);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(stats.count, ==, 4);
+    munit_assert_double(stats.sum, ==, 10.0);
+    // one value into each of several metrics
+    ret = symbiomon_metrics_update_multi(m, multi, 2);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_metric_get_stats(m[1], SYMBIOMON_STATS_LIFETIME, &stats);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(stats.count, ==, 1);
+    munit_assert_double(stats.sum, ==, 6.0);
+
+    ret = symbiomon_metric_destroy(m[0], context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_metric_destroy(m[1], context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_pull(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    symbiomon_metric_t m;
+    symbiomon_metric_id_t id;
+    symbiomon_metric_handle_t rh;
+    symbiomon_metric_buffer buf;
+    symbiomon_return_t ret;
+    int64_t count;
+    int i;
+    // a ring spanning several chunks, so that pulls wrap around
+    struct symbiomon_metric_args args = SYMBIOMON_METRIC_ARGS_INIT;
+    args.capacity = 3000;
+    ret = symbiomon_metric_create_with_args("test", "pull", SYMBIOMON_TYPE_GAUGE,
+            "pulled metric", context->taglist, &m, context->provider, &args);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_remote_metric_get_id("test", "pull", context->taglist, &id);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_remote_metric_handle_create(context->client,
+            context->addr, provider_id, id, &rh);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_remote_metric_enable_pull(rh);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    // the first pull returns everything written so far
+    for(i = 0; i < 2500; i++)
+        symbiomon_metric_update(m, (double)i);
+    count = 10000;
+    ret = symbiomon_remote_metric_fetch(rh, &count, &buf);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(count, ==, 2500);
+    for(i = 0; i < count; i++)
+        munit_assert_double(buf[i].val, ==, (double)i);
+    free(buf);
+    // the next one only the samples appended since, across the wraparound
+    for(i = 2500; i < 4000; i++)
+        symbiomon_metric_update(m, (double)i);
+    count = 10000;
+    ret = symbiomon_remote_metric_fetch(rh, &count, &buf);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(count, ==, 1500);
+    for(i = 0; i < count; i++)
+        munit_assert_double(buf[i].val, ==, (double)(2500 + i));
+    free(buf);
+    // nothing new
+    count = 10000;
+    ret = symbiomon_remote_metric_fetch(rh, &count, &buf);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(count, ==, 0);
+    free(buf);
+
+    ret = symbiomon_remote_metric_handle_release(rh);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_metric_destroy(m, context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_since(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    symbiomon_metric_t m;
+    symbiomon_metric_id_t id;
+    symbiomon_metric_handle_t rh;
+    symbiomon_metric_buffer buf;
+    symbiomon_return_t ret;
+    uint64_t cursor = 0, dropped;
+    symbiomon_time_cursor since = { 0.0, 0 };
+    double batch[6];
+    int64_t count;
+    int i, total;
+    struct symbiomon_metric_args args = SYMBIOMON_METRIC_ARGS_INIT;
+    args.capacity = 8;
+    ret = symbiomon_metric_create_with_args("test", "since", SYMBIOMON_TYPE_GAUGE,
+            "cursor metric", context->taglist, &m, context->provider, &args);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_remote_metric_get_id("test", "since", context->taglist, &id);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_remote_metric_handle_create(context->client,
+            context->addr, provider_id, id, &rh);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    for(i = 0; i < 5; i++)
+        symbiomon_metric_update(m, (double)i);
+    // everything is new the first time
+    count = 100;
+    ret = symbiomon_remote_metric_fetch_since(rh, &cursor, &count, &buf, &dropped);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(count, ==, 5);
+    munit_assert_int(cursor, ==, 5);
+    munit_assert_int(dropped, ==, 0);
+    free(buf);
+    // samples 5 and 6 are overwritten before the next poll
+    for(i = 5; i < 15; i++) {
+        // keep the timestamp cursor below from landing between equal times
+        if(i == 11) margo_thread_sleep(context->mid, 1.0);
+        symbiomon_metric_update(m, (double)i);
+    }
+    count = 4;
+    ret = symbiomon_remote_metric_fetch_since(rh, &cursor, &count, &buf, &dropped);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(count, ==, 4);
+    munit_assert_int(cursor, ==, 11);
+    munit_assert_int(dropped, ==, 2);
+    for(i = 0; i < count; i++)
+        munit_assert_double(buf[i].val, ==, (double)(7 + i));
+    free(buf);
+    // a batch shares one timestamp, the time cursor resumes inside it
+    for(i = 0; i < 6; i++)
+        batch[i] = (double)(15 + i);
+    ret = symbiomon_metric_update_batch(m, batch, 6);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    total = 0;
+    do {
+        count = 3;
+        ret = symbiomon_remote_metric_fetch_since_time(rh, &since, &count, &buf);
+        munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+        for(i = 0; i < count; i++)
+            munit_assert_double(buf[i].val, ==, (double)(13 + total + i));
+        if(count)
+            munit_assert_double(since.time, ==, buf[count-1].time);
+        total += count;
+        free(buf);
+    } while(count);
+    munit_assert_int(total, ==, 8);
+
+    ret = symbiomon_remote_metric_handle_release(rh);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_metric_destroy(m, context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_multi(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    symbiomon_metric_t rows, cols;
+    symbiomon_metric_id_t ids[3];
+    int64_t counts[3] = { 10, 2, 4 };
+    symbiomon_metric_fetch_result results[3];
+    symbiomon_metric_buffer buf;
+    symbiomon_return_t ret;
+    int i;
+    // one metric pushed straight from its ring, one copied first
+    struct symbiomon_metric_args args = SYMBIOMON_METRIC_ARGS_INIT;
+    ret = symbiomon_metric_create_with_args("test", "multi_rows", SYMBIOMON_TYPE_GAUGE,
+            "row metric", context->taglist, &rows, context->provider, &args);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    args.layout = SYMBIOMON_LAYOUT_COLUMNS;
+    ret = symbiomon_metric_create_with_args("test", "multi_cols", SYMBIOMON_TYPE_GAUGE,
+            "column metric", context->taglist, &cols, context->provider, &args);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    for(i = 0; i < 5; i++) {
+        symbiomon_metric_update(rows, (double)i);
+        symbiomon_metric_update(cols, (double)(100 + i));
+    }
+    ret = symbiomon_remote_metric_get_id("test", "multi_rows", context->taglist, &ids[0]);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_remote_metric_get_id("test", "multi_cols", context->taglist, &ids[1]);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ids[2] = ids[0] ^ ids[1] ^ 1;
+    // a single round trip for all of them, unknown ids fail on their own
+    ret = symbiomon_remote_metrics_fetch_multi(context->client, context->addr, provider_id,
+            3, ids, counts, results, &buf);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(results[0].ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(results[0].count, ==, 5);
+    for(i = 0; i < results[0].count; i++)
+        munit_assert_double(results[0].samples[i].val, ==, (double)i);
+    munit_assert_int(results[1].ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(results[1].count, ==, 2);
+    for(i = 0; i < results[1].count; i++)
+        munit_assert_double(results[1].samples[i].val, ==, (double)(103 + i));
+    munit_assert_int(results[2].ret, ==, SYMBIOMON_ERR_INVALID_METRIC);
+    munit_assert_int(results[2].count, ==, 0);
+    free(buf);
+
+    ret = symbiomon_metric_destroy(rows, context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_metric_destroy(cols, context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_range(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    symbiomon_metric_t m;
+    symbiomon_metric_id_t id;
+    symbiomon_metric_handle_t rh;
+    symbiomon_metric_buffer buf, all;
+    symbiomon_return_t ret;
+    int64_t count;
+    int i;
+    struct symbiomon_metric_args args = SYMBIOMON_METRIC_ARGS_INIT;
+    args.capacity = 2000;
+    ret = symbiomon_metric_create_with_args("test", "range", SYMBIOMON_TYPE_GAUGE,
+            "range metric", context->taglist, &m, context->provider, &args);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    // wrap around so that the window spans the end of the ring
+    for(i = 0; i < 3000; i++)
+        symbiomon_metric_update(m, (double)i);
+    ret = symbiomon_remote_metric_get_id("test", "range", context->taglist, &id);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_remote_metric_handle_create(context->client,
+            context->addr, provider_id, id, &rh);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    count = 2000;
+    ret = symbiomon_remote_metric_fetch(rh, &count, &all);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(count, ==, 2000);
+    // the bounds are those of samples 1900 and 2100, both included
+    count = 1000;
+    ret = symbiomon_remote_metric_fetch_range(rh, all[900].time, all[1100].time, &count, &buf);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(count, >=, 201);
+    for(i = 0; i < count; i++) {
+        munit_assert_double(buf[i].time, >=, all[900].time);
+        munit_assert_double(buf[i].time, <=, all[1100].time);
+    }
+    munit_assert_double(buf[0].time, ==, all[900].time);
+    munit_assert_double(buf[count-1].time, ==, all[1100].time);
+    free(buf);
+    // nothing before the retained window
+    count = 1000;
+    ret = symbiomon_remote_metric_fetch_range(rh, 0.0, all[0].time - 1.0, &count, &buf);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(count, ==, 0);
+    free(buf);
+    free(all);
+
+    ret = symbiomon_remote_metric_handle_release(rh);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_metric_destroy(m, context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_aggregate(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    symbiomon_metric_t m;
+    symbiomon_metric_id_t id;
+    symbiomon_metric_handle_t rh;
+    symbiomon_metric_aggregate agg;
+    symbiomon_return_t ret;
+    int i;
+    ret = symbiomon_metric_create("test", "aggregate", SYMBIOMON_TYPE_GAUGE,
+            "aggregate metric", context->taglist, &m, context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    // values recorded out of order so that percentiles need sorting
+    for(i = 0; i < 100; i++)
+        symbiomon_metric_update(m, (double)((i*37)%100 + 1));
+    ret = symbiomon_remote_metric_get_id("test", "aggregate", context->taglist, &id);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_remote_metric_handle_create(context->client,
+            context->addr, provider_id, id, &rh);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_remote_metric_aggregate(rh, 0.0, 1e300, &agg);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(agg.stats.count, ==, 100);
+    munit_assert_double_equal(agg.stats.sum, 5050.0, 9);
+    munit_assert_double_equal(agg.stats.mean, 50.5, 9);
+    munit_assert_double(agg.stats.min, ==, 1.0);
+    munit_assert_double(agg.stats.max, ==, 100.0);
+    munit_assert_double(agg.p50, ==, 50.0);
+    munit_assert_double(agg.p90, ==, 90.0);
+    munit_assert_double(agg.p99, ==, 99.0);
+    // a window after the last sample
+    ret = symbiomon_remote_metric_aggregate(rh, 1e299, 1e300, &agg);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(agg.stats.count, ==, 0);
+
+    ret = symbiomon_remote_metric_handle_release(rh);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_metric_destroy(m, context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_downsample(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    symbiomon_metric_t m;
+    symbiomon_metric_id_t id;
+    symbiomon_metric_handle_t rh;
+    symbiomon_metric_buffer buf;
+    symbiomon_return_t ret;
+    int64_t count;
+    int i;
+    ret = symbiomon_metric_create("test", "downsample", SYMBIOMON_TYPE_GAUGE,
+            "downsample metric", context->taglist, &m, context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    for(i = 0; i < 10000; i++)
+        symbiomon_metric_update(m, (double)i);
+    ret = symbiomon_remote_metric_get_id("test", "downsample", context->taglist, &id);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_remote_metric_handle_create(context->client,
+            context->addr, provider_id, id, &rh);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    // LTTB keeps the first and last samples
+    count = 100;
+    ret = symbiomon_remote_metric_fetch_downsampled(rh, SYMBIOMON_DOWNSAMPLE_LTTB, &count, &buf);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(count, ==, 100);
+    munit_assert_double(buf[0].val, ==, 0.0);
+    munit_assert_double(buf[99].val, ==, 9999.0);
+    for(i = 1; i < count; i++)
+        munit_assert_double(buf[i].val, >, buf[i-1].val);
+    free(buf);
+    // the extremes survive min and max buckets
+    count = 100;
+    ret = symbiomon_remote_metric_fetch_downsampled(rh, SYMBIOMON_DOWNSAMPLE_MIN, &count, &buf);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(count, >, 0);
+    munit_assert_int(count, <=, 100);
+    munit_assert_double(buf[0].val, ==, 0.0);
+    free(buf);
+    count = 100;
+    ret = symbiomon_remote_metric_fetch_downsampled(rh, SYMBIOMON_DOWNSAMPLE_MAX, &count, &buf);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(count, >, 0);
+    munit_assert_int(count, <=, 100);
+    munit_assert_double(buf[count-1].val, ==, 9999.0);
+    free(buf);
+    count = 100;
+    ret = symbiomon_remote_metric_fetch_downsampled(rh, SYMBIOMON_DOWNSAMPLE_AVG, &count, &buf);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(count, <=, 100);
+    for(i = 0; i < count; i++) {
+        munit_assert_double(buf[i].val, >=, 0.0);
+        munit_assert_double(buf[i].val, <=, 9999.0);
+    }
+    free(buf);
+
+    ret = symbiomon_remote_metric_handle_release(rh);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_metric_destroy(m, context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_ifetch(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    symbiomon_metric_t m[4];
+    symbiomon_metric_id_t id;
+    symbiomon_metric_handle_t rh[4];
+    symbiomon_metric_buffer buf[4];
+    symbiomon_request_t reqs[4];
+    symbiomon_metric_id_t ids[16];
+    symbiomon_metric_id_t* pids = ids;
+    symbiomon_return_t ret;
+    int64_t counts[4];
+    size_t i, j, index, num_ids = 16;
+    int flag, done[4] = {0};
+    char name[32];
+    for(i = 0; i < 4; i++) {
+        sprintf(name, "ifetch%zu", i);
+        ret = symbiomon_metric_create("test", name, SYMBIOMON_TYPE_GAUGE,
+                "ifetch metric", context->taglist, &m[i], context->provider);
+        munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+        for(j = 0; j <= i; j++)
+            symbiomon_metric_update(m[i], (double)i);
+        ret = symbiomon_remote_metric_get_id("test", name, context->taglist, &id);
+        munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+        ret = symbiomon_remote_metric_handle_create(context->client,
+                context->addr, provider_id, id, &rh[i]);
+        munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    }
+    // all the fetches in flight at once, completed in any order
+    for(i = 0; i < 4; i++) {
+        counts[i] = 10;
+        ret = symbiomon_remote_metric_ifetch(rh[i], &counts[i], &buf[i], &reqs[i]);
+        munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    }
+    for(i = 0; i < 4; i++) {
+        ret = symbiomon_request_wait_any(4, reqs, &index);
+        munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+        munit_assert_int(index, <, 4);
+        munit_assert_null(reqs[index]);
+        munit_assert_false(done[index]);
+        done[index] = 1;
+        munit_assert_int(counts[index], ==, index + 1);
+        munit_assert_double(buf[index][0].val, ==, (double)index);
+        free(buf[index]);
+    }
+    // list, polling for completion
+    ret = symbiomon_remote_list_metrics_ilist(context->client, context->addr,
+            provider_id, &pids, &num_ids, &reqs[0]);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    do {
+        ret = symbiomon_request_test(reqs[0], &flag);
+        munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+        if(!flag) margo_thread_sleep(context->mid, 1.0);
+    } while(!flag);
+    ret = symbiomon_request_wait(reqs[0]);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(num_ids, ==, 4);
+
+    for(i = 0; i < 4; i++) {
+        ret = symbiomon_remote_metric_handle_release(rh[i]);
+        munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+        ret = symbiomon_metric_destroy(m[i], context->provider);
+        munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    }
+
+    return MUNIT_OK;
+}
+
+static MunitResult test_fanout(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    symbiomon_provider_t second;
+    symbiomon_metric_t m[2];
+    symbiomon_metric_id_t id;
+    symbiomon_fanout_result results[2];
+    symbiomon_fanout_sample* table;
+    symbiomon_metric_aggregate global;
+    symbiomon_return_t ret;
+    size_t n;
+    int i;
+    // the same metric on two providers
+    struct symbiomon_provider_args pargs = SYMBIOMON_PROVIDER_ARGS_INIT;
+    ret = symbiomon_provider_register(context->mid, provider_id + 1, &pargs, &second);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_metric_create("test", "fanout", SYMBIOMON_TYPE_GAUGE,
+            "fanout metric", context->taglist, &m[0], context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_metric_create("test", "fanout", SYMBIOMON_TYPE_GAUGE,
+            "fanout metric", context->taglist, &m[1], second);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    for(i = 1; i <= 100; i++)
+        symbiomon_metric_update(m[i > 50], (double)i);
+    ret = symbiomon_remote_metric_get_id("test", "fanout", context->taglist, &id);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+
+    symbiomon_target targets[2] = {
+        { context->addr, provider_id },
+        { context->addr, provider_id + 1 }
+    };
+    struct symbiomon_fanout_args args = SYMBIOMON_FANOUT_ARGS_INIT;
+    args.max_inflight = 1;
+    ret = symbiomon_remote_fanout_fetch(context->client, 2, targets, id, 100,
+            &args, results, &table, &n);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(n, ==, 100);
+    for(i = 0; i < 2; i++) {
+        munit_assert_int(results[i].ret, ==, SYMBIOMON_SUCCESS);
+        munit_assert_int(results[i].count, ==, 50);
+        munit_assert_double(results[i].latency, >, 0.0);
+    }
+    // merged by time, which follows the order of the updates
+    for(i = 0; i < 100; i++) {
+        munit_assert_double(table[i].val, ==, (double)(i + 1));
+        munit_assert_int(table[i].target, ==, i >= 50);
+    }
+    free(table);
+
+    ret = symbiomon_remote_fanout_aggregate(context->client, 2, targets, id, 0.0, 1e300,
+            NULL, results, &global);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(global.stats.count, ==, 100);
+    munit_assert_double_equal(global.stats.sum, 5050.0, 9);
+    munit_assert_double_equal(global.stats.mean, 50.5, 9);
+    munit_assert_double_equal(global.stats.variance, 833.25, 9);
+    munit_assert_double(global.stats.min, ==, 1.0);
+    munit_assert_double(global.stats.max, ==, 100.0);
+    munit_assert_double(results[1].aggregate.p50, ==, 75.0);
+
+    ret = symbiomon_metric_destroy(m[0], context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    symbiomon_provider_destroy(second);
+
+    return MUNIT_OK;
+}
+
+struct received {
+    symbiomon_metric_id_t id;
+    size_t count;
+    double vals[32];
+};
+
+static void on_samples(void* uarg, symbiomon_metric_id_t id, const symbiomon_metric_sample* samples, size_t count)
+{
+    struct received* r = (struct received*)uarg;
+    size_t i;
+    r->id = id;
+    for(i = 0; i < count && r->count < 32; i++)
+        r->vals[r->count++] = samples[i].val;
+}
+
+static MunitResult test_subscribe(const MunitParameter params[], void* data)
+{
+    (void)params;
+    struct test_context* context = (struct test_context*)data;
+    symbiomon_metric_t m, other;
+    symbiomon_metric_id_t id;
+    symbiomon_subscription_t sub;
+    symbiomon_return_t ret;
+    struct received r;
+    double batch[6];
+    int i;
+    memset(&r, 0, sizeof(r));
+    ret = symbiomon_metric_create("subscribed", "subscribe", SYMBIOMON_TYPE_GAUGE,
+            "subscribed metric", context->taglist, &m, context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_metric_create("test", "subscribe", SYMBIOMON_TYPE_GAUGE,
+            "other metric", context->taglist, &other, context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    // samples recorded before subscribing are not pushed
+    symbiomon_metric_update(m, -1.0);
+
+    struct symbiomon_subscription_args args = SYMBIOMON_SUBSCRIPTION_ARGS_INIT;
+    args.filter = SYMBIOMON_SUBSCRIBE_NAMESPACE;
+    args.pattern = "subscribed";
+    args.interval = 0.01;
+    args.batch_size = 4;
+    ret = symbiomon_remote_subscribe(context->client, context->addr, provider_id,
+            &args, on_samples, &r, &sub);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    margo_thread_sleep(context->mid, 10);
+    for(i = 0; i < 10; i++) {
+        symbiomon_metric_update(m, (double)i);
+        symbiomon_metric_update(other, (double)i);
+    }
+    // one timestamp for the whole batch, split across notifications
+    for(i = 0; i < 6; i++)
+        batch[i] = (double)(10 + i);
+    symbiomon_metric_update_batch(m, batch, 6);
+    // several batches of at most 4 samples, in order
+    margo_thread_sleep(context->mid, 200);
+    munit_assert_int(r.count, ==, 16);
+    ret = symbiomon_remote_metric_get_id("subscribed", "subscribe", context->taglist, &id);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    munit_assert_int(r.id, ==, id);
+    for(i = 0; i < 16; i++)
+        munit_assert_double(r.vals[i], ==, (double)i);
+
+    ret = symbiomon_remote_unsubscribe(sub);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    symbiomon_metric_update(m, 16.0);
+    margo_thread_sleep(context->mid, 50);
+    munit_assert_int(r.count, ==, 16);
+
+    ret = symbiomon_metric_destroy(other, context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+    ret = symbiomon_metric_destroy(m, context->provider);
+    munit_assert_int(ret, ==, SYMBIOMON_SUCCESS);
+
+    return MUNIT_OK;
+}
+
+static MunitTest test_suite_tests[] = {
+    { (char*) "/ring",     test_ring,     test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/columns",  test_columns,  test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/stats",    test_stats,    test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/shards",   test_shards,   test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/increment", test_increment, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/batch",    test_batch,    test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/pull",     test_pull,     test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/since",    test_since,    test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/multi",    test_multi,    test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/range",    test_range,    test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/aggregate", test_aggregate, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/downsample", test_downsample, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/subscribe", test_subscribe, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/ifetch",   test_ifetch,   test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/fanout",   test_fanout,   test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/history",  test_history,  test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/rollup",   test_rollup,   test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/fetch-encoded", test_fetch_encoded, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/histogram", test_histogram, test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { (char*) "/sketch",   test_sketch,   test_context_setup, test_context_tear_down, MUNIT_TEST_OPTION_NONE, NULL },
+    { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
+
+static const MunitSuite test_suite = {
+    (char*) "/symbiomon/metric", test_suite_tests, NULL, 1, MUNIT_SUITE_OPTION_NONE
+};
+
+int main(int argc, char* argv[MUNIT_ARRAY_PARAM(argc + 1)]) {
+    return munit_suite_main(&test_suite, (void*) "symbiomon", argc, argv);
+}